@@ -0,0 +1,58 @@
+#pragma once
+
+#include "tmc/simulator.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tmc {
+
+// One input's outcome in a batch
+struct BatchCase {
+  RunResult result{};
+  double ms = 0;          // wall time of the run
+  double done_ms = 0;     // when it finished, from the start of the batch
+  bool skipped = false;   // not counted: an earlier case stopped the batch
+};
+
+struct BatchOptions {
+  int64_t max_steps = 1000000;
+
+  // Engine settings for each worker's Simulator
+  SimConfig config;
+
+  // Measure each case into RunResult::metrics (RunOptions::metrics)
+  bool metrics = false;
+
+  // Expected cost of each input (say, its step count last time), for
+  // scheduling the longest first; empty: the input length
+  std::vector<int64_t> cost;
+
+  // A case still running after timeout_ms (0: no limit) of wall time,
+  // or of its thread's CPU time with cpu_timeout, is stopped there and
+  // comes back RunResult::timed_out
+  double timeout_ms = 0;
+  bool cpu_timeout = false;
+
+  // Once a case hits the step limit or times out, every case after it in
+  // input order is skipped: those running are stopped, those not started
+  // yet are never run, those already run are reported skipped all the
+  // same, so the outcome matches a run in input order
+  bool stop_on_limit = false;
+
+  // Called for each case in input order, as soon as it and every case
+  // before it are done (one call at a time, from a worker thread)
+  std::function<void(size_t index, const BatchCase& c)> on_case;
+};
+
+// Run every input against `tm` on `threads` worker threads (0: one per
+// hardware thread), each with its own Simulator. Inputs are dealt out
+// longest first to per-worker queues; an idle worker steals from the
+// back of another's. Results come back in input order.
+std::vector<BatchCase> RunBatch(std::shared_ptr<const CompiledTM> tm,
+                                const std::vector<std::string>& inputs, int threads,
+                                const BatchOptions& options = {});
+
+}  // namespace tmc
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "tmc/ir.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tmc {
+
+// A flat-engine run paused part way, with everything needed to carry on
+// to the same result: Execution::Resume (or Simulator::Resume) picks it
+// up on the machine it was taken from
+struct Checkpoint {
+  uint64_t tm_hash = 0;  // HashTM of the machine (set by whoever saves it)
+  std::string input;     // the input the run started from
+  int64_t max_steps = 0;
+  uint32_t state = 0;    // state ID, as CompiledTM numbers them
+  int64_t head = 0;
+  int64_t steps = 0;
+  std::vector<uint8_t> cells;  // symbol indices from cell 0 to the end of the visited tape
+};
+
+// Fingerprint of a machine's states, alphabets and transitions, to tell
+// whether a checkpoint belongs to it
+uint64_t HashTM(const TM& tm);
+
+// Write `ckpt` to `path`, input and tape run-length encoded. The file is written
+// under a temporary name and renamed over `path`, so an interrupted
+// save leaves the previous checkpoint intact. Throws std::runtime_error
+// if the file cannot be written.
+void SaveCheckpoint(const std::string& path, const Checkpoint& ckpt);
+
+// Read a checkpoint written by SaveCheckpoint. Throws std::runtime_error
+// if the file is missing, truncated or not a checkpoint.
+Checkpoint LoadCheckpoint(const std::string& path);
+
+}  // namespace tmc
@@ -8,6 +8,10 @@ namespace tmc {
 // Convert a TM to YAML format for Doty's simulator
 std::string ToYAML(const TM& tm);
 
+// Convert a TM to a standalone C++ program: one labeled block per state
+// switching on the head symbol, with the same results as Simulator::Run
+std::string ToCpp(const TM& tm);
+
 // Parse a TM from Doty's YAML format (.tm files)
 TM FromYAML(const std::string& yaml);
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace tmc {
+
+// Transition table for machines with many states and few transitions per
+// state. Entries are packed in one 32-bit word:
+//
+//   next state << 10 | write << 2 | dir code (0 = L, 1 = S, 2 = R, 3 = scan)
+//
+// where code 3 marks a scan state's loop entry (the caller knows its
+// direction). States with at least half their symbols listed keep a
+// dense row; the rest keep a CSR list of (symbol, entry) pairs, and any
+// symbol not listed takes the default entry. States with no transitions
+// at all share dense row 0, which holds only the default. Rows can also
+// be left unbuilt, sharing a row of code-3 entries, and filled in later
+// (SimConfig's lazy table build).
+class CompactTable {
+public:
+  static constexpr uint32_t kMaxStates = 1u << 22;
+  static constexpr uint32_t kScanCode = 3;
+
+  static uint32_t Pack(uint32_t next, uint8_t write, int8_t dir) {
+    return next << 10 | static_cast<uint32_t>(write) << 2 | static_cast<uint32_t>(dir + 1);
+  }
+  // Loop entry of a scan state reading `sym`
+  static uint32_t PackScan(uint32_t state, uint8_t sym) {
+    return state << 10 | static_cast<uint32_t>(sym) << 2 | kScanCode;
+  }
+  static uint32_t Next(uint32_t e) { return e >> 10; }
+  static uint8_t Write(uint32_t e) { return static_cast<uint8_t>(e >> 2); }
+  static uint32_t Code(uint32_t e) { return e & 3; }
+
+  // Start an empty table; unlisted symbols map to `default_entry`
+  void Reset(int num_symbols, uint32_t default_entry);
+
+  // Append the next state's row: its listed (symbol, entry) pairs
+  void AddRow(const std::vector<std::pair<uint8_t, uint32_t>>& entries);
+
+  // Append `n` states whose rows are not built yet; every symbol reads
+  // as a code-3 entry until SetRow fills the row in
+  void AddUnbuiltRows(uint32_t n);
+  void SetRow(uint32_t state, const std::vector<std::pair<uint8_t, uint32_t>>& entries);
+  bool Built(uint32_t state) const { return rows_[state] != unbuilt_row_; }
+
+  uint32_t Lookup(uint32_t state, uint32_t sym) const {
+    const uint32_t r = rows_[state];
+    if (!(r & kSparse)) return dense_[r + sym];
+    const uint32_t begin = r & ~kSparse;
+    const uint32_t end = begin + sparse_[begin];
+    for (uint32_t k = begin + 1; k <= end; ++k) {
+      if (sparse_syms_[k] == sym) return sparse_[k];
+    }
+    return default_entry_;
+  }
+
+  // Replace a listed entry (ClassifyScan marks loop entries this way)
+  void Set(uint32_t state, uint32_t sym, uint32_t entry);
+
+  uint32_t num_states() const { return static_cast<uint32_t>(rows_.size()); }
+  size_t Bytes() const {
+    return rows_.size() * 4 + dense_.size() * 4 + sparse_.size() * 5;
+  }
+
+private:
+  static constexpr uint32_t kSparse = 0x80000000u;
+  static constexpr uint32_t kNoRow = 0xffffffffu;
+
+  int num_symbols_ = 0;
+  uint32_t default_entry_ = 0;
+  uint32_t unbuilt_row_ = kNoRow;  // dense offset of the unbuilt row, once added
+
+  // Dense row offset, or kSparse | index of the row's length word in
+  // sparse_ (its entries follow, their symbols at the same indices in
+  // sparse_syms_)
+  std::vector<uint32_t> rows_;
+  std::vector<uint32_t> dense_;
+  std::vector<uint32_t> sparse_;
+  std::vector<uint8_t> sparse_syms_;
+};
+
+}  // namespace tmc
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "tmc/ir.hpp"
+#include "tmc/compact_table.hpp"
+#include "tmc/tape_scan.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tmc {
+
+struct RunMetrics;
+
+// Result of running a TM
+struct RunResult {
+  bool accepted;
+  int64_t steps;
+  std::string final_tape;  // tape contents at end
+  bool hit_limit;
+  bool timed_out = false;  // stopped early by RunOptions' deadline or stop flag
+  std::shared_ptr<const RunMetrics> metrics;  // with RunOptions::metrics (flat engine)
+};
+
+// Pre-expanded transition entry for flat table lookup
+struct FlatTransition {
+  uint32_t next;   // next state ID
+  uint8_t write;   // symbol index to write
+  int8_t dir;      // -1, 0, +1
+  uint8_t scan;    // 1 if this is the self-loop entry of a scan state
+};
+
+// Flat-engine table entry: `next_row` is the next state's ID already
+// multiplied by the padded row stride, so a step is one add and one load
+struct KernelTransition {
+  uint32_t next_row;
+  uint8_t write;
+  int8_t dir;
+};
+
+// Kernel rows with this bit mark a scan-state exit (low bits: state)
+constexpr uint32_t kScanRow = 0x80000000u;
+
+// Most steps the contiguous-tape engines (flat, jit, threaded) run
+// between updates of the tape extent
+constexpr int64_t kFlatChunk = int64_t{1} << 20;
+
+// A state that loops on a set of symbols, writing each back unchanged and
+// moving in one direction, until it reads one of its stop symbols
+struct ScanState {
+  int8_t dir;
+  StopSet stops;
+};
+
+// Tape representation and stepping strategy used by Run()
+enum class Engine {
+  Flat,   // contiguous tape, one table lookup per step (scan states skipped)
+  Rle,    // run-length encoded tape, self-loops consume whole runs at once
+  Macro,     // run-compressed tape of k-cell blocks, memoized block crossings
+  HashLife,  // hash-consed tape tree, crossings memoized at every 2^k scale
+  Jit,       // flat tape, table compiled to x86-64 code (Flat if unavailable)
+  Threaded,  // flat tape, computed-goto dispatch with superinstructions
+  Paged,     // fixed-size pages allocated on first write, flat kernel per page
+};
+
+// How CompiledTM fills its transition table
+enum class TableBuild {
+  Eager,     // every row up front, on one thread
+  Parallel,  // every row up front, states split across build_threads
+  Lazy,      // a row when a run first reaches its state (Engine::Flat
+             // only). The TM must outlive the table, and the table is
+             // not shared between threads (CompiledTM::Compile builds
+             // eagerly instead).
+};
+
+// Simulator configuration
+struct SimConfig {
+  Engine engine = Engine::Flat;
+
+  // Cells per macro-symbol for Engine::Macro (1..8)
+  int block_size = 8;
+
+  // Engine::Macro: cross a whole run of equal blocks in one jump when the
+  // head passes through one of them and comes out in the same state
+  bool shift_rule = true;
+
+  // Engine::HashLife: approximate memory cap for the node store and the
+  // crossing memo; past it the memo is dropped and dead nodes collected
+  size_t cache_mb = 1024;
+
+  // Engine::Flat and Step(): inputs of at least this many cells run on a
+  // tape packed 2 or 4 bits per cell when the alphabet is small enough.
+  // Packing costs a shift and mask per step, so it pays once the tape
+  // outgrows the L2 cache (0: always pack)
+  size_t pack_min_cells = size_t{1} << 18;
+
+  // Above this size (MiB) the dense transition tables give way to a
+  // CompactTable for Engine::Flat; the other engines always build the
+  // dense tables
+  size_t dense_table_mb = 64;
+
+  TableBuild table_build = TableBuild::Eager;
+
+  // TableBuild::Parallel: threads to use (0: one per hardware thread)
+  int build_threads = 0;
+
+  // Engine::Paged: log2 of the cells per page
+  int page_bits = 16;
+
+  // Engine::Threaded: steps to profile, over the first inputs run, for
+  // transition pairs worth fusing (0: static Dir::S chains only)
+  int64_t profile_steps = 1 << 20;
+
+  // Step() and RunUntil(): snapshot the configuration every
+  // history_steps steps for StepBack() and GoToStep(), in at most
+  // history_mb MiB. Past the budget every other snapshot is dropped and
+  // the interval doubles (history_mb 0: no snapshots; going back then
+  // replays from the input).
+  size_t history_mb = 256;
+  int64_t history_steps = 1 << 16;
+};
+
+// A TM compiled to the simulator's tables: symbol and state IDs, the
+// transition table (dense, or a CompactTable for large machines), the
+// flat-engine kernel tables and the scan-state classes. Nothing in it
+// changes while inputs run (apart from a lazy build filling in rows), so
+// one CompiledTM, held through a shared_ptr, can back any number of
+// Executions on any number of threads.
+class CompiledTM {
+public:
+  // Compile `tm` with the table layout SimConfig asks for
+  explicit CompiledTM(const TM& tm, const SimConfig& config = {});
+
+  // A table to share between threads: as above, but never built lazily
+  static std::shared_ptr<const CompiledTM> Compile(const TM& tm, const SimConfig& config = {});
+
+  int num_states() const { return num_states_; }
+  int num_symbols() const { return num_symbols_; }
+
+  // Name of state ID `id`, and the symbol with index `idx`
+  const State& state_name(uint32_t id) const { return id_to_state_[id]; }
+  Symbol symbol(uint8_t idx) const { return idx_to_char_[idx]; }
+  const SimConfig& config() const { return config_; }
+
+  // True when the dense tables every engine can use are built
+  bool dense() const { return !table_.empty(); }
+
+  // Build the dense tables (and any rows a lazy build has left) if not
+  // done yet
+  void ExpandTable();
+
+private:
+  friend class Simulator;
+  friend class Execution;
+  friend class Lockstep;
+  friend class TraceRecorder;
+  friend class Profiler;
+
+  void BuildTable(const TM& tm);
+  void BuildKernel();
+
+  // ID of a state name (reject_id_ if it is not a state)
+  uint32_t StateId(const State& name) const;
+
+  // The listed entries of a row: (symbol index, transition) for each
+  // symbol `trans` (null: none) covers
+  void ResolveRow(const TransitionMap* trans,
+                  std::vector<std::pair<uint8_t, FlatTransition>>& row) const;
+
+  // Fill every row from trans[state], into compact_ or table_, on one or
+  // (TableBuild::Parallel) several threads
+  void BuildRows(const std::vector<const TransitionMap*>& trans, bool compact);
+
+  // TableBuild::Lazy: fill in compact_'s row for `state` from lazy_tm_
+  void BuildRow(uint32_t state) const;
+
+  // Give a running state its scan class if it is a scan state, marking
+  // its loop entries in compact_ (the caller marks them in table_).
+  // Returns whether it is one.
+  bool ClassifyScan(uint32_t state) const;
+
+  // Transition for (state, symbol index) from whichever table is built
+  FlatTransition Entry(uint32_t state, uint32_t sym) const;
+
+  // The pieces of a step for loops that take one at a time (profiling,
+  // tracing, metrics) rather than calling a kernel:
+  //
+  // Entry, building the row first if a lazy build has not yet
+  FlatTransition Lookup(uint32_t state, uint32_t sym) const {
+    if (!table_.empty()) return table_[state * num_symbols_ + sym];
+    if (!compact_.Built(state)) BuildRow(state);
+    return Entry(state, sym);
+  }
+
+  // Grow a tape of one byte per cell, doubling, until cell `head` is on it
+  void GrowTape(std::vector<uint8_t>& tape, int64_t head) const {
+    if (static_cast<size_t>(head) < tape.size()) return;
+    tape.resize(std::max(tape.size() * 2, static_cast<size_t>(head + 1)), blank_idx_);
+  }
+
+  // Cells [0, n) as characters with the blanks at either end trimmed,
+  // where cell(i) is the symbol index in cell i
+  template <typename CellAt>
+  std::string DecodeTape(size_t n, CellAt cell) const {
+    size_t left = 0, right = n;
+    while (left < right && cell(left) == blank_idx_) ++left;
+    while (right > left && cell(right - 1) == blank_idx_) --right;
+    std::string out(right - left, '\0');
+    for (size_t i = left; i < right; ++i) out[i - left] = idx_to_char_[cell(i)];
+    return out;
+  }
+  std::string DecodeTape(const std::vector<uint8_t>& tape) const {
+    return DecodeTape(tape.size(), [&](size_t i) { return tape[i]; });
+  }
+
+  // Flat-engine inner loop, specialized on the padded row stride (0 for
+  // alphabets too large to pad) and the tape's bits per cell (8, or 2/4
+  // for a packed tape, where `head` still counts cells). Runs at most n
+  // steps and stops early on a halt or a scan-state loop entry (counted
+  // as a step). Returns the steps taken.
+  template <int kStride, int kBits = 8>
+  int64_t RunKernel(uint8_t* tape, int64_t& head, uint32_t& row, int64_t n) const;
+  using Kernel = int64_t (CompiledTM::*)(uint8_t*, int64_t&, uint32_t&, int64_t) const;
+
+  // RunKernel over `tbl`, a table laid out like kernel_table_ (the
+  // debugger's copy with breakpoint entries patched in). Any row at or
+  // past the halt row ends the run, after its step.
+  template <int kStride, int kBits = 8>
+  int64_t RunTableKernel(const KernelTransition* tbl, uint8_t* tape, int64_t& head, uint32_t& row,
+                         int64_t n) const;
+  using TableKernel = int64_t (CompiledTM::*)(const KernelTransition*, uint8_t*, int64_t&,
+                                               uint32_t&, int64_t) const;
+
+  // RunKernel over compact_, where rows are state IDs
+  int64_t RunCompactKernel(uint8_t* tape, int64_t& head, uint32_t& state, int64_t n) const;
+
+  // Jump a scan state reading one of its loop symbols to the next stop
+  // symbol, within `max` steps in all; cells from `size` on are blank.
+  // The tape holds `bits` bits per cell. Returns false if it runs
+  // forever.
+  bool SkipScan(const uint8_t* tape, size_t size, int64_t& head, uint32_t state,
+                int64_t& steps, int64_t max, int bits = 8) const;
+
+  SimConfig config_;
+
+  // Flat transition table: table_[state_id * num_symbols_ + symbol_idx]
+  int num_states_;
+  int num_symbols_;
+  uint32_t start_id_;
+  uint32_t accept_id_;
+  uint32_t reject_id_;
+  uint32_t halt_threshold_;  // min(accept_id, reject_id)
+  std::vector<FlatTransition> table_;
+
+  // Packed dense rows and CSR lists, used instead of table_ (then empty)
+  // when the dense tables would be over SimConfig::dense_table_mb. A lazy
+  // build fills rows in as runs reach them, hence mutable along with the
+  // scan classes below.
+  mutable CompactTable compact_;
+
+  // TableBuild::Lazy: the machine unbuilt rows come from (null once
+  // every row is built)
+  const TM* lazy_tm_ = nullptr;
+
+  // The flat engine's copy of table_ with rows padded to a power of two
+  // (kernel_table_[state_id * kernel_stride_ + symbol_idx]) and the
+  // kernel chosen for that stride
+  std::vector<KernelTransition> kernel_table_;
+  uint32_t kernel_stride_ = 1;
+  uint32_t kernel_halt_row_ = 0;  // halt_threshold_ * kernel_stride_
+  Kernel kernel_ = nullptr;
+  TableKernel table_kernel_ = nullptr;
+
+  // Packed tape: bits per cell for this alphabet (2 up to 4 symbols, 4 up
+  // to 16, else 8 = unpacked) and the kernel for it
+  int tape_bits_ = 8;
+  Kernel packed_kernel_ = nullptr;
+  TableKernel packed_table_kernel_ = nullptr;
+
+  // Scan states: scan_class_[state_id] indexes scan_classes_ for entries
+  // flagged FlatTransition::scan (states share a class when their loop
+  // symbols and direction match)
+  mutable std::vector<uint32_t> scan_class_;
+  mutable std::vector<ScanState> scan_classes_;
+  mutable std::map<std::pair<int8_t, std::vector<bool>>, uint32_t> scan_class_ids_;
+
+  // Symbol mapping
+  uint8_t char_to_idx_[256];
+  std::vector<char> idx_to_char_;
+  uint8_t blank_idx_;
+
+  // State mapping (for CurrentConfig/Accepted)
+  std::vector<State> id_to_state_;
+};
+
+}  // namespace tmc
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "tmc/compiled_tm.hpp"
+#include "tmc/checkpoint.hpp"
+#include "tmc/metrics.hpp"
+#include "tmc/virtual_tape.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tmc {
+
+// Where a run was when sampled, for RunOptions::on_sample
+struct Sample {
+  int64_t steps = 0;
+  uint32_t state = 0;   // state ID, as CompiledTM numbers them
+  uint8_t symbol = 0;   // symbol index under the head
+  int64_t head = 0;
+  int64_t weight = 1;   // sample points it stands for (a scan can cross several)
+};
+
+// Per-run choices for Execution::Run
+struct RunOptions {
+  // Decode the tape into RunResult::final_tape. Callers that only need
+  // the verdict and step count skip a pass over the whole tape (and the
+  // string it fills).
+  bool final_tape = true;
+
+  // Give up once the wall clock passes `deadline`, the running thread
+  // has spent cpu_ms of CPU time on this run (0: no limit), or `stop` is
+  // set from another thread. The run returns what it has so far, marked
+  // RunResult::timed_out. All three are polled every check_steps steps,
+  // so a run overshoots by at most that many (a few milliseconds).
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  double cpu_ms = 0;
+  const std::atomic<bool>* stop = nullptr;
+  int64_t check_steps = int64_t{1} << 20;
+
+  // Flat engine: pass the running configuration to on_checkpoint every
+  // checkpoint_steps steps and every checkpoint_ms milliseconds (0: not
+  // by that measure), and once more if the run is stopped early
+  std::function<void(Checkpoint&)> on_checkpoint;
+  int64_t checkpoint_steps = 0;
+  double checkpoint_ms = 0;
+
+  // Flat engine: pass on_sample the running configuration every
+  // sample_steps steps (0: not by count), and once soon after
+  // *sample_now is set (a timer signal handler can set it): the run
+  // notices within kFlatChunk steps, clears it and samples at an
+  // arbitrary step up to 65536 further on. A scan is sampled where it
+  // ends.
+  std::function<void(const Sample&)> on_sample;
+  int64_t sample_steps = 0;
+  std::atomic<bool>* sample_now = nullptr;
+
+  // Flat engine: measure the run's space and head movement into
+  // RunResult::metrics. The run takes a loop of its own, one step at a
+  // time apart from scans, several times slower than the kernel; it
+  // skips checkpoints and samples.
+  bool metrics = false;
+};
+
+// When RunOptions' next checkpoint is due. The clock is read at most
+// once per kPollSteps steps.
+class CheckpointTimer {
+public:
+  CheckpointTimer(const RunOptions& options, int64_t steps);
+
+  // True when a checkpoint is due at `steps`; the next one is then timed
+  // from here
+  bool Due(int64_t steps);
+
+private:
+  static constexpr int64_t kPollSteps = int64_t{1} << 20;
+
+  int64_t every_steps_ = 0;
+  int64_t next_steps_ = INT64_MAX;
+  std::chrono::steady_clock::duration every_{};
+  std::chrono::steady_clock::time_point next_time_;
+  int64_t next_poll_ = INT64_MAX;
+};
+
+// A run's view of RunOptions' deadline and stop flag. Engines call
+// Expired() as their step count grows; until the next check_steps
+// boundary that is one compare.
+class RunWatch {
+public:
+  RunWatch() = default;
+  explicit RunWatch(const RunOptions& options);
+
+  bool Expired(int64_t steps) { return steps >= next_check_ && Check(steps); }
+
+  // Whether the run was stopped
+  bool expired() const { return expired_; }
+
+private:
+  bool Check(int64_t steps);
+
+  std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max();
+  double cpu_end_ms_ = 0;  // thread CPU time to stop at (0: none)
+  const std::atomic<bool>* stop_ = nullptr;
+  int64_t check_steps_ = 0;
+  int64_t next_check_ = INT64_MAX;
+  bool expired_ = false;
+};
+
+// Runs inputs on the flat engine against a shared CompiledTM. The tape
+// and the input buffer belong to the Execution and are reused from run
+// to run, so after the first run an input costs no allocation beyond
+// the final tape string. Use one Execution per thread; any number of
+// them can share one CompiledTM.
+class Execution {
+public:
+  explicit Execution(std::shared_ptr<const CompiledTM> tm, int64_t max_steps = 1000000);
+
+  RunResult Run(const std::string& input, const RunOptions& options = {});
+
+  // Carry on from a checkpoint taken on this machine (with the same
+  // max_steps, for the same result). Throws std::runtime_error if the
+  // checkpoint's state or symbols are out of range.
+  RunResult Resume(const Checkpoint& ckpt, const RunOptions& options = {});
+
+  const CompiledTM& tm() const { return *tm_; }
+  int64_t max_steps() const { return max_steps_; }
+
+  // Whether the tape got its address-space reservation (without it the
+  // tape is a heap buffer that doubles as the head moves right)
+  bool reserved() { return tape_.Reserved(); }
+
+private:
+  // Run from state `state_id` with the head at `head` after `steps`
+  // steps, on the tape in cells_
+  RunResult RunFrom(const std::string& input, uint32_t state_id, int64_t head, int64_t steps,
+                    const RunOptions& options);
+
+  // RunFrom for RunOptions::metrics
+  RunResult RunMeasured(uint32_t state_id, int64_t head, int64_t steps, const RunOptions& options);
+
+  std::shared_ptr<const CompiledTM> tm_;
+  int64_t max_steps_;
+  VirtualTape tape_;
+  std::vector<uint8_t> cells_;
+};
+
+}  // namespace tmc
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "tmc/simulator.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tmc {
+
+// Machine state passed in and out of JIT code (field offsets are baked
+// into the generated code)
+struct JitState {
+  uint8_t* tape;
+  int64_t head;
+  int64_t size;    // code exits before reading at head >= size
+  int64_t budget;  // steps left; code exits when it reaches 0
+  uint32_t state;
+};
+
+// Native x86-64 code for a flat transition table: one block per running
+// state that checks the budget and tape end, then jumps through a
+// per-state table indexed by the head symbol to a stub that writes,
+// moves and continues in the next state's block.
+//
+// Code returns to the caller when the machine halts, the budget runs out,
+// the head reaches `size`, or a scan state reads one of its loop symbols
+// (FlatTransition::scan), which the caller skips over itself.
+class JitProgram {
+public:
+  // Table entries above which no code is generated
+  static constexpr size_t kMaxEntries = size_t{1} << 16;
+
+  // Null on hosts other than x86-64 Linux, for tables over kMaxEntries,
+  // or if executable memory cannot be mapped
+  static std::unique_ptr<JitProgram> Compile(const std::vector<FlatTransition>& table,
+                                             int num_symbols, uint32_t halt_threshold);
+
+  ~JitProgram();
+  JitProgram(const JitProgram&) = delete;
+  JitProgram& operator=(const JitProgram&) = delete;
+
+  // Run from s.state (a running state) with s.head < s.size
+  void Run(JitState& s) const;
+
+  size_t CodeSize() const { return size_; }
+
+private:
+  JitProgram(void* code, size_t size) : code_(code), size_(size) {}
+
+  void* code_;
+  size_t size_;
+};
+
+}  // namespace tmc
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "tmc/execution.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tmc {
+
+// Runs many short inputs against one CompiledTM at once, a vector lane
+// per input: two vectors of 16 lanes with AVX-512, two of 8 with AVX2
+// (the second vector's gathers overlap the first's), or a plain loop
+// over 8 without either. Each lane has its own state, head and tape,
+// and a step is two gathers (the cells under the heads, then their
+// table entries) for every lane together; halted lanes are masked out
+// and refilled with the next input. Aggregate throughput on thousands of
+// short inputs (exhaustive checks over every string up to some length)
+// is well above one Execution::Run per input, which pays a tape setup
+// and a chunked kernel call for a few dozen steps.
+//
+// Results match the flat engine's exactly. Inputs too long for a lane,
+// lanes whose head runs off the end of their tape, and machines too
+// large for the packed lane table are run on an Execution instead.
+class Lockstep {
+public:
+  explicit Lockstep(std::shared_ptr<const CompiledTM> tm, int64_t max_steps = 1000000);
+
+  // Results in input order. RunOptions' deadline and stop flag (and
+  // cpu_ms) cover the whole batch: once they pass, the inputs still
+  // running and those not started come back timed out.
+  std::vector<RunResult> Run(const std::vector<std::string>& inputs,
+                             const RunOptions& options = {});
+
+  // Inputs run side by side (0: the machine is too large, every input
+  // runs on the Execution)
+  int lanes() const { return lanes_; }
+
+private:
+  std::shared_ptr<const CompiledTM> tm_;
+  int64_t max_steps_;
+  Execution fallback_;
+  int lanes_ = 0;
+
+  // table_[(state_id << shift_) + symbol]: next state's row << 10 |
+  // write << 2 | dir + 1. Halted states keep their rows so parked
+  // lanes gather in bounds.
+  std::vector<uint32_t> table_;
+  int shift_ = 0;
+  uint32_t start_row_ = 0;
+  uint32_t halt_row_ = 0;
+
+  // Lane tapes, one cell per 32-bit word so a gather reads exactly one
+  // cell (and the AVX-512 scatter writes exactly one)
+  std::vector<uint32_t> tape_;
+};
+
+}  // namespace tmc
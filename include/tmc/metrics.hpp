@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace tmc {
+
+// Head visits over a run as a space-time histogram: row r counts the
+// steps in [r * row_steps, (r + 1) * row_steps), column c the cells in
+// [c * col_cells, (c + 1) * col_cells). Both spans start at 1 and double,
+// merging neighbours, whenever the run outgrows max_rows rows or
+// max_cols columns, so a run of any length and width fits.
+class Heatmap {
+public:
+  explicit Heatmap(int max_rows = 256, int max_cols = 256);
+
+  // One step taken with the head at `cell`
+  void Visit(int64_t step, int64_t cell) {
+    int64_t r = step >> row_shift_;
+    int64_t c = cell >> col_shift_;
+    if (r >= max_rows_ || c >= max_cols_) {
+      Fit(r, c);
+      r = step >> row_shift_;
+      c = cell >> col_shift_;
+    }
+    if (r >= rows_) rows_ = static_cast<int>(r) + 1;
+    if (c >= cols_) cols_ = static_cast<int>(c) + 1;
+    ++visits_[r * max_cols_ + c];
+  }
+
+  // n steps from `step` on, the head starting at `cell` and moving one
+  // cell in direction `dir` each step (staying put at cell 0 when dir
+  // is left), as one bucket update per row or column crossed
+  void VisitRun(int64_t step, int64_t cell, int dir, int64_t n);
+
+  // Rows and columns in use
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int64_t row_steps() const { return int64_t{1} << row_shift_; }
+  int64_t col_cells() const { return int64_t{1} << col_shift_; }
+  int64_t at(int row, int col) const { return visits_[static_cast<size_t>(row) * max_cols_ + col]; }
+
+private:
+  // Double the spans until (r, c) fits
+  void Fit(int64_t r, int64_t c);
+
+  int max_rows_;
+  int max_cols_;
+  int rows_ = 0;
+  int cols_ = 0;
+  int row_shift_ = 0;
+  int col_shift_ = 0;
+  std::vector<int64_t> visits_;  // max_rows_ x max_cols_
+};
+
+// Space and head movement of a run (RunOptions::metrics)
+struct RunMetrics {
+  int64_t max_head = 0;         // furthest cell the head reached
+  int64_t cells_written = 0;    // distinct cells a step changed the symbol of
+  int64_t reversals = 0;        // times the head turned around
+  int64_t travel = 0;           // cells the head moved in all
+  int64_t peak_tape_bytes = 0;  // the widest tape, at the flat engine's bits per cell
+  Heatmap heatmap;
+};
+
+// Write a heatmap as a binary PGM image, time down and tape across,
+// log-scaled so rarely visited cells still show
+void WriteHeatmapPGM(std::ostream& out, const Heatmap& map);
+
+// Write a heatmap as CSV, one row per visited (row, column) bucket
+void WriteHeatmapCSV(std::ostream& out, const Heatmap& map);
+
+}  // namespace tmc
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tmc {
+
+// Tape cells packed kBits (2 or 4) to a byte: cell i lives in byte
+// i * kBits / 8, lowest cell in the lowest bits. Symbol index 0 (blank)
+// packs to zero bits, so zero-filled memory still reads as blank tape.
+template <int kBits>
+inline uint32_t GetPacked(const uint8_t* tape, size_t cell) {
+  constexpr int kShift = kBits == 2 ? 2 : 1;  // log2(cells per byte)
+  const unsigned sh = static_cast<unsigned>(cell & ((1u << kShift) - 1)) * kBits;
+  return (tape[cell >> kShift] >> sh) & ((1u << kBits) - 1);
+}
+
+template <int kBits>
+inline void SetPacked(uint8_t* tape, size_t cell, uint32_t sym) {
+  constexpr int kShift = kBits == 2 ? 2 : 1;
+  constexpr uint32_t kMask = (1u << kBits) - 1;
+  const unsigned sh = static_cast<unsigned>(cell & ((1u << kShift) - 1)) * kBits;
+  uint8_t& b = tape[cell >> kShift];
+  b = static_cast<uint8_t>((b & ~(kMask << sh)) | (sym << sh));
+}
+
+// Runtime-width access for 2, 4 or 8 bits per cell
+inline uint32_t GetCell(const uint8_t* tape, size_t cell, int bits) {
+  switch (bits) {
+    case 2: return GetPacked<2>(tape, cell);
+    case 4: return GetPacked<4>(tape, cell);
+    default: return tape[cell];
+  }
+}
+
+inline void SetCell(uint8_t* tape, size_t cell, int bits, uint32_t sym) {
+  switch (bits) {
+    case 2: SetPacked<2>(tape, cell, sym); break;
+    case 4: SetPacked<4>(tape, cell, sym); break;
+    default: tape[cell] = static_cast<uint8_t>(sym);
+  }
+}
+
+// Bytes holding `cells` cells
+inline size_t PackedBytes(size_t cells, int bits) {
+  return (cells * static_cast<size_t>(bits) + 7) / 8;
+}
+
+// Pack `n` one-byte symbol indices at `bits` per cell over themselves
+// (cell i lands in byte i * bits / 8 <= i, after that byte was read).
+// Returns the packed bytes.
+inline size_t PackCellsInPlace(uint8_t* cells, size_t n, int bits) {
+  if (bits == 8) return n;
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t sym = cells[i];
+    if ((i * bits) % 8 == 0) cells[i * bits / 8] = 0;
+    SetCell(cells, i, bits, sym);
+  }
+  return PackedBytes(n, bits);
+}
+
+// Pack one-byte symbol indices at `bits` per cell
+inline std::vector<uint8_t> PackCells(const uint8_t* cells, size_t n, int bits) {
+  std::vector<uint8_t> out(PackedBytes(n, bits), 0);
+  for (size_t i = 0; i < n; ++i) SetCell(out.data(), i, bits, cells[i]);
+  return out;
+}
+
+}  // namespace tmc
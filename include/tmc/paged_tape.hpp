@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tmc {
+
+// Left-bounded tape of fixed-size pages of one-byte cells, allocated on
+// first write. Pages never written read as one shared all-blank page
+// (symbol index 0), so memory follows the cells actually touched rather
+// than the furthest head position, and growing the tape never copies it.
+class PagedTape {
+public:
+  explicit PagedTape(int page_bits)
+      : page_bits_(page_bits), page_cells_(size_t{1} << page_bits),
+        blank_(new uint8_t[page_cells_]()) {}
+
+  int page_bits() const { return page_bits_; }
+  size_t page_cells() const { return page_cells_; }
+
+  // Pages [0, pages()) may have been written; all later ones are blank
+  size_t pages() const { return pages_.size(); }
+  bool Written(size_t page) const { return page < pages_.size() && pages_[page]; }
+  size_t WrittenPages() const { return written_; }
+
+  // Cells of `page`, the shared blank page if it was never written
+  const uint8_t* Read(size_t page) const {
+    return Written(page) ? pages_[page].get() : blank_.get();
+  }
+
+  // Cells of `page`, allocating it (all blank) on first use
+  uint8_t* Write(size_t page) {
+    if (page >= pages_.size()) pages_.resize(page + 1);
+    if (!pages_[page]) {
+      pages_[page].reset(new uint8_t[page_cells_]());
+      ++written_;
+    }
+    return pages_[page].get();
+  }
+
+  // Copy `n` cells to the start of the tape
+  void Assign(const uint8_t* cells, size_t n) {
+    for (size_t i = 0; i < n; i += page_cells_) {
+      uint8_t* page = Write(i >> page_bits_);
+      for (size_t j = 0; j < page_cells_ && i + j < n; ++j) page[j] = cells[i + j];
+    }
+  }
+
+private:
+  int page_bits_;
+  size_t page_cells_;
+  std::unique_ptr<uint8_t[]> blank_;
+  std::vector<std::unique_ptr<uint8_t[]>> pages_;
+  size_t written_ = 0;
+};
+
+}  // namespace tmc
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "tmc/compiled_tm.hpp"
+#include "tmc/execution.hpp"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tmc {
+
+// Steps taken in one state over a profile
+struct StateHits {
+  State state;
+  int64_t hits = 0;
+};
+
+// Times one (state, symbol) transition fired over a profile
+struct TransitionHits {
+  State state;
+  Symbol read;
+  Symbol write;
+  Dir dir;
+  State next;
+  int64_t hits = 0;
+};
+
+// Runs inputs like the flat engine, but one step at a time through its
+// own loop (scans included), counting every transition that fires. The
+// plain engines carry no counters, so profiling costs a normal run
+// nothing. Counts add up over runs until Clear.
+class Profiler {
+public:
+  explicit Profiler(std::shared_ptr<const CompiledTM> tm, int64_t max_steps = 1000000);
+
+  // Run `input`, adding its steps to the counts. RunOptions' deadline and
+  // stop flag end the run early.
+  RunResult Run(const std::string& input, const RunOptions& options = {});
+
+  int64_t runs() const { return runs_; }
+  int64_t steps() const { return steps_; }
+
+  // Counts so far, most hits first; states never run and transitions
+  // never fired are left out
+  std::vector<StateHits> States() const;
+  std::vector<TransitionHits> Transitions() const;
+
+  void Clear();
+
+private:
+  std::shared_ptr<const CompiledTM> tm_;
+  int64_t max_steps_;
+  std::vector<int64_t> hits_;  // hits_[state_id * num_symbols + symbol_idx]
+  std::vector<uint8_t> tape_;
+  int64_t runs_ = 0;
+  int64_t steps_ = 0;
+};
+
+// Samples of one (state, symbol) with the head in [head_lo, head_hi]
+struct SampleBin {
+  State state;
+  Symbol symbol;
+  int64_t head_lo = 0;
+  int64_t head_hi = 0;
+  int64_t samples = 0;
+};
+
+// Samples over steps [first_step, end_step) of a run, most first
+struct SamplePhase {
+  int64_t first_step = 0;
+  int64_t end_step = 0;
+  int64_t samples = 0;
+  int64_t max_head = 0;
+  std::vector<SampleBin> bins;
+};
+
+// A sampled profile for runs too long to count every step. Fed from
+// RunOptions::on_sample, it keeps a histogram of (state, symbol, head
+// bucket) for each phase of the run; head buckets double in width
+// (0, 1, 2-3, 4-7, ...). Phases are equal spans of phase_steps steps.
+// When a run outgrows max_phases of them, neighbours merge and the span
+// doubles, so any run length ends up in at most max_phases phases.
+class SampleProfile {
+public:
+  explicit SampleProfile(std::shared_ptr<const CompiledTM> tm,
+                         int64_t phase_steps = int64_t{1} << 24, size_t max_phases = 32);
+
+  void Add(const Sample& sample);
+
+  int64_t samples() const { return samples_; }
+  int64_t phase_steps() const { return phase_steps_; }
+
+  // Phases in step order, those without samples left out
+  std::vector<SamplePhase> Phases() const;
+
+  // All samples as one phase
+  SamplePhase Total() const;
+
+private:
+  struct Phase {
+    int64_t samples = 0;
+    int64_t max_head = 0;
+    std::map<uint64_t, int64_t> bins;  // (state << 16 | symbol << 8 | bucket) -> samples
+  };
+  SamplePhase Describe(const Phase& phase, int64_t first_step, int64_t end_step) const;
+
+  std::shared_ptr<const CompiledTM> tm_;
+  int64_t phase_steps_;
+  size_t max_phases_;
+  std::vector<Phase> phases_;
+  int64_t samples_ = 0;
+};
+
+// Write a profile as CSV: one row per state, then one per transition,
+// each with its hits and its share of all steps
+void WriteProfileCSV(std::ostream& out, const Profiler& profile);
+
+// The same as a JSON object: {"runs", "steps", "states": [...],
+// "transitions": [...]}
+void WriteProfileJSON(std::ostream& out, const Profiler& profile);
+
+// Write a sampled profile as CSV: the whole run's bins (phase "all"),
+// then each phase's, with their share of the phase's samples
+void WriteSamplesCSV(std::ostream& out, const SampleProfile& profile);
+
+}  // namespace tmc
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace tmc {
+
+// A maximal run of one tape symbol (a cell's symbol index, or a packed
+// block of cells for the macro engine)
+template <typename Sym>
+struct TapeRun {
+  Sym sym;
+  int64_t len;
+};
+
+// Run-length encoded, left-bounded tape as two stacks around the head.
+//
+//   left_:  runs left of the head, back() adjacent to the head
+//   right_: runs from the head rightwards, back() holds the head cell as
+//           its first cell; the bottom run is the endless blank tail
+//
+// Pushes merge with an equal-symbol neighbor, so adjacent runs within a
+// stack always differ and back() is the whole run the head sits in (on
+// the right) or next to (on the left).
+template <typename Sym>
+class RunTape {
+public:
+  // Length of the blank run standing in for the unbounded right end.
+  // Large enough that no step budget can exhaust it, small enough not to
+  // overflow when merged with a finite run.
+  static constexpr int64_t kEndless = std::numeric_limits<int64_t>::max() / 4;
+
+  RunTape(const std::vector<Sym>& cells, Sym blank) : blank_(blank) {
+    right_.push_back({blank, kEndless});
+    for (auto it = cells.rbegin(); it != cells.rend(); ++it) Push(right_, *it, 1);
+  }
+
+  Sym Read() const { return right_.back().sym; }
+
+  // Head is on cell 0
+  bool AtLeftEnd() const { return left_.empty(); }
+
+  // One step: write the head cell and move (-1, 0, +1)
+  void WriteMove(Sym w, int dir) {
+    Take(right_, 1);
+    if (dir > 0) {
+      Push(left_, w, 1);
+    } else if (dir < 0 && !left_.empty()) {
+      Push(right_, w, 1);
+      Take(left_, 1);
+      Push(right_, taken_, 1);
+    } else {
+      // Stay, or move left pinned at cell 0
+      Push(right_, w, 1);
+    }
+  }
+
+  // Cells the head can cross in `dir` while still reading its own symbol,
+  // counting the head cell
+  int64_t RunAhead(int dir) const {
+    if (dir > 0) return right_.back().len;
+    return 1 + (LeftRunMatches() ? left_.back().len : 0);
+  }
+
+  // RunAhead(-1) extends all the way to cell 0
+  bool RunReachesLeftEnd() const {
+    return left_.empty() || (left_.size() == 1 && LeftRunMatches());
+  }
+
+  // Apply m steps of a self-loop that writes w and moves in dir across
+  // the current run (m <= RunAhead(dir)). Returns false if the head ends
+  // pinned at cell 0.
+  bool CrossRun(Sym w, int dir, int64_t m) {
+    if (dir > 0) {
+      Take(right_, m);
+      Push(left_, w, m);
+      return true;
+    }
+    Take(right_, 1);
+    if (m > 1) Take(left_, m - 1);
+    Push(right_, w, m);
+    if (left_.empty()) return false;
+    Take(left_, 1);
+    Push(right_, taken_, 1);
+    return true;
+  }
+
+  // Runs from cell 0 rightwards, with blank runs trimmed from both ends.
+  // Trimming works on whole runs so a blank run the head swept out to
+  // the step limit is never expanded.
+  std::vector<TapeRun<Sym>> Runs() const {
+    std::vector<TapeRun<Sym>> runs(left_.begin(), left_.end());
+    runs.insert(runs.end(), right_.rbegin(), right_.rend());
+    size_t first = 0, last = runs.size();
+    while (first < last && runs[first].sym == blank_) ++first;
+    while (last > first && runs[last - 1].sym == blank_) --last;
+    return std::vector<TapeRun<Sym>>(runs.begin() + first, runs.begin() + last);
+  }
+
+private:
+  bool LeftRunMatches() const {
+    return !left_.empty() && left_.back().sym == right_.back().sym;
+  }
+
+  static void Push(std::vector<TapeRun<Sym>>& stack, Sym sym, int64_t n) {
+    if (!stack.empty() && stack.back().sym == sym) {
+      stack.back().len += n;
+    } else {
+      stack.push_back({sym, n});
+    }
+  }
+
+  // Remove n cells from the top run (n <= its length); remembers the symbol
+  void Take(std::vector<TapeRun<Sym>>& stack, int64_t n) {
+    TapeRun<Sym>& top = stack.back();
+    taken_ = top.sym;
+    top.len -= n;
+    if (top.len == 0) stack.pop_back();
+  }
+
+  Sym blank_;
+  std::vector<TapeRun<Sym>> left_;
+  std::vector<TapeRun<Sym>> right_;
+  Sym taken_{};
+};
+
+}  // namespace tmc
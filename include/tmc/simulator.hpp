@@ -1,20 +1,20 @@
 #pragma once
 
 #include "tmc/ir.hpp"
+#include "tmc/compiled_tm.hpp"
+#include "tmc/execution.hpp"
+#include "tmc/packed_tape.hpp"
+#include "tmc/virtual_tape.hpp"
+#include <algorithm>
+#include <functional>
 #include <string>
 #include <vector>
+#include <memory>
+#include <unordered_map>
 #include <cstdint>
 
 namespace tmc {
 
-// Result of running a TM
-struct RunResult {
-  bool accepted;
-  int64_t steps;
-  std::string final_tape;  // tape contents at end
-  bool hit_limit;
-};
-
 // Configuration of a TM at a point in time
 struct Config {
   std::vector<Symbol> tape;
@@ -22,20 +22,134 @@ struct Config {
   State state;
 };
 
-// Pre-expanded transition entry for flat table lookup
-struct FlatTransition {
-  uint32_t next;   // next state ID
-  uint8_t write;   // symbol index to write
-  int8_t dir;      // -1, 0, +1
+// Where Simulator::RunUntil stops, besides a halt and the step limit.
+// Each is checked after every step.
+struct Breakpoints {
+  std::vector<State> states;  // on a step into any of these states
+  int64_t step = -1;          // when Steps() reaches this (-1: none)
+  int64_t head = -1;          // when the head arrives at this cell (-1: none)
+  std::vector<int64_t> watch;  // on a step that changes any of these cells
+};
+
+// Why RunUntil returned (the first that applies, in this order)
+enum class StopReason { Halted, Limit, State, Watch, Head, Step };
+
+// Read-only view of the Step() tape, cells [first(), last()] around the
+// head, read straight from the simulator's tape: nothing is copied or
+// converted until a cell is asked for. Valid until the next Reset(),
+// Step() or RunUntil().
+class TapeWindow {
+public:
+  int64_t first() const { return first_; }
+  int64_t last() const { return last_; }
+  int64_t head() const { return head_; }
+
+  // Symbol in `cell`, for any cell (unvisited cells are blank)
+  Symbol operator[](int64_t cell) const {
+    if (cell < 0 || static_cast<size_t>(cell) >= len_) return blank_;
+    return idx_to_char_[GetCell(tape_, static_cast<size_t>(cell), bits_)];
+  }
+
+private:
+  friend class Simulator;
+
+  const uint8_t* tape_ = nullptr;
+  int bits_ = 8;
+  size_t len_ = 0;  // cells visited; the rest are blank
+  const char* idx_to_char_ = nullptr;
+  Symbol blank_ = kBlank;
+  int64_t first_ = 0;
+  int64_t last_ = -1;
+  int64_t head_ = 0;
+};
+
+// Old bytes of a Step() tape, to write back over it: runs of (offset,
+// length) in increasing offset, their bytes end to end
+struct TapeUndo {
+  std::vector<std::pair<size_t, size_t>> runs;
+  std::vector<uint8_t> bytes;
+};
+
+// A Step() configuration kept for going back
+struct Snapshot {
+  int64_t steps;
+  uint32_t state;
+  int64_t head;
+  size_t len;     // cells visited
+  TapeUndo undo;  // turns the next snapshot's tape back into this one's
+};
+
+// Threaded-code instruction for one (state, symbol) entry. `handler` is
+// the address of the code that executes it; superinstructions also
+// carry a second transition (write2/dir2/next_row2):
+//   chain: `steps` static steps (Dir::S connectors, then one move)
+//   pair:  after the first step, if the head reads `expect`, the second
+//          step is applied without a dispatch
+struct ThreadedOp {
+  const void* handler;
+  uint32_t next_row;
+  uint8_t write;
+  int8_t dir;
+  uint8_t expect;
+  uint8_t write2;
+  int8_t dir2;
+  uint32_t next_row2;
+  int64_t steps;
+};
+
+// Block macro-machine memo key: the head enters a block of
+// SimConfig::block_size cells (one symbol index per byte, cell 0 in the
+// low byte) at its left or right edge in some state
+struct MacroKey {
+  uint64_t block;
+  uint32_t state;
+  uint8_t side;      // 0 = entered at the left edge, 1 = at the right edge
+  uint8_t leftmost;  // block 0: moving left from its first cell stays put
+
+  bool operator==(const MacroKey& other) const {
+    return block == other.block && state == other.state &&
+           side == other.side && leftmost == other.leftmost;
+  }
+};
+
+// Where the head leaves a block, and what it left behind
+struct MacroEntry {
+  uint64_t block;  // block contents on exit
+  uint32_t state;  // state on exit (a halt state if it halted inside)
+  int8_t exit;     // -1 = left, +1 = right, 0 = halted or out of budget
+  int64_t steps;   // micro-steps taken inside the block
+};
+
+struct MacroSlot {
+  MacroKey key;
+  MacroEntry entry;
+  bool used;
 };
 
+struct HashLifeCache;
+class JitProgram;
+class PagedTape;
+
 // Simulate a TM on an input
 class Simulator {
 public:
-  explicit Simulator(const TM& tm, int64_t max_steps = 1000000);
+  explicit Simulator(const TM& tm, int64_t max_steps = 1000000,
+                     const SimConfig& config = {});
+
+  // Run on a table compiled elsewhere (CompiledTM::Compile), shared with
+  // other Simulators and Executions. An engine other than Engine::Flat
+  // on a compact table gets its own dense copy.
+  Simulator(std::shared_ptr<const CompiledTM> tm, int64_t max_steps = 1000000,
+            const SimConfig& config = {});
 
-  // Run on input string
-  RunResult Run(const std::string& input);
+  // Run on input string. Every engine honors RunOptions' deadline, stop
+  // flag and final_tape; checkpoints, samples and metrics only the flat
+  // engine.
+  RunResult Run(const std::string& input, const RunOptions& options = {});
+
+  // Carry on from a checkpoint (RunOptions::on_checkpoint) on the flat
+  // engine, whatever the configured engine
+  RunResult Resume(const Checkpoint& ckpt, const RunOptions& options = {});
 
   // Step-by-step execution
   void Reset(const std::string& input);
@@ -45,34 +159,144 @@ public:
   int64_t Steps() const;
   Config CurrentConfig() const;
 
+  // Step at full flat-kernel speed (scan states skipped) until a
+  // breakpoint, a halt, or the step limit; always takes at least one
+  // step unless halted or at the limit. Breakpoint states on a compact
+  // table fall back to Step() one step at a time. The visited part of
+  // the tape afterwards may include a few blank cells Step() would not
+  // have reached.
+  StopReason RunUntil(const Breakpoints& breakpoints);
+
+  // Cells within `radius` of the head, without copying them; and the
+  // state and head without building a Config
+  TapeWindow Window(int64_t radius) const;
+  const State& CurrentState() const { return tm_->id_to_state_[state_id_]; }
+  int64_t Head() const { return head_; }
+
+  // Going back (SimConfig::history_mb). Any earlier step is a snapshot
+  // restore and at most one snapshot interval of re-execution away.
+  // StepBack() returns false at step 0; GoToStep() goes either way and
+  // returns false if the run halts or hits the step limit first.
+  bool StepBack();
+  bool GoToStep(int64_t step);
+
+  // Go back to the latest earlier step at which `pred` holds, searching
+  // one snapshot interval at a time. Without one, ends at step 0 and
+  // returns false.
+  bool RunBackUntil(const std::function<bool(const Simulator&)>& pred);
+
 private:
-  void BuildTable(const TM& tm);
+  // Engines behind Run()
+  RunResult RunFlat(const std::string& input);
+  RunResult RunRle(const std::string& input);
+  RunResult RunMacro(const std::string& input);
+  RunResult RunHashLife(const std::string& input);
+  RunResult RunJit(const std::string& input);
+  RunResult RunThreaded(const std::string& input);
+  RunResult RunPaged(const std::string& input);
+
+  // Build threaded_ops_ with Dir::S chains fused
+  void BuildThreaded();
+
+  // Profile `input` until SimConfig::profile_steps have been profiled in
+  // total, then re-pick the pair superinstructions
+  void ProfileThreaded(const std::string& input);
+
+  // Threaded-code counterpart of CompiledTM::RunKernel. With tape ==
+  // nullptr it only publishes its handler addresses to threaded_handlers_.
+  int64_t ThreadedKernel(uint8_t* tape, int64_t& head, uint32_t& row, int64_t n);
+
+  // SkipScan over a paged tape; unwritten pages are crossed without
+  // being read
+  bool SkipScanPaged(const PagedTape& tape, int64_t& head, uint32_t state,
+                     int64_t& steps) const;
+
+  // Micro-simulate inside one block, starting at cell `pos`, until the
+  // head leaves it, the machine halts, or `budget` steps have run (or
+  // `watch`, given the run's steps so far as `base`, expires)
+  MacroEntry CrossBlock(uint32_t state, uint64_t block, int pos, bool leftmost,
+                        int64_t budget, RunWatch* watch = nullptr, int64_t base = 0) const;
 
   int64_t max_steps_;
+  SimConfig config_;
+
+  // The current Run()'s options, and the watch on its deadline
+  RunOptions run_options_;
+  RunWatch watch_;
 
-  // Flat transition table: table_[state_id * num_symbols_ + symbol_idx]
-  int num_states_;
-  int num_symbols_;
-  uint32_t start_id_;
-  uint32_t accept_id_;
-  uint32_t reject_id_;
-  uint32_t halt_threshold_;  // min(accept_id, reject_id)
-  std::vector<FlatTransition> table_;
-
-  // Symbol mapping
-  uint8_t char_to_idx_[256];
-  std::vector<char> idx_to_char_;
-  uint8_t blank_idx_;
-
-  // State mapping (for CurrentConfig/Accepted)
-  std::vector<State> id_to_state_;
-
-  // Runtime state
-  std::vector<uint8_t> tape_;
-  int head_;
+  // The tables, shared; flat_ runs Engine::Flat on them
+  std::shared_ptr<const CompiledTM> tm_;
+  Execution flat_;
+
+  // Block transitions filled lazily by RunMacro and kept across runs:
+  // open addressing over a power-of-two table with linear probing
+  std::vector<MacroSlot> macro_memo_;
+  size_t macro_count_ = 0;
+
+  // Tape tree and crossing memo for RunHashLife, kept across runs
+  std::shared_ptr<HashLifeCache> hashlife_;
+
+  // Native code for RunJit, compiled on first use (null: use RunFlat)
+  std::shared_ptr<JitProgram> jit_;
+  bool jit_compiled_ = false;
+
+  // Threaded code for RunThreaded, laid out like kernel_table_ and built
+  // on first use; handlers are step, chain, pair, exit
+  std::vector<ThreadedOp> threaded_ops_;
+  const void* threaded_handlers_[4] = {};
+
+  // Profile so far: (first entry * entries + second) -> count, and how
+  // often each entry was followed at all
+  std::unordered_map<uint64_t, uint64_t> threaded_pairs_;
+  std::vector<uint64_t> threaded_follows_;
+  int64_t threaded_profiled_ = 0;
+
+  // Tape of RunJit and RunThreaded, kept across runs to reuse the
+  // reservation
+  VirtualTape flat_tape_;
+
+  // Runtime state (Step); step_len_ cells have been visited, packed like
+  // RunFlat's tape
+  VirtualTape step_tape_;
+  int step_bits_ = 8;
+  size_t step_len_ = 0;
+  int64_t head_;
   uint32_t state_id_;
   int64_t steps_;
   bool halted_;
+
+  // Snapshot now, with the undo for the interval just run
+  void TakeSnapshot();
+
+  // Back to snapshots_[i], dropping the later ones
+  void RestoreSnapshot(size_t i);
+
+  // Index of the last snapshot at or before `step`
+  size_t SnapshotAt(int64_t step) const;
+
+  // Tape bytes [first, last] may have changed since the last snapshot
+  void MarkDirty(size_t first, size_t last) {
+    dirty_lo_ = std::min(dirty_lo_, first);
+    dirty_hi_ = std::max(dirty_hi_, last + 1);
+  }
+
+  // History of Step() runs: the input, snapshots in step order with the
+  // tape as of the last one (shadow_) and the byte range written since
+  std::string input_;
+  std::vector<Snapshot> snapshots_;
+  std::vector<uint8_t> shadow_;
+  size_t history_bytes_ = 0;
+  int64_t history_steps_ = 0;  // current interval
+  int64_t next_snapshot_ = INT64_MAX;
+  size_t dirty_lo_ = SIZE_MAX;
+  size_t dirty_hi_ = 0;
+
+  // RunUntil's kernel table: kernel_table_ with the steps into
+  // break_states_ redirected to kBreakRow | next row, built when the set
+  // changes; break_flag_ marks the same states by ID
+  std::vector<uint32_t> break_states_;
+  std::vector<KernelTransition> break_table_;
+  std::vector<uint8_t> break_flag_;
 };
 
 }  // namespace tmc
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tmc {
+
+// Set of symbol indices that end a scan.
+//
+// `stop` is a full lookup table used by the scalar path. The vector paths
+// compare against `symbols` instead: normally the stop symbols, or, when
+// `invert` is set, the symbols the scan continues over (whichever list is
+// shorter).
+struct StopSet {
+  bool stop[256] = {};
+  std::vector<uint8_t> symbols;
+  bool invert = false;
+};
+
+constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+// Build a StopSet from a per-symbol stop flag (index = symbol index)
+StopSet MakeStopSet(const std::vector<bool>& is_stop);
+
+// Index of the first stop symbol in data[0..n), or n if there is none
+size_t FindStopForward(const uint8_t* data, size_t n, const StopSet& stops);
+
+// Index of the last stop symbol in data[0..n), or kNotFound if there is none
+size_t FindStopBackward(const uint8_t* data, size_t n, const StopSet& stops);
+
+// Packed-tape versions (2 or 4 bits per cell, see packed_tape.hpp) that
+// test a 64-bit word of cells at a time. Cell indices throughout: the
+// first stop in cells [from, n) or n, and the last in [0, n) or kNotFound.
+size_t FindStopForwardPacked(const uint8_t* data, size_t from, size_t n, int bits,
+                             const StopSet& stops);
+size_t FindStopBackwardPacked(const uint8_t* data, size_t n, int bits, const StopSet& stops);
+
+}  // namespace tmc
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "tmc/compiled_tm.hpp"
+#include "tmc/simulator.hpp"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tmc {
+
+// Trace files: a run recorded step by step, to replay offline.
+//
+// The header names the symbols and states. Then come blocks, each one a
+// sync frame followed by the block's steps:
+//   sync frame: step, state, head, tape (run-length encoded)
+//   steps:      a bit stream and a byte stream of varints. Each step is
+//               2 bits of direction (L, S, R), 1 bit for "state changed"
+//               and the written symbol's index in as few bits as the
+//               alphabet needs; a changed state's ID goes to the varints.
+//               Direction code 3 is a run of steps that leave the tape
+//               and the state as they are (scans), moving one way: 1 bit
+//               of direction, its length in the varints.
+// A block index and the final state close the file. A sync frame is
+// written every sync_steps steps or so, but never before the block's
+// steps take as many bytes as its sync frame did, so syncs stay a
+// small part of the file whatever the tape size.
+
+// Runs inputs like the flat engine (scans jumped whole) and records each
+// run to a trace file
+class TraceRecorder {
+public:
+  explicit TraceRecorder(std::shared_ptr<const CompiledTM> tm, int64_t max_steps = 1000000,
+                         int64_t sync_steps = int64_t{1} << 20);
+
+  // Run `input`, writing its trace to `path`. Throws std::runtime_error if
+  // the file cannot be written. RunOptions' deadline and stop flag end
+  // the run (and the trace) early.
+  RunResult Record(const std::string& input, const std::string& path,
+                   const RunOptions& options = {});
+
+private:
+  void Sync();
+  void FlushBlock();
+  void PutBits(uint64_t v, int n);
+  void PutStep(int dir, uint32_t write, uint32_t next);
+  void PutRun(int dir, int64_t len);
+  void FlushRun();
+
+  std::shared_ptr<const CompiledTM> tm_;
+  int64_t max_steps_;
+  int64_t sync_steps_;
+  int sym_bits_ = 1;
+
+  // The run being recorded
+  std::ofstream out_;
+  std::vector<uint8_t> tape_;
+  uint32_t state_ = 0;
+  int64_t head_ = 0;
+  int64_t steps_ = 0;
+
+  // The open block: bit stream, varints, steps so far, and the pending
+  // run of unchanged-tape steps
+  std::string bits_;
+  uint64_t bit_acc_ = 0;
+  int bit_count_ = 0;
+  std::string vars_;
+  int64_t block_steps_ = 0;
+  int run_dir_ = 0;
+  int64_t run_len_ = 0;
+  int64_t next_sync_ = 0;
+  std::string sync_;  // the open block's sync frame
+  int64_t sync_step_ = 0;
+  size_t sync_bytes_ = 0;
+  std::vector<std::pair<int64_t, uint64_t>> index_;  // (step, file offset) per block
+};
+
+// Replays a trace file: any step's configuration, by seeking to the
+// sync frame before it and decoding forward, without the machine
+class TraceReplay {
+public:
+  // Throws std::runtime_error if `path` is not a readable trace
+  explicit TraceReplay(const std::string& path);
+
+  // Steps recorded, and the state the run ended in
+  int64_t steps() const { return total_steps_; }
+  const State& final_state() const { return states_[final_state_]; }
+
+  // Go to step `step` (clamped to [0, steps()])
+  void Seek(int64_t step);
+
+  // One step forward; false at the end of the trace
+  bool Next();
+
+  int64_t step() const { return step_; }
+  const State& state() const { return states_[state_]; }
+  int64_t head() const { return head_; }
+  Symbol cell(int64_t i) const {
+    return i >= 0 && static_cast<size_t>(i) < tape_.size() ? symbols_[tape_[i]] : symbols_[0];
+  }
+
+  // The configuration here, tape up to the furthest cell written or
+  // visited
+  Config CurrentConfig() const;
+
+private:
+  void LoadBlock(size_t b);
+  uint64_t Bits(int n);
+  uint64_t Varint();
+
+  std::ifstream in_;
+  uint64_t footer_at_ = 0;
+  std::vector<Symbol> symbols_;
+  std::vector<State> states_;
+  int sym_bits_ = 1;
+  std::vector<std::pair<int64_t, uint64_t>> index_;
+  int64_t total_steps_ = 0;
+  uint32_t final_state_ = 0;
+
+  // Replay position, and the block being decoded
+  std::vector<uint8_t> tape_;
+  uint32_t state_ = 0;
+  int64_t head_ = 0;
+  int64_t step_ = 0;
+  size_t block_ = 0;
+  int64_t block_end_ = 0;
+  std::string bits_;
+  size_t bit_pos_ = 0;  // in bits
+  std::string vars_;
+  size_t var_pos_ = 0;
+  int run_dir_ = 0;
+  int64_t run_left_ = 0;
+};
+
+}  // namespace tmc
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace tmc {
+
+// LEB128 varints for the binary file formats (checkpoints, traces),
+// signed values zigzagged
+inline void PutVarint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+inline void PutSigned(std::string& out, int64_t v) {
+  PutVarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+// Reads them back from `size` bytes at `data`, throwing
+// std::runtime_error naming `what` ("checkpoint", "trace") when the data
+// runs out or a varint is malformed
+struct ByteReader {
+  const char* data;
+  size_t size;
+  const char* what;
+  size_t pos = 0;
+
+  uint8_t Byte() {
+    if (pos >= size) throw std::runtime_error(std::string("Truncated ") + what);
+    return static_cast<uint8_t>(data[pos++]);
+  }
+  uint64_t Varint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t b = Byte();
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    throw std::runtime_error(std::string("Bad varint in ") + what);
+  }
+  int64_t Signed() {
+    uint64_t v = Varint();
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+  }
+  // `n` raw bytes
+  const char* Bytes(size_t n) {
+    if (n > size - pos) throw std::runtime_error(std::string("Truncated ") + what);
+    pos += n;
+    return data + pos - n;
+  }
+};
+
+// A byte sequence as its length, then (byte, run length) pairs
+template <typename Bytes>
+void PutRuns(std::string& out, const Bytes& bytes) {
+  PutVarint(out, bytes.size());
+  for (size_t i = 0; i < bytes.size();) {
+    size_t j = i + 1;
+    while (j < bytes.size() && bytes[j] == bytes[i]) ++j;
+    out.push_back(static_cast<char>(bytes[i]));
+    PutVarint(out, j - i);
+    i = j;
+  }
+}
+
+// Reads a PutRuns sequence back, appending to `bytes`
+template <typename Bytes>
+void ReadRuns(ByteReader& in, Bytes& bytes) {
+  const uint64_t n = in.Varint();
+  while (bytes.size() < n) {
+    const auto b = static_cast<typename Bytes::value_type>(in.Byte());
+    const uint64_t len = in.Varint();
+    if (len == 0 || len > n - bytes.size()) {
+      throw std::runtime_error(std::string("Bad run in ") + in.what);
+    }
+    bytes.insert(bytes.end(), len, b);
+  }
+}
+
+}  // namespace tmc
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tmc {
+
+// Tape cells backed by one large reservation of demand-zero memory. With
+// the blank symbol at index 0, every cell the machine has not written is
+// already blank, so moving right never needs a resize and the hot loops
+// need no per-step size check. A PROT_NONE guard page follows the region
+// so an overrun faults instead of corrupting memory.
+//
+// If the reservation fails (address-space limits, non-POSIX hosts) the
+// tape falls back to a zero-filled heap buffer grown with Grow().
+class VirtualTape {
+public:
+  // Address space reserved per tape
+  static constexpr size_t kReserve = size_t{1} << 35;
+
+  VirtualTape() = default;
+  ~VirtualTape();
+  VirtualTape(const VirtualTape&) = delete;
+  VirtualTape& operator=(const VirtualTape&) = delete;
+
+  // Reset to all blank, then copy `n` cells to the start
+  void Assign(const uint8_t* cells, size_t n);
+
+  uint8_t* data() { return base_; }
+  const uint8_t* data() const { return base_; }
+
+  // Cells addressable without Grow()
+  size_t capacity() const { return capacity_; }
+
+  // Make cells [0, cells) addressable. Only the fallback buffer can grow;
+  // past the reservation this throws std::length_error.
+  void Grow(size_t cells);
+
+  // One past the rightmost cell that may be non-blank; cells from here on
+  // are known blank. Callers widen it as the head moves.
+  size_t extent() const { return extent_; }
+  void Touch(size_t end) {
+    if (end > extent_) extent_ = end;
+  }
+
+  bool reserved() const { return mapped_; }
+
+  // Make the reservation now if not tried yet; returns reserved()
+  bool Reserved() {
+    if (!tried_) Reserve();
+    return mapped_;
+  }
+
+private:
+  void Reserve();
+
+  uint8_t* base_ = nullptr;
+  size_t capacity_ = 0;
+  size_t extent_ = 0;
+  bool mapped_ = false;
+  bool tried_ = false;
+  std::vector<uint8_t> fallback_;
+};
+
+}  // namespace tmc
@@ -0,0 +1,186 @@
+#include "tmc/batch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+namespace tmc {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MsBetween(Clock::time_point a, Clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+// A worker's queue of input indices: the owner pops the front, thieves
+// take the back
+struct WorkQueue {
+  std::mutex mu;
+  std::deque<size_t> jobs;
+};
+
+// The case a worker is running, and the flag that stops it. The mutex
+// keeps a stop aimed at one case from landing on the worker's next.
+struct WorkerCase {
+  std::mutex mu;
+  size_t index = SIZE_MAX;
+  std::atomic<bool> cancel{false};
+};
+
+}  // namespace
+
+std::vector<BatchCase> RunBatch(std::shared_ptr<const CompiledTM> tm,
+                                const std::vector<std::string>& inputs, int threads,
+                                const BatchOptions& options) {
+  const size_t n = inputs.size();
+  std::vector<BatchCase> cases(n);
+  if (n == 0) return cases;
+  if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+  threads = static_cast<int>(std::min<size_t>(static_cast<size_t>(std::max(threads, 1)), n));
+
+  // Longest first, dealt round-robin so every worker starts on one of
+  // the longest
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), size_t{0});
+  auto cost = [&](size_t i) {
+    return i < options.cost.size() ? options.cost[i] : static_cast<int64_t>(inputs[i].size());
+  };
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cost(a) > cost(b); });
+  std::vector<WorkQueue> queues(threads);
+  for (size_t k = 0; k < n; ++k) queues[k % threads].jobs.push_back(order[k]);
+
+  // Lowest index of a case that stopped the batch (n: none yet); cases
+  // after it are not started
+  std::atomic<size_t> stop_at{n};
+
+  std::vector<WorkerCase> current(threads);
+
+  // Whether a finished case stops the batch
+  auto stops = [&](const BatchCase& c) {
+    return options.stop_on_limit &&
+           (c.result.hit_limit || c.result.timed_out ||
+            (options.timeout_ms > 0 && !options.cpu_timeout && c.ms >= options.timeout_ms));
+  };
+
+  // In-order delivery: cases [0, next) have been passed to on_case
+  std::mutex done_mu;
+  std::vector<char> done(n, 0);
+  size_t next = 0;
+  bool stopped = false;
+
+  const auto start = Clock::now();
+  auto finish = [&](size_t i) {
+    std::lock_guard<std::mutex> lock(done_mu);
+    done[i] = 1;
+    while (next < n && done[next]) {
+      BatchCase& c = cases[next];
+      if (stopped) {
+        c = BatchCase{};
+        c.skipped = true;
+      } else if (stops(c)) {
+        stopped = true;
+      }
+      if (options.on_case) options.on_case(next, c);
+      ++next;
+    }
+  };
+
+  auto take = [&](int w, size_t& job) {
+    {
+      WorkQueue& own = queues[w];
+      std::lock_guard<std::mutex> lock(own.mu);
+      if (!own.jobs.empty()) {
+        job = own.jobs.front();
+        own.jobs.pop_front();
+        return true;
+      }
+    }
+    for (int k = 1; k < threads; ++k) {
+      WorkQueue& victim = queues[(w + k) % threads];
+      std::lock_guard<std::mutex> lock(victim.mu);
+      if (!victim.jobs.empty()) {
+        job = victim.jobs.back();
+        victim.jobs.pop_back();
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // The first exception a worker throws, rethrown once all are joined;
+  // the others stop taking cases
+  std::mutex error_mu;
+  std::exception_ptr error;
+  std::atomic<bool> failed{false};
+
+  auto run = [&](int w) {
+    Simulator sim(tm, options.max_steps, options.config);
+    WorkerCase& cur = current[w];
+    RunOptions run;
+    run.stop = &cur.cancel;
+    run.metrics = options.metrics;
+    size_t i;
+    while (!failed.load(std::memory_order_relaxed) && take(w, i)) {
+      BatchCase& c = cases[i];
+      // Published before stop_at is read, so a stop that lands after the
+      // check still sees this case running and cancels it
+      {
+        std::lock_guard<std::mutex> lock(cur.mu);
+        cur.index = i;
+        cur.cancel = false;
+      }
+      if (i > stop_at.load()) {
+        c.skipped = true;
+        finish(i);
+        continue;
+      }
+      const auto t0 = Clock::now();
+      if (options.timeout_ms > 0 && options.cpu_timeout) {
+        run.cpu_ms = options.timeout_ms;
+      } else if (options.timeout_ms > 0) {
+        run.deadline = t0 + std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double, std::milli>(options.timeout_ms));
+      }
+      c.result = sim.Run(inputs[i], run);
+      const auto t1 = Clock::now();
+      c.ms = MsBetween(t0, t1);
+      c.done_ms = MsBetween(start, t1);
+      if (stops(c)) {
+        size_t at = stop_at.load();
+        while (i < at && !stop_at.compare_exchange_weak(at, i)) {}
+        // Cases after the stop that are running now are wasted work
+        at = stop_at.load();
+        for (WorkerCase& other : current) {
+          std::lock_guard<std::mutex> lock(other.mu);
+          if (other.index > at) other.cancel = true;
+        }
+      }
+      finish(i);
+    }
+  };
+  auto work = [&](int w) {
+    try {
+      run(w);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mu);
+      if (!error) error = std::current_exception();
+      failed = true;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int w = 1; w < threads; ++w) workers.emplace_back(work, w);
+  work(0);
+  for (auto& t : workers) t.join();
+  if (error) std::rethrow_exception(error);
+  return cases;
+}
+
+}  // namespace tmc
@@ -0,0 +1,95 @@
+#include "tmc/checkpoint.hpp"
+#include "tmc/varint.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace tmc {
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'M', 'C', 'K', 'P', 'T', '1', '\n'};
+
+// FNV-1a, fed field by field
+struct Fnv {
+  uint64_t h = 0xcbf29ce484222325ull;
+  void Byte(uint8_t b) {
+    h ^= b;
+    h *= 0x100000001b3ull;
+  }
+  void Str(const std::string& s) {
+    for (char c : s) Byte(static_cast<uint8_t>(c));
+    Byte(0);
+  }
+};
+
+}  // namespace
+
+uint64_t HashTM(const TM& tm) {
+  Fnv f;
+  f.Str(tm.start);
+  f.Str(tm.accept);
+  f.Str(tm.reject);
+  for (const State& s : tm.states) f.Str(s);
+  f.Byte(0);
+  for (Symbol c : tm.input_alphabet) f.Byte(static_cast<uint8_t>(c));
+  f.Byte(0);
+  for (Symbol c : tm.tape_alphabet) f.Byte(static_cast<uint8_t>(c));
+  f.Byte(0);
+  for (const auto& [state, trans] : tm.delta) {
+    f.Str(state);
+    for (const auto& [sym, t] : trans) {
+      f.Byte(static_cast<uint8_t>(sym));
+      f.Byte(static_cast<uint8_t>(t.write));
+      f.Byte(static_cast<uint8_t>(t.dir));
+      f.Str(t.next);
+    }
+  }
+  return f.h;
+}
+
+void SaveCheckpoint(const std::string& path, const Checkpoint& ckpt) {
+  std::string out(kMagic, sizeof(kMagic));
+  for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(ckpt.tm_hash >> (8 * i)));
+  PutSigned(out, ckpt.max_steps);
+  PutVarint(out, ckpt.state);
+  PutSigned(out, ckpt.head);
+  PutSigned(out, ckpt.steps);
+  PutRuns(out, ckpt.input);
+  PutRuns(out, ckpt.cells);
+
+  const std::string tmp = path + ".tmp";
+  {
+    std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+    if (!ofs || !ofs.write(out.data(), static_cast<std::streamsize>(out.size())) || !ofs.flush()) {
+      throw std::runtime_error("Cannot write checkpoint: " + tmp);
+    }
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Cannot write checkpoint: " + path);
+  }
+}
+
+Checkpoint LoadCheckpoint(const std::string& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) throw std::runtime_error("Cannot open checkpoint: " + path);
+  const std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  if (data.compare(0, sizeof(kMagic), std::string(kMagic, sizeof(kMagic))) != 0) {
+    throw std::runtime_error("Not a checkpoint: " + path);
+  }
+
+  ByteReader in{data.data(), data.size(), "checkpoint", sizeof(kMagic)};
+  Checkpoint ckpt;
+  for (int i = 0; i < 8; ++i) ckpt.tm_hash |= static_cast<uint64_t>(in.Byte()) << (8 * i);
+  ckpt.max_steps = in.Signed();
+  ckpt.state = static_cast<uint32_t>(in.Varint());
+  ckpt.head = in.Signed();
+  ckpt.steps = in.Signed();
+  ReadRuns(in, ckpt.input);
+  ReadRuns(in, ckpt.cells);
+  if (in.pos != data.size()) throw std::runtime_error("Trailing data in checkpoint: " + path);
+  return ckpt;
+}
+
+}  // namespace tmc
@@ -103,6 +103,143 @@ std::string ToYAML(const TM& tm) {
   return out.str();
 }
 
+namespace {
+
+// C++ character literal for a tape symbol
+std::string CharLiteral(Symbol s) {
+  unsigned char c = static_cast<unsigned char>(s);
+  if (c >= 0x20 && c < 0x7F && c != '\'' && c != '\\') return std::string("'") + s + "'";
+  static const char* hex = "0123456789ABCDEF";
+  return std::string("'\\x") + hex[c >> 4] + hex[c & 15] + "'";
+}
+
+// State name made safe for a // comment
+std::string CommentText(const std::string& s) {
+  std::string out;
+  for (char c : s) out += (c == '\n' || c == '\r') ? ' ' : c;
+  return out;
+}
+
+}  // namespace
+
+std::string ToCpp(const TM& tm) {
+  // Same symbol set and state numbering as Simulator::BuildTable, so the
+  // program takes identical steps (including the default transition to
+  // reject, which writes the lowest symbol and stays)
+  std::set<Symbol> symbols = tm.tape_alphabet;
+  symbols.insert(kBlank);
+  symbols.insert(tm.input_alphabet.begin(), tm.input_alphabet.end());
+  const Symbol sym0 = *symbols.begin();
+
+  std::map<State, std::string> label;
+  std::vector<State> running;
+  for (const auto& s : tm.states) {
+    if (s == tm.accept || s == tm.reject) continue;
+    label[s] = "s" + std::to_string(running.size());
+    running.push_back(s);
+  }
+  label[tm.accept] = "accept";
+  label[tm.reject] = "reject";
+  auto target = [&](const State& s) {
+    auto it = label.find(s);
+    return it != label.end() ? it->second : std::string("reject");
+  };
+
+  std::ostringstream out;
+  out << "// Generated by tmc --emit-cpp. Build with e.g. `c++ -O3 -std=c++17`.\n"
+      << "// Run(input, max_steps) matches tmc::Simulator::Run; main() reads one\n"
+      << "// input per line and prints: ACCEPT|REJECT <steps> <hit_limit> <tape>\n"
+      << "#include <cstdint>\n"
+      << "#include <iostream>\n"
+      << "#include <string>\n"
+      << "#include <vector>\n\n"
+      << "namespace tmc_generated {\n\n"
+      << "struct RunResult {\n"
+      << "  bool accepted;\n"
+      << "  int64_t steps;\n"
+      << "  std::string final_tape;\n"
+      << "  bool hit_limit;\n"
+      << "};\n\n"
+      << "inline RunResult Run(const std::string& input, int64_t max_steps = 1000000) {\n"
+      << "  std::vector<char> tape(input.size() + 4096, " << CharLiteral(kBlank) << ");\n"
+      << "  for (size_t i = 0; i < input.size(); ++i) {\n"
+      << "    switch (input[i]) {\n";
+  for (Symbol s : symbols) out << "      case " << CharLiteral(s) << ":\n";
+  out << "        tape[i] = input[i];\n"
+      << "        break;\n"
+      << "      default:\n"
+      << "        tape[i] = " << CharLiteral(sym0) << ";\n"
+      << "    }\n"
+      << "  }\n"
+      << "  size_t head = 0;\n"
+      << "  int64_t steps = 0;\n"
+      << "  bool accepted = false, halted = false;\n"
+      << "  goto " << target(tm.start) << ";\n";
+
+  for (const auto& s : running) {
+    const auto dit = tm.delta.find(s);
+    const Transition* wildcard = nullptr;
+    if (dit != tm.delta.end()) {
+      auto wit = dit->second.find(kWildcard);
+      if (wit != dit->second.end()) wildcard = &wit->second;
+    }
+
+    out << "\n" << label[s] << ":  // " << CommentText(s) << "\n"
+        << "  if (steps >= max_steps) goto done;\n"
+        << "  if (head >= tape.size()) tape.resize(tape.size() * 2, " << CharLiteral(kBlank)
+        << ");\n"
+        << "  ++steps;\n"
+        << "  switch (tape[head]) {\n";
+    for (Symbol sym : symbols) {
+      const Transition* t = wildcard;
+      if (dit != tm.delta.end()) {
+        auto eit = dit->second.find(sym);
+        if (eit != dit->second.end()) t = &eit->second;
+      }
+      out << "    case " << CharLiteral(sym) << ":";
+      if (!t) {
+        out << " tape[head] = " << CharLiteral(sym0) << "; goto reject;\n";
+        continue;
+      }
+      Symbol w = t->write == kWildcard ? sym : t->write;
+      if (w != sym) out << " tape[head] = " << CharLiteral(w) << ";";
+      if (t->dir == Dir::R) out << " ++head;";
+      if (t->dir == Dir::L) out << " if (head > 0) --head;";
+      out << " goto " << target(t->next) << ";\n";
+    }
+    out << "  }\n"
+        << "  goto reject;\n";
+  }
+
+  out << "\naccept:\n"
+      << "  accepted = true;\n"
+      << "reject:\n"
+      << "  halted = true;\n"
+      << "done:\n"
+      << "  RunResult result{accepted, steps, std::string(), !halted && steps >= max_steps};\n"
+      << "  size_t left = 0, right = tape.size();\n"
+      << "  while (left < right && tape[left] == " << CharLiteral(kBlank) << ") ++left;\n"
+      << "  while (right > left && tape[right - 1] == " << CharLiteral(kBlank) << ") --right;\n"
+      << "  result.final_tape.assign(tape.begin() + left, tape.begin() + right);\n"
+      << "  return result;\n"
+      << "}\n\n"
+      << "}  // namespace tmc_generated\n\n"
+      << "#ifndef TMC_GENERATED_NO_MAIN\n"
+      << "int main(int argc, char** argv) {\n"
+      << "  int64_t max_steps = argc > 1 ? std::stoll(argv[1]) : 1000000;\n"
+      << "  std::ios::sync_with_stdio(false);\n"
+      << "  std::string line;\n"
+      << "  while (std::getline(std::cin, line)) {\n"
+      << "    tmc_generated::RunResult r = tmc_generated::Run(line, max_steps);\n"
+      << "    std::cout << (r.accepted ? \"ACCEPT \" : \"REJECT \") << r.steps << ' '\n"
+      << "              << r.hit_limit << ' ' << r.final_tape << '\\n';\n"
+      << "  }\n"
+      << "  return 0;\n"
+      << "}\n"
+      << "#endif\n";
+  return out.str();
+}
+
 // Parse a symbol token from YAML (handles quoting like '#', '>')
 namespace {
 
@@ -0,0 +1,60 @@
+#include "tmc/compact_table.hpp"
+
+namespace tmc {
+
+void CompactTable::Reset(int num_symbols, uint32_t default_entry) {
+  num_symbols_ = num_symbols;
+  default_entry_ = default_entry;
+  unbuilt_row_ = kNoRow;
+  rows_.clear();
+  dense_.assign(static_cast<size_t>(num_symbols), default_entry);
+  sparse_.clear();
+  sparse_syms_.clear();
+}
+
+void CompactTable::AddRow(const std::vector<std::pair<uint8_t, uint32_t>>& entries) {
+  rows_.push_back(0);
+  SetRow(static_cast<uint32_t>(rows_.size() - 1), entries);
+}
+
+void CompactTable::AddUnbuiltRows(uint32_t n) {
+  if (unbuilt_row_ == kNoRow) {
+    unbuilt_row_ = static_cast<uint32_t>(dense_.size());
+    for (int si = 0; si < num_symbols_; ++si) dense_.push_back(kScanCode);
+  }
+  rows_.resize(rows_.size() + n, unbuilt_row_);
+}
+
+void CompactTable::SetRow(uint32_t state, const std::vector<std::pair<uint8_t, uint32_t>>& entries) {
+  uint32_t& r = rows_[state];
+  if (entries.empty()) {
+    r = 0;
+  } else if (2 * entries.size() >= static_cast<size_t>(num_symbols_)) {
+    r = static_cast<uint32_t>(dense_.size());
+    dense_.resize(dense_.size() + num_symbols_, default_entry_);
+    uint32_t* row = &dense_[r];
+    for (const auto& [sym, e] : entries) row[sym] = e;
+  } else {
+    r = kSparse | static_cast<uint32_t>(sparse_.size());
+    sparse_.push_back(static_cast<uint32_t>(entries.size()));
+    sparse_syms_.push_back(0);
+    for (const auto& [sym, e] : entries) {
+      sparse_.push_back(e);
+      sparse_syms_.push_back(sym);
+    }
+  }
+}
+
+void CompactTable::Set(uint32_t state, uint32_t sym, uint32_t entry) {
+  const uint32_t r = rows_[state];
+  if (!(r & kSparse)) {
+    if (r != 0 && r != unbuilt_row_) dense_[r + sym] = entry;  // shared rows
+    return;
+  }
+  const uint32_t begin = r & ~kSparse;
+  for (uint32_t k = begin + 1; k <= begin + sparse_[begin]; ++k) {
+    if (sparse_syms_[k] == sym) sparse_[k] = entry;
+  }
+}
+
+}  // namespace tmc
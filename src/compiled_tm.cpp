@@ -0,0 +1,475 @@
+#include "tmc/compiled_tm.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace tmc {
+
+CompiledTM::CompiledTM(const TM& tm, const SimConfig& config) : config_(config) {
+  BuildTable(tm);
+}
+
+std::shared_ptr<const CompiledTM> CompiledTM::Compile(const TM& tm, const SimConfig& config) {
+  SimConfig eager = config;
+  if (eager.table_build == TableBuild::Lazy) eager.table_build = TableBuild::Eager;
+  return std::make_shared<const CompiledTM>(tm, eager);
+}
+
+void CompiledTM::BuildTable(const TM& tm) {
+  // --- Symbol mapping: char -> dense index ---
+  // Collect all symbols from tape alphabet plus blank
+  std::set<Symbol> all_symbols = tm.tape_alphabet;
+  all_symbols.insert(kBlank);
+  // Also include input alphabet (should already be in tape_alphabet, but be safe)
+  all_symbols.insert(tm.input_alphabet.begin(), tm.input_alphabet.end());
+
+  // The blank gets index 0 so zero-filled memory reads as blank tape
+  // (VirtualTape); the rest follow in sorted order
+  num_symbols_ = static_cast<int>(all_symbols.size());
+  idx_to_char_.clear();
+  idx_to_char_.push_back(kBlank);
+  for (Symbol s : all_symbols) {
+    if (s != kBlank) idx_to_char_.push_back(s);
+  }
+  for (int i = 0; i < num_symbols_; ++i) {
+    char_to_idx_[static_cast<unsigned char>(idx_to_char_[i])] = static_cast<uint8_t>(i);
+  }
+  blank_idx_ = 0;
+
+  // Characters outside the alphabet, and the default transition's write,
+  // use the lowest symbol
+  const uint8_t lowest = char_to_idx_[static_cast<unsigned char>(*all_symbols.begin())];
+  for (int c = 0; c < 256; ++c) {
+    if (!all_symbols.count(static_cast<Symbol>(c))) char_to_idx_[c] = lowest;
+  }
+
+  // --- State mapping: string -> dense integer ID ---
+  // Running states take IDs in name order (tm.states is sorted), so
+  // StateId finds a name by binary search. Accept and reject get the two
+  // highest IDs so that all "running" states have IDs < halt_threshold_.
+  id_to_state_.clear();
+  id_to_state_.reserve(tm.states.size() + 2);
+  for (const auto& s : tm.states) {
+    if (s != tm.accept && s != tm.reject) id_to_state_.push_back(s);
+  }
+  uint32_t id = static_cast<uint32_t>(id_to_state_.size());
+  accept_id_ = id++;
+  id_to_state_.push_back(tm.accept);
+  reject_id_ = id++;
+  id_to_state_.push_back(tm.reject);
+
+  num_states_ = id;
+  halt_threshold_ = std::min(accept_id_, reject_id_);
+  start_id_ = StateId(tm.start);
+  if (start_id_ == reject_id_ && tm.start != tm.reject) {
+    throw std::out_of_range("start state is not a state: " + tm.start);
+  }
+
+  // --- Build transition table ---
+  // Every pair without a transition goes to reject. For the flat engine,
+  // large machines and lazy builds keep their transitions in compact_
+  // (Execution and Step() read it directly), the rest in table_.
+  uint32_t padded = 2;
+  while (padded < static_cast<uint32_t>(num_symbols_)) padded *= 2;
+  const size_t dense_bytes = static_cast<size_t>(num_states_) *
+      (num_symbols_ * sizeof(FlatTransition) + padded * sizeof(KernelTransition));
+  const bool fits = config_.engine == Engine::Flat &&
+                    static_cast<uint32_t>(num_states_) <= CompactTable::kMaxStates;
+  const bool lazy = fits && config_.table_build == TableBuild::Lazy;
+  const bool compact = lazy || (fits && dense_bytes > (config_.dense_table_mb << 20));
+  table_.clear();
+  if (compact) {
+    compact_.Reset(num_symbols_, CompactTable::Pack(reject_id_, lowest, 0));
+  } else {
+    table_.assign(static_cast<size_t>(num_states_) * num_symbols_,
+                  FlatTransition{reject_id_, lowest, 0, 0});
+  }
+
+  scan_class_.assign(num_states_, 0);
+  scan_classes_.clear();
+  scan_class_ids_.clear();
+  if (lazy) {
+    // Rows are built as runs reach their states (BuildRow)
+    lazy_tm_ = &tm;
+    compact_.AddUnbuiltRows(static_cast<uint32_t>(num_states_));
+    return;
+  }
+  lazy_tm_ = nullptr;
+
+  // Each state's transitions, walking tm.delta and the running states
+  // side by side (both in name order)
+  std::vector<const TransitionMap*> trans(num_states_, nullptr);
+  uint32_t sid = 0;
+  for (const auto& [name, trans_map] : tm.delta) {
+    while (sid < halt_threshold_ && id_to_state_[sid] < name) ++sid;
+    if (sid < halt_threshold_ && id_to_state_[sid] == name) {
+      trans[sid] = &trans_map;
+    } else if (name == tm.accept || name == tm.reject) {
+      trans[StateId(name)] = &trans_map;
+    }
+  }
+  BuildRows(trans, compact);
+
+  for (uint32_t sid = 0; sid < halt_threshold_; ++sid) {
+    if (!ClassifyScan(sid) || compact) continue;
+    for (int si = 0; si < num_symbols_; ++si) {
+      FlatTransition& ft = table_[sid * num_symbols_ + si];
+      if (ft.next == sid) ft.scan = 1;
+    }
+  }
+  if (!compact) BuildKernel();
+}
+
+uint32_t CompiledTM::StateId(const State& name) const {
+  if (name == id_to_state_[reject_id_]) return reject_id_;
+  if (name == id_to_state_[accept_id_]) return accept_id_;
+  const auto begin = id_to_state_.begin();
+  const auto end = begin + halt_threshold_;
+  const auto it = std::lower_bound(begin, end, name);
+  return it != end && *it == name ? static_cast<uint32_t>(it - begin) : reject_id_;
+}
+
+void CompiledTM::ResolveRow(const TransitionMap* trans,
+                            std::vector<std::pair<uint8_t, FlatTransition>>& row) const {
+  row.clear();
+  if (!trans) return;
+
+  // Find wildcard transition if any
+  const Transition* wildcard = nullptr;
+  auto wit = trans->find(kWildcard);
+  if (wit != trans->end()) {
+    wildcard = &wit->second;
+  }
+
+  // For each symbol in the alphabet, fill the table entry
+  for (int si = 0; si < num_symbols_; ++si) {
+    Symbol sym = idx_to_char_[si];
+    const Transition* t = nullptr;
+
+    // Exact match first
+    auto eit = trans->find(sym);
+    if (eit != trans->end()) {
+      t = &eit->second;
+    } else if (wildcard) {
+      t = wildcard;
+    }
+    if (!t) continue;  // default (reject)
+
+    FlatTransition ft{};
+
+    // Resolve next state
+    ft.next = StateId(t->next);
+
+    // Resolve write symbol (wildcard write means keep current)
+    Symbol ws = (t->write == kWildcard) ? sym : t->write;
+    ft.write = char_to_idx_[static_cast<unsigned char>(ws)];
+
+    // Direction
+    switch (t->dir) {
+      case Dir::L: ft.dir = -1; break;
+      case Dir::R: ft.dir = 1; break;
+      case Dir::S: ft.dir = 0; break;
+    }
+    row.push_back({static_cast<uint8_t>(si), ft});
+  }
+}
+
+void CompiledTM::BuildRows(const std::vector<const TransitionMap*>& trans, bool compact) {
+  int threads = 1;
+  if (config_.table_build == TableBuild::Parallel) {
+    threads = config_.build_threads > 0 ? config_.build_threads
+                                        : static_cast<int>(std::thread::hardware_concurrency());
+    // A thread per few thousand states at most
+    threads = std::clamp(threads, 1, std::max(1, num_states_ / 4096));
+  }
+
+  // Thread t resolves its slice of the states straight into table_, or
+  // for compact_ into its own entry list (row ends in `ends`), appended
+  // in order once all threads are done
+  struct Part {
+    std::vector<std::pair<uint8_t, uint32_t>> entries;
+    std::vector<size_t> ends;
+  };
+  std::vector<Part> parts(threads);
+  auto build = [&](int t) {
+    const uint32_t begin = static_cast<uint32_t>(int64_t{num_states_} * t / threads);
+    const uint32_t end = static_cast<uint32_t>(int64_t{num_states_} * (t + 1) / threads);
+    Part& part = parts[t];
+    std::vector<std::pair<uint8_t, FlatTransition>> row;
+    for (uint32_t sid = begin; sid < end; ++sid) {
+      ResolveRow(trans[sid], row);
+      for (const auto& [si, ft] : row) {
+        if (compact) {
+          part.entries.push_back({si, CompactTable::Pack(ft.next, ft.write, ft.dir)});
+        } else {
+          table_[sid * num_symbols_ + si] = ft;
+        }
+      }
+      if (compact) part.ends.push_back(part.entries.size());
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; ++t) workers.emplace_back(build, t);
+  build(0);
+  for (auto& w : workers) w.join();
+
+  if (!compact) return;
+  std::vector<std::pair<uint8_t, uint32_t>> row;
+  for (const Part& part : parts) {
+    size_t from = 0;
+    for (size_t end : part.ends) {
+      row.assign(part.entries.begin() + from, part.entries.begin() + end);
+      compact_.AddRow(row);
+      from = end;
+    }
+  }
+}
+
+void CompiledTM::BuildRow(uint32_t sid) const {
+  auto it = lazy_tm_->delta.find(id_to_state_[sid]);
+  std::vector<std::pair<uint8_t, FlatTransition>> resolved;
+  ResolveRow(it != lazy_tm_->delta.end() ? &it->second : nullptr, resolved);
+  std::vector<std::pair<uint8_t, uint32_t>> row;
+  row.reserve(resolved.size());
+  for (const auto& [si, ft] : resolved) {
+    row.push_back({si, CompactTable::Pack(ft.next, ft.write, ft.dir)});
+  }
+  compact_.SetRow(sid, row);
+  if (sid < halt_threshold_) ClassifyScan(sid);
+}
+
+void CompiledTM::ExpandTable() {
+  if (!table_.empty()) return;
+  if (lazy_tm_) {
+    for (uint32_t sid = 0; sid < static_cast<uint32_t>(num_states_); ++sid) {
+      if (!compact_.Built(sid)) BuildRow(sid);
+    }
+    lazy_tm_ = nullptr;
+  }
+  std::vector<FlatTransition> table(static_cast<size_t>(num_states_) * num_symbols_);
+  for (uint32_t sid = 0; sid < static_cast<uint32_t>(num_states_); ++sid) {
+    for (int si = 0; si < num_symbols_; ++si) table[sid * num_symbols_ + si] = Entry(sid, si);
+  }
+  table_.swap(table);
+  BuildKernel();
+}
+
+FlatTransition CompiledTM::Entry(uint32_t state, uint32_t sym) const {
+  if (!table_.empty()) return table_[state * num_symbols_ + sym];
+  const uint32_t e = compact_.Lookup(state, sym);
+  const uint32_t code = CompactTable::Code(e);
+  if (code == CompactTable::kScanCode) {
+    return {state, static_cast<uint8_t>(sym), scan_classes_[scan_class_[state]].dir, 1};
+  }
+  return {CompactTable::Next(e), CompactTable::Write(e), static_cast<int8_t>(static_cast<int>(code) - 1), 0};
+}
+
+bool CompiledTM::ClassifyScan(uint32_t sid) const {
+  // A running state is a scan state when every entry that loops back to
+  // itself writes the symbol it read and moves the same way (L or R).
+  // Those entries get the scan flag; all other symbols stop the scan.
+  int8_t dir = 0;
+  std::vector<bool> is_stop(num_symbols_, true);
+  for (int si = 0; si < num_symbols_; ++si) {
+    const FlatTransition ft = Entry(sid, si);
+    if (ft.next != sid) continue;
+    if (ft.write != si || ft.dir == 0 || (dir != 0 && ft.dir != dir)) return false;
+    dir = ft.dir;
+    is_stop[si] = false;
+  }
+  if (dir == 0) return false;
+
+  auto key = std::make_pair(dir, is_stop);
+  auto it = scan_class_ids_.find(key);
+  if (it == scan_class_ids_.end()) {
+    it = scan_class_ids_.emplace(key, static_cast<uint32_t>(scan_classes_.size())).first;
+    scan_classes_.push_back({dir, MakeStopSet(is_stop)});
+  }
+  scan_class_[sid] = it->second;
+  if (table_.empty()) {
+    for (int si = 0; si < num_symbols_; ++si) {
+      if (!is_stop[si]) compact_.Set(sid, si, CompactTable::PackScan(sid, static_cast<uint8_t>(si)));
+    }
+  }
+  return true;
+}
+
+void CompiledTM::BuildKernel() {
+  // Pad rows to a power of two up to 32 symbols; larger alphabets keep
+  // their natural stride and use the generic kernel
+  uint32_t stride = 2;
+  while (stride < static_cast<uint32_t>(num_symbols_)) stride *= 2;
+  switch (stride) {
+    case 2:
+      kernel_ = &CompiledTM::RunKernel<2>;
+      table_kernel_ = &CompiledTM::RunTableKernel<2>;
+      break;
+    case 4:
+      kernel_ = &CompiledTM::RunKernel<4>;
+      table_kernel_ = &CompiledTM::RunTableKernel<4>;
+      break;
+    case 8:
+      kernel_ = &CompiledTM::RunKernel<8>;
+      table_kernel_ = &CompiledTM::RunTableKernel<8>;
+      break;
+    case 16:
+      kernel_ = &CompiledTM::RunKernel<16>;
+      table_kernel_ = &CompiledTM::RunTableKernel<16>;
+      break;
+    case 32:
+      kernel_ = &CompiledTM::RunKernel<32>;
+      table_kernel_ = &CompiledTM::RunTableKernel<32>;
+      break;
+    default:
+      stride = static_cast<uint32_t>(num_symbols_);
+      kernel_ = &CompiledTM::RunKernel<0>;
+      table_kernel_ = &CompiledTM::RunTableKernel<0>;
+  }
+  kernel_stride_ = stride;
+  kernel_halt_row_ = halt_threshold_ * stride;
+
+  // Small alphabets can pack the tape: 2 bits per cell up to 4 symbols,
+  // 4 bits up to 16
+  switch (stride) {
+    case 2:
+      tape_bits_ = 2;
+      packed_kernel_ = &CompiledTM::RunKernel<2, 2>;
+      packed_table_kernel_ = &CompiledTM::RunTableKernel<2, 2>;
+      break;
+    case 4:
+      tape_bits_ = 2;
+      packed_kernel_ = &CompiledTM::RunKernel<4, 2>;
+      packed_table_kernel_ = &CompiledTM::RunTableKernel<4, 2>;
+      break;
+    case 8:
+      tape_bits_ = 4;
+      packed_kernel_ = &CompiledTM::RunKernel<8, 4>;
+      packed_table_kernel_ = &CompiledTM::RunTableKernel<8, 4>;
+      break;
+    case 16:
+      tape_bits_ = 4;
+      packed_kernel_ = &CompiledTM::RunKernel<16, 4>;
+      packed_table_kernel_ = &CompiledTM::RunTableKernel<16, 4>;
+      break;
+    default:
+      tape_bits_ = 8;
+      packed_kernel_ = nullptr;
+      packed_table_kernel_ = nullptr;
+  }
+
+  // Scan-state loop entries leave the kernel like a halt: they go to
+  // kScanRow | state, an out-of-range row, without writing or moving.
+  // Padding entries are never read: tape cells hold valid symbol indices.
+  kernel_table_.assign(static_cast<size_t>(num_states_) * stride, KernelTransition{0, 0, 0});
+  for (int sid = 0; sid < num_states_; ++sid) {
+    for (int si = 0; si < num_symbols_; ++si) {
+      const FlatTransition& ft = table_[sid * num_symbols_ + si];
+      KernelTransition& kt = kernel_table_[sid * stride + si];
+      if (ft.scan) {
+        kt = {kScanRow | static_cast<uint32_t>(sid), static_cast<uint8_t>(si), 0};
+      } else {
+        kt = {ft.next * stride, ft.write, ft.dir};
+      }
+    }
+  }
+}
+
+template <int kStride, int kBits>
+int64_t CompiledTM::RunKernel(uint8_t* tape, int64_t& head, uint32_t& row, int64_t n) const {
+  return RunTableKernel<kStride, kBits>(kernel_table_.data(), tape, head, row, n);
+}
+
+template <int kStride, int kBits>
+int64_t CompiledTM::RunTableKernel(const KernelTransition* tbl, uint8_t* tape, int64_t& head_io,
+                                   uint32_t& row_io, int64_t n) const {
+  const uint32_t halt_row = kernel_halt_row_;
+  uint32_t row = row_io;
+  int64_t head = head_io;
+  int64_t i = 0;
+  for (; i < n && row < halt_row; ++i) {
+    if constexpr (kBits == 8) {
+      uint32_t sym = tape[head];
+      if (kStride) sym &= kStride - 1;  // lets the compiler see the row bound
+      const KernelTransition& t = tbl[row + sym];
+      tape[head] = t.write;
+      row = t.next_row;
+      head += t.dir;
+    } else {
+      // Read-modify-write of the byte holding the cell (packed_tape.hpp)
+      constexpr int kShift = kBits == 2 ? 2 : 1;
+      constexpr uint32_t kMask = (1u << kBits) - 1;
+      uint8_t* byte = tape + (head >> kShift);
+      const unsigned sh = static_cast<unsigned>(head & ((1 << kShift) - 1)) * kBits;
+      const uint32_t b = *byte;
+      uint32_t sym = (b >> sh) & kMask;
+      if (kStride) sym &= kStride - 1;
+      const KernelTransition& t = tbl[row + sym];
+      *byte = static_cast<uint8_t>((b & ~(kMask << sh)) | (uint32_t{t.write} << sh));
+      row = t.next_row;
+      head += t.dir;
+    }
+    head &= ~(head >> 63);  // left-bounded (Sipser), branch-free
+  }
+  head_io = head;
+  row_io = row;
+  return i;
+}
+
+int64_t CompiledTM::RunCompactKernel(uint8_t* tape, int64_t& head_io, uint32_t& state_io,
+                                     int64_t n) const {
+  const CompactTable& tbl = compact_;
+  const uint32_t halt = halt_threshold_;
+  uint32_t state = state_io;
+  int64_t head = head_io;
+  int64_t i = 0;
+  for (; i < n && state < halt; ++i) {
+    const uint32_t e = tbl.Lookup(state, tape[head]);
+    const uint32_t code = CompactTable::Code(e);
+    if (code == CompactTable::kScanCode) {
+      // Leave like RunKernel does, counting the entry as a step
+      state |= kScanRow;
+      ++i;
+      break;
+    }
+    tape[head] = CompactTable::Write(e);
+    state = CompactTable::Next(e);
+    head += static_cast<int64_t>(code) - 1;
+    head &= ~(head >> 63);
+  }
+  head_io = head;
+  state_io = state;
+  return i;
+}
+
+bool CompiledTM::SkipScan(const uint8_t* tape, size_t size, int64_t& head, uint32_t state,
+                          int64_t& steps, int64_t max, int bits) const {
+  // Every cell up to the next stop symbol is rewritten unchanged, so jump
+  // straight there. Cells from `size` on are blank.
+  const ScanState& sc = scan_classes_[scan_class_[state]];
+  int64_t budget = max - steps;
+  if (sc.dir > 0) {
+    size_t n = size > static_cast<size_t>(head) ? size - head : 0;
+    size_t dist = bits == 8 ? FindStopForward(tape + head, n, sc.stops)
+                            : FindStopForwardPacked(tape, head, head + n, bits, sc.stops) - head;
+    if (dist == n && !sc.stops.stop[blank_idx_] && budget > static_cast<int64_t>(n)) {
+      // Runs off into blank tape that never stops it
+      steps = max;
+      return false;
+    }
+    int64_t moved = std::min<int64_t>(static_cast<int64_t>(dist), budget);
+    head += moved;
+    steps += moved;
+  } else {
+    size_t stop = bits == 8 ? FindStopBackward(tape, head + 1, sc.stops)
+                            : FindStopBackwardPacked(tape, head + 1, bits, sc.stops);
+    // With no stop symbol left of the head the scan pins itself against
+    // cell 0 until the step limit
+    int64_t dist = (stop == kNotFound) ? budget : head - static_cast<int64_t>(stop);
+    int64_t moved = std::min(dist, budget);
+    head = std::max<int64_t>(head - moved, 0);
+    steps += moved;
+  }
+  return true;
+}
+
+}  // namespace tmc
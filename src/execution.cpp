@@ -0,0 +1,287 @@
+#include "tmc/execution.hpp"
+#include "tmc/packed_tape.hpp"
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+
+namespace tmc {
+
+namespace {
+
+// CPU time the calling thread has used, in milliseconds (wall time
+// where there is no per-thread clock)
+double ThreadCpuMs() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) * 1e3 + static_cast<double>(ts.tv_nsec) / 1e6;
+#else
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+}  // namespace
+
+CheckpointTimer::CheckpointTimer(const RunOptions& options, int64_t steps) {
+  if (!options.on_checkpoint) return;
+  if (options.checkpoint_steps > 0) {
+    every_steps_ = options.checkpoint_steps;
+    next_steps_ = steps + every_steps_;
+  }
+  if (options.checkpoint_ms > 0) {
+    every_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double, std::milli>(options.checkpoint_ms));
+    next_time_ = std::chrono::steady_clock::now() + every_;
+    next_poll_ = steps + kPollSteps;
+  }
+}
+
+bool CheckpointTimer::Due(int64_t steps) {
+  bool due = false;
+  if (steps >= next_steps_) {
+    due = true;
+  } else if (steps >= next_poll_) {
+    next_poll_ = steps + kPollSteps;
+    due = std::chrono::steady_clock::now() >= next_time_;
+  }
+  if (!due) return false;
+  if (every_steps_ > 0) next_steps_ = steps + every_steps_;
+  if (next_poll_ != INT64_MAX) next_time_ = std::chrono::steady_clock::now() + every_;
+  return true;
+}
+
+RunWatch::RunWatch(const RunOptions& options)
+    : deadline_(options.deadline), stop_(options.stop),
+      check_steps_(std::max<int64_t>(options.check_steps, 1)) {
+  if (options.cpu_ms > 0) cpu_end_ms_ = ThreadCpuMs() + options.cpu_ms;
+  // Nothing to watch: never check
+  if (stop_ || cpu_end_ms_ > 0 || deadline_ != std::chrono::steady_clock::time_point::max()) {
+    next_check_ = 0;
+  }
+}
+
+bool RunWatch::Check(int64_t steps) {
+  if (expired_) return true;
+  expired_ = (stop_ && stop_->load(std::memory_order_relaxed)) ||
+             (deadline_ != std::chrono::steady_clock::time_point::max() &&
+              std::chrono::steady_clock::now() >= deadline_) ||
+             (cpu_end_ms_ > 0 && ThreadCpuMs() >= cpu_end_ms_);
+  // Once expired, every later call comes here and says so
+  next_check_ = expired_ ? INT64_MIN : steps + check_steps_;
+  return expired_;
+}
+
+Execution::Execution(std::shared_ptr<const CompiledTM> tm, int64_t max_steps)
+    : tm_(std::move(tm)), max_steps_(max_steps) {}
+
+RunResult Execution::Run(const std::string& input, const RunOptions& options) {
+  const CompiledTM& tm = *tm_;
+  cells_.resize(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    cells_[i] = tm.char_to_idx_[static_cast<unsigned char>(input[i])];
+  }
+  return RunFrom(input, tm.start_id_, 0, 0, options);
+}
+
+RunResult Execution::Resume(const Checkpoint& ckpt, const RunOptions& options) {
+  const CompiledTM& tm = *tm_;
+  if (ckpt.state >= static_cast<uint32_t>(tm.num_states_) || ckpt.head < 0 || ckpt.steps < 0) {
+    throw std::runtime_error("Checkpoint does not fit this machine");
+  }
+  for (uint8_t c : ckpt.cells) {
+    if (c >= tm.num_symbols_) throw std::runtime_error("Checkpoint does not fit this machine");
+  }
+  cells_ = ckpt.cells;
+  return RunFrom(ckpt.input, ckpt.state, ckpt.head, ckpt.steps, options);
+}
+
+RunResult Execution::RunFrom(const std::string& input, uint32_t state_id, int64_t head,
+                             int64_t steps, const RunOptions& options) {
+  if (options.metrics) return RunMeasured(state_id, head, steps, options);
+  const CompiledTM& tm = *tm_;
+  // Tape capacity and extent are in bytes; the head counts cells.
+  // With only the compact table, rows are plain state IDs and cells bytes
+  const bool compact = tm.table_.empty();
+  const int bits = !compact && cells_.size() >= tm.config_.pack_min_cells ? tm.tape_bits_ : 8;
+  const CompiledTM::Kernel kernel = compact ? &CompiledTM::RunCompactKernel
+                                  : bits == 8 ? tm.kernel_ : tm.packed_kernel_;
+  const uint32_t stride = compact ? 1 : tm.kernel_stride_;
+  const int64_t per_byte = 8 / bits;
+  VirtualTape& tape = tape_;
+  tape.Assign(cells_.data(), PackCellsInPlace(cells_.data(), cells_.size(), bits));
+
+  uint32_t row = state_id * stride;
+  const int64_t max = max_steps_;
+  const uint32_t halt_row = tm.halt_threshold_ * stride;
+  RunWatch watch(options);
+  CheckpointTimer timer(options, steps);
+
+  // The running configuration, for RunOptions::on_checkpoint
+  auto checkpoint = [&] {
+    Checkpoint ckpt;
+    ckpt.input = input;
+    ckpt.max_steps = max;
+    ckpt.state = row / stride;
+    ckpt.head = head;
+    ckpt.steps = steps;
+    const size_t n = std::max(tape.extent() * per_byte, static_cast<size_t>(head + 1));
+    ckpt.cells.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      ckpt.cells[i] = static_cast<uint8_t>(GetCell(tape.data(), i, bits));
+    }
+    options.on_checkpoint(ckpt);
+  };
+
+  // For RunOptions::on_sample: the next sample point, the step a
+  // sample_now request is taken at, and a sample here
+  const int64_t every = options.on_sample ? options.sample_steps : 0;
+  int64_t next_sample = every > 0 ? (steps / every + 1) * every : INT64_MAX;
+  int64_t timed_sample = INT64_MAX;
+  auto sample = [&](int64_t weight) {
+    Sample s;
+    s.steps = steps;
+    s.state = row / stride;
+    s.head = head;
+    s.symbol = head < static_cast<int64_t>(tape.capacity()) * per_byte
+                   ? static_cast<uint8_t>(GetCell(tape.data(), static_cast<size_t>(head), bits))
+                   : tm.blank_idx_;
+    s.weight = weight;
+    options.on_sample(s);
+  };
+
+  while (row < halt_row && steps < max && !watch.Expired(steps)) {
+    if (timer.Due(steps)) checkpoint();
+    if (steps >= next_sample) {
+      const int64_t crossed = (steps - next_sample) / every + 1;
+      next_sample += crossed * every;
+      sample(crossed);
+    }
+    if (steps >= timed_sample) {
+      timed_sample = INT64_MAX;
+      sample(1);
+    } else if (timed_sample == INT64_MAX && options.on_sample && options.sample_now &&
+               options.sample_now->load(std::memory_order_relaxed)) {
+      // Chunks end where scans do, so a sample taken at the end of this
+      // one would be skewed: take it at an arbitrary step a little ahead
+      options.sample_now->store(false, std::memory_order_relaxed);
+      const uint64_t jitter = (static_cast<uint64_t>(steps) * 0x9e3779b97f4a7c15ull) >> 48;
+      timed_sample = steps + 1 + static_cast<int64_t>(jitter);
+    }
+    // The head moves at most one cell per step, so a chunk of n steps
+    // stays inside the tape without bounds checks. Chunks are capped so
+    // the tape's extent stays a tight bound on the cells written.
+    if (head + 1 >= static_cast<int64_t>(tape.capacity()) * per_byte) {
+      tape.Grow(PackedBytes(static_cast<size_t>(head + 2), bits));
+    }
+    int64_t cells = static_cast<int64_t>(tape.capacity()) * per_byte;
+    int64_t n = std::min({max - steps, cells - 1 - head, kFlatChunk, next_sample - steps,
+                          timed_sample - steps});
+    int64_t start = head;
+    int64_t done = (tm.*kernel)(tape.data(), head, row, n);
+    steps += done;
+    tape.Touch(PackedBytes(static_cast<size_t>(start + done + 1), bits));
+    if (!(row & kScanRow)) continue;
+
+    // Stopped on a scan state's loop symbol; that entry was not a step
+    uint32_t state = row & ~kScanRow;
+    row = state * stride;
+    --steps;
+    if (compact && !tm.compact_.Built(state)) {
+      // Lazy build: first time in this state
+      tm.BuildRow(state);
+      continue;
+    }
+    if (!tm.SkipScan(tape.data(), tape.extent() * per_byte, head, state, steps, max, bits)) break;
+    tape.Touch(PackedBytes(static_cast<size_t>(head + 1), bits));
+  }
+  uint32_t state = row / stride;
+  // Stopped early: where to pick it up again
+  if (watch.expired() && options.on_checkpoint) checkpoint();
+
+  // Build result
+  RunResult result;
+  result.accepted = (state == tm.accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < tm.halt_threshold_);
+  result.timed_out = watch.expired();
+  if (!options.final_tape) return result;
+
+  // Extract final tape contents (convert back to chars, trim blanks)
+  const uint8_t* data = tape.data();
+  result.final_tape = tm.DecodeTape(tape.extent() * per_byte,
+                                    [&](size_t i) { return GetCell(data, i, bits); });
+  return result;
+}
+
+RunResult Execution::RunMeasured(uint32_t state_id, int64_t head, int64_t steps,
+                                 const RunOptions& options) {
+  const CompiledTM& tm = *tm_;
+  const bool compact = tm.table_.empty();
+  const int bits = !compact && cells_.size() >= tm.config_.pack_min_cells ? tm.tape_bits_ : 8;
+  std::vector<uint8_t>& tape = cells_;
+  std::vector<bool> written(tape.size(), false);
+  auto metrics = std::make_shared<RunMetrics>();
+  RunMetrics& m = *metrics;
+  m.max_head = head;
+  int64_t widest = std::max(static_cast<int64_t>(tape.size()), head + 1);
+  int last_dir = 0;
+
+  uint32_t state = state_id;
+  const int64_t max = max_steps_;
+  RunWatch watch(options);
+  while (state < tm.halt_threshold_ && steps < max && !watch.Expired(steps)) {
+    tm.GrowTape(tape, head);
+    if (written.size() < tape.size()) written.resize(tape.size(), false);
+    const uint8_t sym = tape[head];
+    const FlatTransition t = tm.Lookup(state, sym);
+    if (t.scan) {
+      // The whole scan in one go: it rewrites every cell unchanged and
+      // never turns, so it adds only its distance
+      const int64_t before = steps;
+      const int64_t from = head;
+      if (!tm.SkipScan(tape.data(), tape.size(), head, state, steps, max)) {
+        // Right into blank tape for good, to the step limit
+        head = from + (max - before);
+      }
+      m.heatmap.VisitRun(before, from, t.dir, steps - before);
+      if (head != from) {
+        if (last_dir != 0 && t.dir != last_dir) ++m.reversals;
+        last_dir = t.dir;
+        m.travel += head > from ? head - from : from - head;
+        m.max_head = std::max(m.max_head, head);
+      }
+      continue;
+    }
+    m.heatmap.Visit(steps, head);
+    if (t.write != sym && !written[head]) {
+      written[head] = true;
+      ++m.cells_written;
+    }
+    tape[head] = t.write;
+    state = t.next;
+    // Only moves count: a left move at cell 0 stays put
+    const int64_t to = std::max<int64_t>(head + t.dir, 0);
+    if (to != head) {
+      if (last_dir != 0 && t.dir != last_dir) ++m.reversals;
+      last_dir = t.dir;
+      ++m.travel;
+      head = to;
+      m.max_head = std::max(m.max_head, head);
+    }
+    ++steps;
+  }
+  widest = std::max(widest, m.max_head + 1);
+  m.peak_tape_bytes = static_cast<int64_t>(PackedBytes(static_cast<size_t>(widest), bits));
+
+  RunResult result;
+  result.accepted = (state == tm.accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < tm.halt_threshold_);
+  result.timed_out = watch.expired();
+  result.metrics = std::move(metrics);
+  if (options.final_tape) result.final_tape = tm.DecodeTape(tape);
+  return result;
+}
+
+}  // namespace tmc
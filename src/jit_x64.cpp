@@ -0,0 +1,210 @@
+#include "tmc/jit.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define TMC_JIT_X64 1
+#endif
+
+namespace tmc {
+
+#ifdef TMC_JIT_X64
+
+static_assert(offsetof(JitState, tape) == 0 && offsetof(JitState, head) == 8 &&
+                  offsetof(JitState, size) == 16 && offsetof(JitState, budget) == 24 &&
+                  offsetof(JitState, state) == 32,
+              "JIT code hardcodes the JitState layout");
+
+namespace {
+
+// Byte buffer with labels, patched once the final address is known
+class Assembler {
+public:
+  void Emit(std::initializer_list<uint8_t> bytes) { code_.insert(code_.end(), bytes); }
+
+  void Imm32(uint32_t v) {
+    for (int i = 0; i < 4; ++i) code_.push_back(static_cast<uint8_t>(v >> (8 * i)));
+  }
+
+  int NewLabel() {
+    labels_.push_back(0);
+    return static_cast<int>(labels_.size()) - 1;
+  }
+
+  void Bind(int label) { labels_[label] = code_.size(); }
+
+  // 32-bit displacement to `label`, relative to the end of the field
+  void Rel32(int label) {
+    rel_.push_back({code_.size(), label});
+    Imm32(0);
+  }
+
+  // 64-bit absolute address of `label`
+  void Abs64(int label) {
+    abs_.push_back({code_.size(), label});
+    code_.insert(code_.end(), 8, 0);
+  }
+
+  void Align(size_t n) {
+    while (code_.size() % n) code_.push_back(0xCC);  // int3
+  }
+
+  size_t Size() const { return code_.size(); }
+
+  void CopyTo(uint8_t* dst) const {
+    std::memcpy(dst, code_.data(), code_.size());
+    for (const Fixup& f : rel_) {
+      int32_t d = static_cast<int32_t>(labels_[f.label] - (f.pos + 4));
+      std::memcpy(dst + f.pos, &d, 4);
+    }
+    for (const Fixup& f : abs_) {
+      uint64_t a = reinterpret_cast<uint64_t>(dst + labels_[f.label]);
+      std::memcpy(dst + f.pos, &a, 8);
+    }
+  }
+
+private:
+  struct Fixup {
+    size_t pos;
+    int label;
+  };
+  std::vector<uint8_t> code_;
+  std::vector<size_t> labels_;
+  std::vector<Fixup> rel_;
+  std::vector<Fixup> abs_;
+};
+
+}  // namespace
+
+// Register use inside generated code:
+//   rbp = JitState*, r12 = tape, r13 = head, r14 = size, r15 = budget,
+//   ebx = state on exit, rax/rcx = scratch
+std::unique_ptr<JitProgram> JitProgram::Compile(const std::vector<FlatTransition>& table,
+                                                int num_symbols, uint32_t halt_threshold) {
+  if (table.size() > kMaxEntries || halt_threshold == 0) return nullptr;
+  const uint32_t running = halt_threshold;
+
+  Assembler a;
+  int state_table = a.NewLabel();
+  int leave = a.NewLabel();
+  std::vector<int> entry(running), exit(running), sym_table(running);
+  for (uint32_t s = 0; s < running; ++s) {
+    entry[s] = a.NewLabel();
+    exit[s] = a.NewLabel();
+    sym_table[s] = a.NewLabel();
+  }
+  std::vector<int> stub(table.size(), -1);
+
+  // Prologue: save callee-saved registers, load the machine state and
+  // jump to the current state's block
+  a.Emit({0x55, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});  // push rbp..r15
+  a.Emit({0x48, 0x89, 0xFD});        // mov rbp, rdi
+  a.Emit({0x4C, 0x8B, 0x65, 0x00});  // mov r12, [rbp+0]
+  a.Emit({0x4C, 0x8B, 0x6D, 0x08});  // mov r13, [rbp+8]
+  a.Emit({0x4C, 0x8B, 0x75, 0x10});  // mov r14, [rbp+16]
+  a.Emit({0x4C, 0x8B, 0x7D, 0x18});  // mov r15, [rbp+24]
+  a.Emit({0x8B, 0x45, 0x20});        // mov eax, [rbp+32]
+  a.Emit({0x48, 0x8D, 0x0D});        // lea rcx, [rip+state_table]
+  a.Rel32(state_table);
+  a.Emit({0xFF, 0x24, 0xC1});  // jmp [rcx+rax*8]
+
+  // Epilogue: store head, budget and state back
+  a.Bind(leave);
+  a.Emit({0x4C, 0x89, 0x6D, 0x08});  // mov [rbp+8], r13
+  a.Emit({0x4C, 0x89, 0x7D, 0x18});  // mov [rbp+24], r15
+  a.Emit({0x89, 0x5D, 0x20});        // mov [rbp+32], ebx
+  a.Emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D});  // pop r15..rbp
+  a.Emit({0xC3});                                                        // ret
+
+  for (uint32_t s = 0; s < running; ++s) {
+    a.Align(16);
+    a.Bind(entry[s]);
+    a.Emit({0x4D, 0x85, 0xFF});  // test r15, r15
+    a.Emit({0x0F, 0x84});        // jz exit
+    a.Rel32(exit[s]);
+    a.Emit({0x4D, 0x39, 0xF5});  // cmp r13, r14
+    a.Emit({0x0F, 0x83});        // jae exit
+    a.Rel32(exit[s]);
+    a.Emit({0x43, 0x0F, 0xB6, 0x04, 0x2C});  // movzx eax, byte [r12+r13]
+    a.Emit({0x48, 0x8D, 0x0D});              // lea rcx, [rip+sym_table]
+    a.Rel32(sym_table[s]);
+    a.Emit({0xFF, 0x24, 0xC1});  // jmp [rcx+rax*8]
+
+    a.Bind(exit[s]);
+    a.Emit({0xBB});  // mov ebx, s
+    a.Imm32(s);
+    a.Emit({0xE9});  // jmp leave
+    a.Rel32(leave);
+
+    for (int sym = 0; sym < num_symbols; ++sym) {
+      const FlatTransition& t = table[s * num_symbols + sym];
+      if (t.scan) continue;  // handled by the caller
+      stub[s * num_symbols + sym] = a.NewLabel();
+      a.Bind(stub[s * num_symbols + sym]);
+      if (t.write != sym) {
+        a.Emit({0x43, 0xC6, 0x04, 0x2C, t.write});  // mov byte [r12+r13], write
+      }
+      a.Emit({0x49, 0xFF, 0xCF});  // dec r15
+      if (t.dir > 0) {
+        a.Emit({0x49, 0xFF, 0xC5});  // inc r13
+      } else if (t.dir < 0) {
+        a.Emit({0x31, 0xC9});              // xor ecx, ecx
+        a.Emit({0x49, 0xFF, 0xCD});        // dec r13
+        a.Emit({0x4C, 0x0F, 0x48, 0xE9});  // cmovs r13, rcx (left-bounded)
+      }
+      if (t.next >= halt_threshold) {
+        a.Emit({0xBB});  // mov ebx, next
+        a.Imm32(t.next);
+        a.Emit({0xE9});  // jmp leave
+        a.Rel32(leave);
+      } else {
+        a.Emit({0xE9});  // jmp next state's block
+        a.Rel32(entry[t.next]);
+      }
+    }
+  }
+
+  a.Align(8);
+  a.Bind(state_table);
+  for (uint32_t s = 0; s < running; ++s) a.Abs64(entry[s]);
+  for (uint32_t s = 0; s < running; ++s) {
+    a.Bind(sym_table[s]);
+    for (int sym = 0; sym < num_symbols; ++sym) {
+      int target = stub[s * num_symbols + sym];
+      a.Abs64(target >= 0 ? target : exit[s]);
+    }
+  }
+
+  size_t size = a.Size();
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return nullptr;
+  a.CopyTo(static_cast<uint8_t*>(mem));
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    return nullptr;
+  }
+  return std::unique_ptr<JitProgram>(new JitProgram(mem, size));
+}
+
+JitProgram::~JitProgram() {
+  munmap(code_, size_);
+}
+
+void JitProgram::Run(JitState& s) const {
+  reinterpret_cast<void (*)(JitState*)>(code_)(&s);
+}
+
+#else  // !TMC_JIT_X64
+
+std::unique_ptr<JitProgram> JitProgram::Compile(const std::vector<FlatTransition>&, int,
+                                                uint32_t) {
+  return nullptr;
+}
+
+JitProgram::~JitProgram() {}
+
+void JitProgram::Run(JitState&) const {}
+
+#endif
+
+}  // namespace tmc
@@ -0,0 +1,350 @@
+#include "tmc/lockstep.hpp"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TMC_LOCKSTEP_X86 1
+#include <immintrin.h>
+#endif
+
+namespace tmc {
+
+namespace {
+
+constexpr int kMaxLanes = 32;
+
+// Lockstep steps between checks for halted lanes and heads near the end
+// of their tape
+constexpr int kBlock = 16;
+
+// Longest input given a lane; longer ones go to the Execution
+constexpr size_t kMaxLaneInput = 4096;
+
+// A lane runs at most this many steps (its count is 32 bits) before it
+// is handed to the Execution
+constexpr int64_t kMaxLaneSteps = int64_t{1} << 30;
+
+// Each lane's configuration. Rows are state IDs shifted by the table's
+// row shift, heads count cells from the lane's tape base.
+struct LaneState {
+  alignas(64) int32_t row[kMaxLanes];
+  alignas(64) int32_t head[kMaxLanes];
+  alignas(64) int32_t steps[kMaxLanes];
+  alignas(64) int32_t hi[kMaxLanes];    // rightmost cell the head reached
+  alignas(64) int32_t base[kMaxLanes];  // lane's first cell in the tape
+};
+
+// Run every lane `n` steps; lanes halted or at `max` steps stand still
+using StepFn = void (*)(LaneState&, const uint32_t* table, uint32_t* tape,
+                        int32_t halt_row, int32_t max, int n);
+
+void StepScalar(LaneState& s, const uint32_t* table, uint32_t* tape, int32_t halt_row,
+                int32_t max, int n) {
+  for (int i = 0; i < n; ++i) {
+    for (int l = 0; l < 8; ++l) {
+      if (s.row[l] >= halt_row || s.steps[l] >= max) continue;
+      uint32_t* cell = &tape[s.base[l] + s.head[l]];
+      const uint32_t e = table[s.row[l] + *cell];
+      *cell = (e >> 2) & 0xff;
+      s.head[l] = std::max(s.head[l] + static_cast<int32_t>(e & 3) - 1, 0);
+      s.row[l] = static_cast<int32_t>(e >> 10);
+      ++s.steps[l];
+      s.hi[l] = std::max(s.hi[l], s.head[l]);
+    }
+  }
+}
+
+#ifdef TMC_LOCKSTEP_X86
+
+__attribute__((target("avx2")))
+inline __m256i Load8(const int32_t* p) {
+  return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2")))
+inline void Store8(int32_t* p, __m256i v) {
+  _mm256_store_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+__attribute__((target("avx2")))
+void StepAvx2(LaneState& s, const uint32_t* table, uint32_t* tape, int32_t halt_row,
+              int32_t max, int n) {
+  const int* tp = reinterpret_cast<const int*>(tape);
+  const int* tb = reinterpret_cast<const int*>(table);
+  const __m256i halt_v = _mm256_set1_epi32(halt_row);
+  const __m256i max_v = _mm256_set1_epi32(max);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  __m256i base[2], row[2], head[2], steps[2], hi[2];
+  for (int g = 0; g < 2; ++g) {
+    base[g] = Load8(s.base + 8 * g);
+    row[g] = Load8(s.row + 8 * g);
+    head[g] = Load8(s.head + 8 * g);
+    steps[g] = Load8(s.steps + 8 * g);
+    hi[g] = Load8(s.hi + 8 * g);
+  }
+  alignas(32) int32_t addr_out[8], write_out[8];
+
+  for (int i = 0; i < n; ++i) {
+    // Two independent groups of 8, so one's gathers overlap the other's
+    for (int g = 0; g < 2; ++g) {
+      const __m256i active = _mm256_and_si256(_mm256_cmpgt_epi32(halt_v, row[g]),
+                                              _mm256_cmpgt_epi32(max_v, steps[g]));
+      const __m256i addr = _mm256_add_epi32(base[g], head[g]);
+      const __m256i cell = _mm256_i32gather_epi32(tp, addr, 4);
+      const __m256i e = _mm256_i32gather_epi32(tb, _mm256_add_epi32(row[g], cell), 4);
+
+      // No scatter in AVX2: the writes go out one lane at a time,
+      // inactive lanes writing back what they read
+      const __m256i write =
+          _mm256_blendv_epi8(cell, _mm256_and_si256(_mm256_srli_epi32(e, 2), ff), active);
+      Store8(addr_out, addr);
+      Store8(write_out, write);
+      for (int l = 0; l < 8; ++l) tape[addr_out[l]] = static_cast<uint32_t>(write_out[l]);
+
+      const __m256i dir =
+          _mm256_and_si256(_mm256_sub_epi32(_mm256_and_si256(e, three), one), active);
+      head[g] = _mm256_max_epi32(_mm256_add_epi32(head[g], dir), zero);
+      row[g] = _mm256_blendv_epi8(row[g], _mm256_srli_epi32(e, 10), active);
+      steps[g] = _mm256_sub_epi32(steps[g], active);
+      hi[g] = _mm256_max_epi32(hi[g], head[g]);
+    }
+  }
+  for (int g = 0; g < 2; ++g) {
+    Store8(s.row + 8 * g, row[g]);
+    Store8(s.head + 8 * g, head[g]);
+    Store8(s.steps + 8 * g, steps[g]);
+    Store8(s.hi + 8 * g, hi[g]);
+  }
+}
+
+__attribute__((target("avx512f")))
+void StepAvx512(LaneState& s, const uint32_t* table, uint32_t* tape, int32_t halt_row,
+                int32_t max, int n) {
+  const __m512i halt_v = _mm512_set1_epi32(halt_row);
+  const __m512i max_v = _mm512_set1_epi32(max);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i three = _mm512_set1_epi32(3);
+  const __m512i ff = _mm512_set1_epi32(0xff);
+  __m512i base[2], row[2], head[2], steps[2], hi[2];
+  for (int g = 0; g < 2; ++g) {
+    base[g] = _mm512_load_si512(s.base + 16 * g);
+    row[g] = _mm512_load_si512(s.row + 16 * g);
+    head[g] = _mm512_load_si512(s.head + 16 * g);
+    steps[g] = _mm512_load_si512(s.steps + 16 * g);
+    hi[g] = _mm512_load_si512(s.hi + 16 * g);
+  }
+
+  for (int i = 0; i < n; ++i) {
+    // Two independent groups of 16, so one's gathers overlap the other's
+    for (int g = 0; g < 2; ++g) {
+      const __mmask16 active = _mm512_cmplt_epi32_mask(row[g], halt_v) &
+                               _mm512_cmplt_epi32_mask(steps[g], max_v);
+      const __m512i addr = _mm512_add_epi32(base[g], head[g]);
+      // Masked forms throughout: the unmasked ones start from an undefined
+      // vector, which GCC flags as maybe-uninitialized
+      const __m512i cell = _mm512_mask_i32gather_epi32(zero, active, addr, tape, 4);
+      const __m512i e =
+          _mm512_mask_i32gather_epi32(zero, active, _mm512_add_epi32(row[g], cell), table, 4);
+      _mm512_mask_i32scatter_epi32(tape, active, addr,
+                                   _mm512_and_si512(_mm512_maskz_srli_epi32(active, e, 2), ff), 4);
+      const __m512i dir = _mm512_sub_epi32(_mm512_and_si512(e, three), one);
+      head[g] = _mm512_mask_max_epi32(head[g], active, _mm512_add_epi32(head[g], dir), zero);
+      row[g] = _mm512_mask_srli_epi32(row[g], active, e, 10);
+      steps[g] = _mm512_mask_add_epi32(steps[g], active, steps[g], one);
+      hi[g] = _mm512_mask_max_epi32(hi[g], active, hi[g], head[g]);
+    }
+  }
+  for (int g = 0; g < 2; ++g) {
+    _mm512_store_si512(s.row + 16 * g, row[g]);
+    _mm512_store_si512(s.head + 16 * g, head[g]);
+    _mm512_store_si512(s.steps + 16 * g, steps[g]);
+    _mm512_store_si512(s.hi + 16 * g, hi[g]);
+  }
+}
+
+#endif  // TMC_LOCKSTEP_X86
+
+// The widest kernel this CPU runs, and its lane count
+StepFn PickKernel(int& lanes) {
+#ifdef TMC_LOCKSTEP_X86
+  if (__builtin_cpu_supports("avx512f")) {
+    lanes = 32;
+    return StepAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    lanes = 16;
+    return StepAvx2;
+  }
+#endif
+  lanes = 8;
+  return StepScalar;
+}
+
+}  // namespace
+
+Lockstep::Lockstep(std::shared_ptr<const CompiledTM> tm, int64_t max_steps)
+    : tm_(std::move(tm)), max_steps_(max_steps), fallback_(tm_, max_steps) {
+  const CompiledTM& t = *tm_;
+  while ((1 << shift_) < t.num_symbols_) ++shift_;
+  // Rows must fit the entry's 22 bits of next row
+  if ((static_cast<uint64_t>(t.num_states_) << shift_) > (uint64_t{1} << 22)) return;
+  PickKernel(lanes_);
+
+  const uint32_t stride = 1u << shift_;
+  table_.assign(static_cast<size_t>(t.num_states_) * stride, 0);
+  for (uint32_t sid = 0; sid < static_cast<uint32_t>(t.num_states_); ++sid) {
+    uint32_t* row = &table_[sid * stride];
+    if (sid >= t.halt_threshold_) {
+      // Halted: stand still (lanes are masked out here anyway)
+      for (uint32_t si = 0; si < stride; ++si) row[si] = (sid << shift_) << 10 | si << 2 | 1;
+      continue;
+    }
+    if (t.table_.empty() && !t.compact_.Built(sid)) t.BuildRow(sid);
+    for (int si = 0; si < t.num_symbols_; ++si) {
+      const FlatTransition ft = t.Entry(sid, static_cast<uint32_t>(si));
+      row[si] = (ft.next << shift_) << 10 | static_cast<uint32_t>(ft.write) << 2 |
+                static_cast<uint32_t>(ft.dir + 1);
+    }
+  }
+  start_row_ = t.start_id_ << shift_;
+  halt_row_ = t.halt_threshold_ << shift_;
+}
+
+std::vector<RunResult> Lockstep::Run(const std::vector<std::string>& inputs,
+                                     const RunOptions& options) {
+  const CompiledTM& t = *tm_;
+  std::vector<RunResult> results(inputs.size());
+
+  // Deadline and stop flag, for the batch as a whole
+  RunWatch watch(options);
+
+  // Inputs that get a lane, and the widest of them
+  std::vector<size_t> queue;
+  std::vector<size_t> spill;
+  size_t longest = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (lanes_ > 0 && inputs[i].size() <= kMaxLaneInput) {
+      queue.push_back(i);
+      longest = std::max(longest, inputs[i].size());
+    } else {
+      spill.push_back(i);
+    }
+  }
+
+  if (!queue.empty()) {
+    int lanes = 0;
+    const StepFn step = PickKernel(lanes);
+
+    // Each lane's tape has room for twice its input; a head that gets
+    // within a block of the end hands its lane to the Execution
+    int32_t width = 256;
+    while (static_cast<size_t>(width) < 2 * longest + 2 * kBlock + 2) width *= 2;
+    tape_.assign(static_cast<size_t>(width) * kMaxLanes, t.blank_idx_);
+    const int32_t max = static_cast<int32_t>(std::min(max_steps_, kMaxLaneSteps));
+    const int32_t halt_row = static_cast<int32_t>(halt_row_);
+
+    LaneState s;
+    constexpr size_t kParked = SIZE_MAX;
+    size_t lane_input[kMaxLanes];
+    size_t next = 0;
+    int running = 0;
+
+    // Put the next input in lane l, or park the lane (a halted row)
+    auto refill = [&](int l) {
+      uint32_t* cells = &tape_[static_cast<size_t>(s.base[l])];
+      std::fill(cells, cells + s.hi[l] + 1, static_cast<uint32_t>(t.blank_idx_));
+      if (next == queue.size()) {
+        lane_input[l] = kParked;
+        s.row[l] = halt_row;
+        s.head[l] = s.steps[l] = s.hi[l] = 0;
+        return;
+      }
+      const std::string& in = inputs[queue[next]];
+      for (size_t i = 0; i < in.size(); ++i) {
+        cells[i] = t.char_to_idx_[static_cast<unsigned char>(in[i])];
+      }
+      lane_input[l] = queue[next++];
+      s.row[l] = static_cast<int32_t>(start_row_);
+      s.head[l] = s.steps[l] = 0;
+      s.hi[l] = std::max<int32_t>(static_cast<int32_t>(in.size()) - 1, 0);
+      ++running;
+    };
+
+    for (int l = 0; l < kMaxLanes; ++l) {
+      s.base[l] = l * width;
+      s.row[l] = halt_row;
+      s.head[l] = s.steps[l] = s.hi[l] = 0;
+      lane_input[l] = kParked;
+    }
+    for (int l = 0; l < lanes; ++l) refill(l);
+
+    // Lane l's configuration as input lane_input[l]'s result
+    auto record = [&](int l) {
+      RunResult& r = results[lane_input[l]];
+      const uint32_t state = static_cast<uint32_t>(s.row[l]) >> shift_;
+      r.accepted = (state == t.accept_id_);
+      r.steps = s.steps[l];
+      r.hit_limit = (r.steps >= max_steps_ && state < t.halt_threshold_);
+      if (!options.final_tape) return;
+      const uint32_t* cells = &tape_[static_cast<size_t>(s.base[l])];
+      r.final_tape = t.DecodeTape(static_cast<size_t>(s.hi[l]) + 1,
+                                  [&](size_t c) { return cells[c]; });
+    };
+
+    int64_t stepped = 0;  // lane steps run, counting idle lanes
+    while (running > 0) {
+      step(s, table_.data(), tape_.data(), halt_row, max, kBlock);
+      stepped += int64_t{kBlock} * lanes;
+      if (watch.Expired(stepped)) {
+        for (int l = 0; l < lanes; ++l) {
+          if (lane_input[l] == kParked) continue;
+          record(l);
+          results[lane_input[l]].timed_out = !results[lane_input[l]].hit_limit &&
+                                             s.row[l] < halt_row;
+        }
+        for (; next < queue.size(); ++next) spill.push_back(queue[next]);
+        break;
+      }
+      for (int l = 0; l < lanes; ++l) {
+        if (lane_input[l] == kParked) continue;
+        const bool halted = s.row[l] >= halt_row;
+        const bool at_max = s.steps[l] >= max;
+        if (!halted && !at_max && s.head[l] < width - 2 - kBlock) continue;
+
+        // Done, or handed on: near the end of its tape, or out of lane
+        // steps short of the run's limit
+        if (halted || (at_max && max == max_steps_)) {
+          record(l);
+        } else {
+          spill.push_back(lane_input[l]);
+        }
+        --running;
+        refill(l);
+      }
+    }
+  }
+
+  if (watch.expired()) {
+    // Out of time: what was not run comes back as it started
+    for (size_t i : spill) {
+      RunResult& r = results[i];
+      r = RunResult{};
+      r.timed_out = true;
+      if (!options.final_tape) continue;
+      const std::string& in = inputs[i];
+      const char blank = t.idx_to_char_[t.blank_idx_];
+      const size_t left = std::min(in.find_first_not_of(blank), in.size());
+      const size_t right = in.find_last_not_of(blank);
+      if (right != std::string::npos) r.final_tape = in.substr(left, right - left + 1);
+    }
+    return results;
+  }
+  for (size_t i : spill) results[i] = fallback_.Run(inputs[i], options);
+  return results;
+}
+
+}  // namespace tmc
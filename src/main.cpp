@@ -4,11 +4,21 @@
 #include "tmc/hlcompiler.hpp"
 #include "tmc/optimizer.hpp"
 #include "tmc/simulator.hpp"
-
+#include "tmc/batch.hpp"
+#include "tmc/checkpoint.hpp"
+#include "tmc/trace.hpp"
+#include "tmc/profile.hpp"
+#include "tmc/metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <sys/time.h>
 #include <iomanip>
+#include <memory>
 #include <vector>
 #include <chrono>
 
@@ -33,6 +43,16 @@ std::vector<std::string> ParseTestSuite(const std::string& path) {
   return inputs;
 }
 
+// Set by SIGINT/SIGTERM: a checkpointed run stops and saves where it is
+std::atomic<bool> g_stop{false};
+
+extern "C" void OnStopSignal(int) { g_stop = true; }
+
+// Set by SIGPROF for --sample-ms: the run takes a sample and clears it
+std::atomic<bool> g_sample{false};
+
+extern "C" void OnSampleSignal(int) { g_sample = true; }
+
 // Oracle for { a^n b^m | m = n*(n+1)/2 }
 bool IsTriangular(const std::string& s) {
   int n = 0, m = 0;
@@ -66,17 +86,126 @@ void PrintUsage(const char* prog) {
   std::cerr << "\nOptions:\n";
   std::cerr << "  -o <file>         Output YAML file (default: stdout)\n";
   std::cerr << "  -t <string>       Test input string after compilation\n";
+  std::cerr << "  --max-steps <n>   Step limit for -t (default: 1000000)\n";
+  std::cerr << "  --checkpoint <f>  Save the -t run to f periodically and on SIGINT/SIGTERM\n";
+  std::cerr << "  --checkpoint-steps <n> Save every n steps\n";
+  std::cerr << "  --checkpoint-secs <s>  Save every s seconds (default: 600)\n";
+  std::cerr << "  --resume <file>   Carry on a -t run from a checkpoint\n";
+  std::cerr << "  --trace <file>    Record the -t run to a trace file\n";
+  std::cerr << "  --replay <file>   Show a trace's configuration (no source file needed)\n";
+  std::cerr << "  --at <n>          Step for --replay (default: the last)\n";
+  std::cerr << "  --metrics         Report head travel, reversals and tape size for -t or --bench\n";
+  std::cerr << "  --heatmap <file>  Write the -t run's head visits over time as PGM (.pgm) or CSV\n";
+  std::cerr << "  --sample <file>   Sample the -t run's state, symbol and head into a CSV by phase\n";
+  std::cerr << "  --sample-steps <n> Sample every n steps (default: 1048576)\n";
+  std::cerr << "  --sample-ms <ms>  Sample every ms of CPU time instead\n";
   std::cerr << "  -v                Verbose output\n";
   std::cerr << "  --no-opt          Disable optimizations\n";
   std::cerr << "  --precompute <n>  Precompute results for inputs up to length n\n";
   std::cerr << "  --max-states <n>  Maximum states to generate\n";
   std::cerr << "  --max-symbols <n> Maximum tape alphabet size\n";
+  std::cerr << "  --emit-cpp <file> Write the TM as a standalone C++ program\n";
   std::cerr << "  --bench <file>    Benchmark against test suite file\n";
   std::cerr << "  --timeout <secs>  Wall clock timeout per test case (default: 60)\n";
+  std::cerr << "  --timeout-cpu     Measure --timeout in the case's CPU time instead\n";
+  std::cerr << "  --threads <n>     Run --bench cases on n threads, longest first\n";
+  std::cerr << "                    (default: 1; 0: one per core)\n";
   std::cerr << "  --csv <file>      Write CSV results (use with --bench)\n";
+  std::cerr << "  --profile <file>  Count each state's and transition's hits over the --bench\n";
+  std::cerr << "                    inputs (or -t) and write them as CSV, or JSON for .json\n";
+  std::cerr << "  --engine <name>   Simulation engine: flat (default), rle, macro, hashlife,\n";
+  std::cerr << "                    jit, threaded, paged\n";
+  std::cerr << "  --block-size <k>  Cells per macro-symbol for --engine macro (1-8, default: 8)\n";
+  std::cerr << "  --cache-mb <n>    Memory cap for --engine hashlife (default: 1024)\n";
+  std::cerr << "  --pack-min <n>    Pack the tape for inputs of n+ cells (default: 262144)\n";
+  std::cerr << "  --table-build <m> Transition table build: eager (default), parallel, lazy\n";
+  std::cerr << "  --build-threads <n> Threads for --table-build parallel (default: all)\n";
+}
+
+// Milliseconds since `start`
+double MsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A bench case's time limit, for the passes run off the clock after it
+tmc::RunOptions TimeoutOptions(double timeout_secs, bool timeout_cpu) {
+  tmc::RunOptions options;
+  if (timeout_cpu) {
+    options.cpu_ms = timeout_secs * 1000.0;
+  } else {
+    options.deadline = std::chrono::steady_clock::now() +
+                       std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                           std::chrono::duration<double>(timeout_secs));
+  }
+  return options;
+}
+
+// Write a profile to `path` (JSON for a .json name, CSV otherwise) and
+// print where the steps went
+bool WriteProfile(const std::string& path, const tmc::Profiler& profile) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "Error: Cannot open profile file: " << path << "\n";
+    return false;
+  }
+  const bool json = path.size() >= 5 && path.substr(path.size() - 5) == ".json";
+  if (json) {
+    tmc::WriteProfileJSON(out, profile);
+  } else {
+    tmc::WriteProfileCSV(out, profile);
+  }
+
+  std::cout << "\n=== Profile (" << profile.steps() << " steps, " << profile.runs() << " runs) ===\n";
+  const std::vector<tmc::StateHits> states = profile.States();
+  for (size_t i = 0; i < states.size() && i < 5; ++i) {
+    std::cout << std::setw(20) << std::left << states[i].state << std::right
+              << std::setw(14) << states[i].hits << "  " << std::fixed << std::setprecision(1)
+              << std::setw(5) << 100.0 * states[i].hits / profile.steps() << "%\n";
+  }
+  std::cout << "Wrote " << path << "\n";
+  return true;
+}
+
+// Write a sampled profile to `path` as CSV and print the top states of
+// each phase
+bool WriteSamples(const std::string& path, const tmc::SampleProfile& profile) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "Error: Cannot open sample file: " << path << "\n";
+    return false;
+  }
+  tmc::WriteSamplesCSV(out, profile);
+
+  std::cerr << "Samples: " << profile.samples() << "\n";
+  for (const tmc::SamplePhase& phase : profile.Phases()) {
+    // Fold the bins into states
+    std::vector<std::pair<std::string, int64_t>> states;
+    for (const tmc::SampleBin& bin : phase.bins) {
+      auto it = std::find_if(states.begin(), states.end(),
+                             [&](const auto& s) { return s.first == bin.state; });
+      if (it == states.end()) {
+        states.emplace_back(bin.state, bin.samples);
+      } else {
+        it->second += bin.samples;
+      }
+    }
+    std::stable_sort(states.begin(), states.end(),
+                     [](const auto& a, const auto& b) { return a.second > b.second; });
+    std::cerr << "  steps " << std::setw(12) << phase.first_step << "-" << std::left
+              << std::setw(12) << phase.end_step << std::right << " head <= " << std::setw(9)
+              << phase.max_head << " ";
+    for (size_t i = 0; i < states.size() && i < 3; ++i) {
+      std::cerr << " " << states[i].first << " " << std::fixed << std::setprecision(0)
+                << 100.0 * states[i].second / phase.samples << "%";
+    }
+    std::cerr << "\n";
+  }
+  std::cerr << "Wrote " << path << "\n";
+  return true;
 }
 
 int main(int argc, char* argv[]) {
+  const auto main_start = std::chrono::steady_clock::now();
   if (argc < 2) {
     PrintUsage(argv[0]);
     return 1;
@@ -87,12 +216,30 @@ int main(int argc, char* argv[]) {
   std::string test_input;
   std::string bench_file;
   std::string csv_file;
+  std::string cpp_file;
+  std::string profile_file;
+  std::string sample_file;
+  std::string heatmap_file;
+  bool metrics = false;
+  int64_t sample_steps = 0;
+  double sample_ms = 0;
+  std::string checkpoint_file;
+  std::string resume_file;
+  std::string trace_file;
+  std::string replay_file;
+  int64_t replay_step = -1;
+  int64_t test_max_steps = 1000000;
+  int64_t checkpoint_steps = 0;
+  double checkpoint_secs = 0;
   bool verbose = false;
   bool optimize = true;
   int precompute_len = 0;
   int max_states = 0;
   int max_symbols = 0;
   double timeout_secs = 60.0;
+  bool timeout_cpu = false;
+  int bench_threads = 1;
+  tmc::SimConfig sim_config;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
@@ -100,6 +247,22 @@ int main(int argc, char* argv[]) {
       output_file = argv[++i];
     } else if (arg == "-t" && i + 1 < argc) {
       test_input = argv[++i];
+    } else if (arg == "--max-steps" && i + 1 < argc) {
+      test_max_steps = std::stoll(argv[++i]);
+    } else if (arg == "--checkpoint" && i + 1 < argc) {
+      checkpoint_file = argv[++i];
+    } else if (arg == "--checkpoint-steps" && i + 1 < argc) {
+      checkpoint_steps = std::stoll(argv[++i]);
+    } else if (arg == "--checkpoint-secs" && i + 1 < argc) {
+      checkpoint_secs = std::stod(argv[++i]);
+    } else if (arg == "--resume" && i + 1 < argc) {
+      resume_file = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      trace_file = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replay_file = argv[++i];
+    } else if (arg == "--at" && i + 1 < argc) {
+      replay_step = std::stoll(argv[++i]);
     } else if (arg == "-v") {
       verbose = true;
     } else if (arg == "--no-opt") {
@@ -110,12 +273,73 @@ int main(int argc, char* argv[]) {
       max_states = std::stoi(argv[++i]);
     } else if (arg == "--max-symbols" && i + 1 < argc) {
       max_symbols = std::stoi(argv[++i]);
+    } else if (arg == "--emit-cpp" && i + 1 < argc) {
+      cpp_file = argv[++i];
     } else if (arg == "--bench" && i + 1 < argc) {
       bench_file = argv[++i];
     } else if (arg == "--timeout" && i + 1 < argc) {
       timeout_secs = std::stod(argv[++i]);
+    } else if (arg == "--timeout-cpu") {
+      timeout_cpu = true;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      bench_threads = std::stoi(argv[++i]);
     } else if (arg == "--csv" && i + 1 < argc) {
       csv_file = argv[++i];
+    } else if (arg == "--profile" && i + 1 < argc) {
+      profile_file = argv[++i];
+    } else if (arg == "--metrics") {
+      metrics = true;
+    } else if (arg == "--heatmap" && i + 1 < argc) {
+      heatmap_file = argv[++i];
+      metrics = true;
+    } else if (arg == "--sample" && i + 1 < argc) {
+      sample_file = argv[++i];
+    } else if (arg == "--sample-steps" && i + 1 < argc) {
+      sample_steps = std::stoll(argv[++i]);
+    } else if (arg == "--sample-ms" && i + 1 < argc) {
+      sample_ms = std::stod(argv[++i]);
+    } else if (arg == "--engine" && i + 1 < argc) {
+      std::string engine = argv[++i];
+      if (engine == "flat") {
+        sim_config.engine = tmc::Engine::Flat;
+      } else if (engine == "rle") {
+        sim_config.engine = tmc::Engine::Rle;
+      } else if (engine == "macro") {
+        sim_config.engine = tmc::Engine::Macro;
+      } else if (engine == "hashlife") {
+        sim_config.engine = tmc::Engine::HashLife;
+      } else if (engine == "jit") {
+        sim_config.engine = tmc::Engine::Jit;
+      } else if (engine == "threaded") {
+        sim_config.engine = tmc::Engine::Threaded;
+      } else if (engine == "paged") {
+        sim_config.engine = tmc::Engine::Paged;
+      } else {
+        std::cerr << "Unknown engine: " << engine << "\n";
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--block-size" && i + 1 < argc) {
+      sim_config.block_size = std::stoi(argv[++i]);
+    } else if (arg == "--cache-mb" && i + 1 < argc) {
+      sim_config.cache_mb = std::stoul(argv[++i]);
+    } else if (arg == "--pack-min" && i + 1 < argc) {
+      sim_config.pack_min_cells = std::stoull(argv[++i]);
+    } else if (arg == "--table-build" && i + 1 < argc) {
+      std::string mode = argv[++i];
+      if (mode == "eager") {
+        sim_config.table_build = tmc::TableBuild::Eager;
+      } else if (mode == "parallel") {
+        sim_config.table_build = tmc::TableBuild::Parallel;
+      } else if (mode == "lazy") {
+        sim_config.table_build = tmc::TableBuild::Lazy;
+      } else {
+        std::cerr << "Unknown table build: " << mode << "\n";
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--build-threads" && i + 1 < argc) {
+      sim_config.build_threads = std::stoi(argv[++i]);
     } else if (arg[0] != '-') {
       input_file = arg;
     } else {
@@ -125,6 +349,30 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  // Replay a trace: the trace names its own symbols and states
+  if (!replay_file.empty()) {
+    try {
+      tmc::TraceReplay replay(replay_file);
+      replay.Seek(replay_step < 0 ? replay.steps() : replay_step);
+      std::cout << "Trace: " << replay.steps() << " steps, ended in " << replay.final_state() << "\n";
+      std::cout << "Step " << replay.step() << ": state " << replay.state() << ", head "
+                << replay.head() << "\n";
+      std::cout << "Tape: ";
+      for (int64_t i = std::max<int64_t>(replay.head() - 40, 0); i <= replay.head() + 40; ++i) {
+        if (i == replay.head()) {
+          std::cout << '[' << replay.cell(i) << ']';
+        } else {
+          std::cout << replay.cell(i);
+        }
+      }
+      std::cout << "\n";
+    } catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
   if (input_file.empty()) {
     std::cerr << "Error: No input file specified\n";
     PrintUsage(argv[0]);
@@ -203,7 +451,13 @@ int main(int argc, char* argv[]) {
       std::cerr << "TM: " << num_states << " states, "
                 << num_transitions << " transitions\n\n";
 
-      tmc::Simulator sim(tm, 86000000000LL);
+      if (verbose) std::cerr << "Loaded TM in " << MsSince(main_start) << " ms\n";
+      auto build_start = std::chrono::steady_clock::now();
+      // A lazily built table fills in rows as it runs, so only one
+      // thread may use it
+      auto compiled = bench_threads == 1 ? std::make_shared<const tmc::CompiledTM>(tm, sim_config)
+                                         : tmc::CompiledTM::Compile(tm, sim_config);
+      if (verbose) std::cerr << "Built transition table in " << MsSince(build_start) << " ms\n";
       using Clock = std::chrono::high_resolution_clock;
 
       std::string student = StudentName(input_file);
@@ -212,44 +466,41 @@ int main(int argc, char* argv[]) {
       int64_t best_max_steps = 0;
       int max_steps_n = 0;
       int max_steps_len = 0;
-      bool abort_remaining = false;
-
-      auto bench_start = Clock::now();
-
-      for (size_t i = 0; i < inputs.size(); ++i) {
+      double elapsed_ms = 0;
+
+      // Cases run on bench_threads threads, longest first; each line is
+      // printed once every case before it is done. A case that hits the
+      // step limit or times out stops the rest.
+      tmc::BatchOptions batch;
+      batch.max_steps = 86000000000LL;
+      batch.config = sim_config;
+      batch.stop_on_limit = true;
+      batch.timeout_ms = timeout_secs * 1000.0;
+      batch.cpu_timeout = timeout_cpu;
+      batch.on_case = [&](size_t i, const tmc::BatchCase& c) {
         const std::string& input = inputs[i];
         bool expected = IsTriangular(input);
 
         int n = 0;
-        for (char c : input) {
-          if (c == 'a') ++n;
+        for (char ch : input) {
+          if (ch == 'a') ++n;
           else break;
         }
 
         bool timed_out = false;
         bool correct = false;
-        tmc::RunResult result;
-        double ms = 0;
+        tmc::RunResult result = c.result;
+        double ms = c.ms;
 
-        if (abort_remaining) {
+        if (c.skipped) {
           result.accepted = false;
           result.steps = 0;
           result.hit_limit = true;
           timed_out = true;
         } else {
-          auto t0 = Clock::now();
-          result = sim.Run(input);
-          auto t1 = Clock::now();
-          ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
-
-          // Check wall clock timeout
-          timed_out = (ms / 1000.0) >= timeout_secs;
+          // Stopped at the deadline, or (wall clock) finished past it
+          timed_out = result.timed_out || (!timeout_cpu && (ms / 1000.0) >= timeout_secs);
           correct = (result.accepted == expected) && !result.hit_limit && !timed_out;
-
-          // If hit step limit or timed out, abort all remaining cases
-          if (result.hit_limit || timed_out) {
-            abort_remaining = true;
-          }
         }
 
         total_steps += result.steps;
@@ -260,7 +511,7 @@ int main(int argc, char* argv[]) {
         }
 
         double case_rate = ms > 0 ? result.steps / (ms / 1000.0) : 0;
-        double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - bench_start).count();
+        elapsed_ms = std::max(elapsed_ms, c.done_ms);
         double cumul_rate = elapsed_ms > 0 ? total_steps / (elapsed_ms / 1000.0) : 0;
 
         std::cout << "[" << std::setw(2) << (i + 1) << "/" << inputs.size() << "] "
@@ -279,13 +530,44 @@ int main(int argc, char* argv[]) {
 
         if (correct) ++passed;
         else ++failed;
-      }
+      };
+
+      if (verbose) std::cerr << "Time to first step: " << MsSince(main_start) << " ms\n";
+      auto bench_start = Clock::now();
+      tmc::RunBatch(compiled, inputs, bench_threads, batch);
 
       auto bench_end = Clock::now();
       double total_ms = std::chrono::duration<double, std::milli>(bench_end - bench_start).count();
       double avg_steps = static_cast<double>(total_steps) / inputs.size();
       double steps_per_sec = total_ms > 0 ? total_steps / (total_ms / 1000.0) : 0;
 
+      // Measure the inputs once more, off the clock, on the flat engine's
+      // measuring loop (whichever engine the bench ran on)
+      tmc::RunMetrics most;  // the largest of each metric over the cases
+      int measured = 0;
+      if (metrics) {
+        tmc::Execution exec(compiled, batch.max_steps);
+        std::cout << "\n=== Metrics ===\n";
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          tmc::RunOptions options = TimeoutOptions(timeout_secs, timeout_cpu);
+          options.final_tape = false;
+          options.metrics = true;
+          tmc::RunResult result = exec.Run(inputs[i], options);
+          if (result.hit_limit || result.timed_out) break;
+          const tmc::RunMetrics& m = *result.metrics;
+          std::cout << "[" << std::setw(2) << (i + 1) << "/" << inputs.size() << "] "
+                    << "|w|=" << std::setw(4) << inputs[i].size() << "  head=" << m.max_head
+                    << " written=" << m.cells_written << " rev=" << m.reversals
+                    << " travel=" << m.travel << " tape=" << m.peak_tape_bytes << "B\n";
+          most.max_head = std::max(most.max_head, m.max_head);
+          most.cells_written = std::max(most.cells_written, m.cells_written);
+          most.reversals = std::max(most.reversals, m.reversals);
+          most.travel = std::max(most.travel, m.travel);
+          most.peak_tape_bytes = std::max(most.peak_tape_bytes, m.peak_tape_bytes);
+          ++measured;
+        }
+      }
+
       std::cout << "\n=== Summary ===\n";
       std::cout << "Passed:  " << passed << "/" << inputs.size() << "\n";
       if (failed > 0) std::cout << "Failed:  " << failed << "\n";
@@ -295,6 +577,12 @@ int main(int argc, char* argv[]) {
                 << " (n=" << max_steps_n << ", |w|=" << max_steps_len << ")\n";
       std::cout << "Wall:    " << std::fixed << std::setprecision(1) << total_ms << "ms"
                 << " (" << std::setprecision(0) << steps_per_sec / 1e6 << "M steps/sec)\n";
+      if (measured > 0) {
+        std::cout << "Space:   head " << most.max_head << ", " << most.cells_written
+                  << " cells written, peak tape " << most.peak_tape_bytes << " bytes (largest case)\n";
+        std::cout << "Moves:   " << most.reversals << " reversals, " << most.travel
+                  << " cells of travel (largest case)\n";
+      }
 
       // Write CSV if requested
       if (!csv_file.empty()) {
@@ -326,14 +614,37 @@ int main(int argc, char* argv[]) {
             << best_max_steps << "\n";
       }
 
+      // Profile the inputs once more, off the clock, on the counting loop
+      if (!profile_file.empty()) {
+        tmc::Profiler profiler(compiled, batch.max_steps);
+        for (const std::string& input : inputs) {
+          tmc::RunOptions options = TimeoutOptions(timeout_secs, timeout_cpu);
+          options.final_tape = false;
+          tmc::RunResult result = profiler.Run(input, options);
+          if (result.hit_limit || result.timed_out) break;
+        }
+        if (!WriteProfile(profile_file, profiler)) return 1;
+      }
+
       return failed > 0 ? 1 : 0;
     }
 
-    // Output YAML
+    // Output C++
+    if (!cpp_file.empty()) {
+      std::ofstream ofs(cpp_file);
+      if (!ofs) {
+        std::cerr << "Error: Cannot open output file: " << cpp_file << "\n";
+        return 1;
+      }
+      ofs << tmc::ToCpp(tm);
+      if (verbose) std::cerr << "Wrote " << cpp_file << "\n";
+    }
+
+    // Output YAML (to stdout only when not emitting C++)
     std::string yaml = tmc::ToYAML(tm);
 
     if (output_file.empty()) {
-      std::cout << yaml;
+      if (cpp_file.empty()) std::cout << yaml;
     } else {
       std::ofstream ofs(output_file);
       if (!ofs) {
@@ -344,11 +655,103 @@ int main(int argc, char* argv[]) {
       if (verbose) std::cerr << "Wrote " << output_file << "\n";
     }
 
-    // Test if requested
-    if (!test_input.empty()) {
+    // Test if requested, or carry on a checkpointed test
+    if (!test_input.empty() || !resume_file.empty()) {
+      const bool checkpointed = !checkpoint_file.empty() || !resume_file.empty();
+      if ((checkpointed || !sample_file.empty()) && sim_config.engine != tmc::Engine::Flat) {
+        std::cerr << "Error: --checkpoint, --resume and --sample need --engine flat\n";
+        return 1;
+      }
+      if (!sample_file.empty() && (!trace_file.empty() || !profile_file.empty())) {
+        std::cerr << "Error: --sample cannot be combined with --trace or --profile\n";
+        return 1;
+      }
+      if (metrics && (sim_config.engine != tmc::Engine::Flat || !trace_file.empty() ||
+                      !profile_file.empty() || !sample_file.empty())) {
+        std::cerr << "Error: --metrics and --heatmap need --engine flat, without --trace, --profile or --sample\n";
+        return 1;
+      }
+      if (checkpointed && (!trace_file.empty() || !profile_file.empty())) {
+        std::cerr << "Error: --trace and --profile cannot be combined with --checkpoint or --resume\n";
+        return 1;
+      }
+      if (!trace_file.empty() && !profile_file.empty()) {
+        std::cerr << "Error: --trace cannot be combined with --profile\n";
+        return 1;
+      }
+      const uint64_t tm_hash = checkpointed ? tmc::HashTM(tm) : 0;
+      tmc::Checkpoint resume;
+      if (!resume_file.empty()) {
+        resume = tmc::LoadCheckpoint(resume_file);
+        if (resume.tm_hash != tm_hash) {
+          std::cerr << "Error: Checkpoint " << resume_file << " was taken on a different TM\n";
+          return 1;
+        }
+        test_input = resume.input;
+        test_max_steps = resume.max_steps;
+      }
+
+      tmc::RunOptions options;
+      options.metrics = metrics;
+      if (!checkpoint_file.empty()) {
+        options.on_checkpoint = [&](tmc::Checkpoint& ckpt) {
+          ckpt.tm_hash = tm_hash;
+          tmc::SaveCheckpoint(checkpoint_file, ckpt);
+          if (verbose) std::cerr << "Checkpoint at step " << ckpt.steps << "\n";
+        };
+        options.checkpoint_steps = checkpoint_steps;
+        options.checkpoint_ms = checkpoint_secs * 1000.0;
+        if (checkpoint_steps <= 0 && checkpoint_secs <= 0) options.checkpoint_ms = 600 * 1000.0;
+        options.stop = &g_stop;
+        std::signal(SIGINT, OnStopSignal);
+        std::signal(SIGTERM, OnStopSignal);
+      }
+
       if (verbose) std::cerr << "Testing on input: \"" << test_input << "\"\n";
-      tmc::Simulator sim(tm);
-      tmc::RunResult result = sim.Run(test_input);
+      tmc::RunResult result;
+      std::unique_ptr<tmc::Profiler> profiler;
+      if (!profile_file.empty()) {
+        profiler = std::make_unique<tmc::Profiler>(
+            std::make_shared<const tmc::CompiledTM>(tm, sim_config), test_max_steps);
+        result = profiler->Run(test_input, options);
+      } else if (!trace_file.empty()) {
+        tmc::TraceRecorder recorder(std::make_shared<const tmc::CompiledTM>(tm, sim_config),
+                                    test_max_steps);
+        result = recorder.Record(test_input, trace_file, options);
+        if (verbose) std::cerr << "Wrote trace " << trace_file << "\n";
+      } else {
+        auto compiled = std::make_shared<const tmc::CompiledTM>(tm, sim_config);
+        std::unique_ptr<tmc::SampleProfile> samples;
+        if (!sample_file.empty()) {
+          samples = std::make_unique<tmc::SampleProfile>(compiled);
+          options.on_sample = [&](const tmc::Sample& sample) { samples->Add(sample); };
+          if (sample_ms > 0) {
+            options.sample_now = &g_sample;
+            std::signal(SIGPROF, OnSampleSignal);
+            const auto usec = static_cast<long>(sample_ms * 1000.0);
+            itimerval timer{};
+            timer.it_interval.tv_sec = usec / 1000000;
+            timer.it_interval.tv_usec = usec % 1000000;
+            timer.it_value = timer.it_interval;
+            setitimer(ITIMER_PROF, &timer, nullptr);
+          } else {
+            options.sample_steps = sample_steps > 0 ? sample_steps : int64_t{1} << 20;
+          }
+        }
+        tmc::Simulator sim(compiled, test_max_steps, sim_config);
+        if (verbose) std::cerr << "Time to first step: " << MsSince(main_start) << " ms\n";
+        result = resume_file.empty() ? sim.Run(test_input, options) : sim.Resume(resume, options);
+        if (samples) {
+          itimerval off{};
+          setitimer(ITIMER_PROF, &off, nullptr);
+          if (!WriteSamples(sample_file, *samples)) return 1;
+        }
+      }
+      if (result.timed_out) {
+        std::cerr << "Stopped at step " << result.steps << "; carry on with --resume "
+                  << checkpoint_file << "\n";
+        return 1;
+      }
 
       std::cout << "Input: \"" << test_input << "\"\n";
       std::cout << "Result: " << (result.accepted ? "ACCEPT" : "REJECT") << "\n";
@@ -359,6 +762,30 @@ int main(int argc, char* argv[]) {
       if (result.hit_limit) {
         std::cout << "WARNING: Hit step limit\n";
       }
+      if (profiler && !WriteProfile(profile_file, *profiler)) return 1;
+      if (result.metrics) {
+        const tmc::RunMetrics& m = *result.metrics;
+        std::cout << "Max head: " << m.max_head << "\n";
+        std::cout << "Cells written: " << m.cells_written << "\n";
+        std::cout << "Reversals: " << m.reversals << "\n";
+        std::cout << "Travel: " << m.travel << "\n";
+        std::cout << "Peak tape: " << m.peak_tape_bytes << " bytes\n";
+        if (!heatmap_file.empty()) {
+          std::ofstream out(heatmap_file, std::ios::binary);
+          if (!out) {
+            std::cerr << "Error: Cannot open heatmap file: " << heatmap_file << "\n";
+            return 1;
+          }
+          const bool pgm = heatmap_file.size() >= 4 &&
+                           heatmap_file.substr(heatmap_file.size() - 4) == ".pgm";
+          if (pgm) {
+            tmc::WriteHeatmapPGM(out, m.heatmap);
+          } else {
+            tmc::WriteHeatmapCSV(out, m.heatmap);
+          }
+          if (verbose) std::cerr << "Wrote " << heatmap_file << "\n";
+        }
+      }
     }
 
     // Print stats
@@ -0,0 +1,92 @@
+#include "tmc/metrics.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace tmc {
+
+Heatmap::Heatmap(int max_rows, int max_cols)
+    : max_rows_(std::max(max_rows, 2)), max_cols_(std::max(max_cols, 2)),
+      visits_(static_cast<size_t>(max_rows_) * max_cols_, 0) {}
+
+void Heatmap::Fit(int64_t r, int64_t c) {
+  while (r >= max_rows_) {
+    for (int i = 0; i < max_rows_; ++i) {
+      for (int j = 0; j < max_cols_; ++j) {
+        const int64_t v = i < rows_ ? at(i, j) : 0;
+        visits_[static_cast<size_t>(i) * max_cols_ + j] = 0;
+        visits_[static_cast<size_t>(i / 2) * max_cols_ + j] += v;
+      }
+    }
+    rows_ = (rows_ + 1) / 2;
+    ++row_shift_;
+    r >>= 1;
+  }
+  while (c >= max_cols_) {
+    for (int i = 0; i < rows_; ++i) {
+      for (int j = 0; j < max_cols_; ++j) {
+        const int64_t v = at(i, j);
+        visits_[static_cast<size_t>(i) * max_cols_ + j] = 0;
+        visits_[static_cast<size_t>(i) * max_cols_ + j / 2] += v;
+      }
+    }
+    cols_ = (cols_ + 1) / 2;
+    ++col_shift_;
+    c >>= 1;
+  }
+}
+
+void Heatmap::VisitRun(int64_t step, int64_t cell, int dir, int64_t n) {
+  if (n <= 0) return;
+  // Size the map for the run's far corner first, so the spans stay put
+  const int64_t last = step + n - 1;
+  const int64_t far = dir > 0 ? cell + n - 1 : cell;
+  if ((last >> row_shift_) >= max_rows_ || (far >> col_shift_) >= max_cols_) {
+    Fit(last >> row_shift_, far >> col_shift_);
+  }
+  rows_ = std::max(rows_, static_cast<int>(last >> row_shift_) + 1);
+  cols_ = std::max(cols_, static_cast<int>(far >> col_shift_) + 1);
+
+  while (n > 0) {
+    const int64_t r = step >> row_shift_;
+    const int64_t c = cell >> col_shift_;
+    // Steps until the run leaves this bucket's row or column
+    int64_t k = std::min(n, ((r + 1) << row_shift_) - step);
+    if (dir > 0) {
+      k = std::min(k, ((c + 1) << col_shift_) - cell);
+    } else if (cell > 0) {
+      k = std::min(k, cell - (c << col_shift_) + 1);
+    }
+    visits_[r * max_cols_ + c] += k;
+    step += k;
+    n -= k;
+    cell = dir > 0 ? cell + k : std::max<int64_t>(cell - k, 0);
+  }
+}
+
+void WriteHeatmapPGM(std::ostream& out, const Heatmap& map) {
+  int64_t most = 0;
+  for (int i = 0; i < map.rows(); ++i) {
+    for (int j = 0; j < map.cols(); ++j) most = std::max(most, map.at(i, j));
+  }
+  out << "P5\n" << map.cols() << " " << map.rows() << "\n255\n";
+  const double scale = most > 0 ? 255.0 / std::log1p(static_cast<double>(most)) : 0.0;
+  for (int i = 0; i < map.rows(); ++i) {
+    for (int j = 0; j < map.cols(); ++j) {
+      const double v = std::log1p(static_cast<double>(map.at(i, j))) * scale;
+      out.put(static_cast<char>(static_cast<unsigned char>(std::lround(v))));
+    }
+  }
+}
+
+void WriteHeatmapCSV(std::ostream& out, const Heatmap& map) {
+  out << "first_step,end_step,first_cell,end_cell,visits\n";
+  for (int i = 0; i < map.rows(); ++i) {
+    for (int j = 0; j < map.cols(); ++j) {
+      if (map.at(i, j) == 0) continue;
+      out << i * map.row_steps() << "," << (i + 1) * map.row_steps() << ","
+          << j * map.col_cells() << "," << (j + 1) * map.col_cells() << "," << map.at(i, j) << "\n";
+    }
+  }
+}
+
+}  // namespace tmc
@@ -0,0 +1,249 @@
+#include "tmc/profile.hpp"
+#include <algorithm>
+#include <iomanip>
+
+namespace tmc {
+
+namespace {
+
+const char* DirName(Dir d) { return d == Dir::L ? "L" : d == Dir::R ? "R" : "S"; }
+
+// A CSV field, quoted when it holds a comma, quote or newline
+std::string CsvField(const std::string& s) {
+  if (s.find_first_of(",\"\n") == std::string::npos) return s;
+  std::string q = "\"";
+  for (char c : s) {
+    if (c == '"') q += '"';
+    q += c;
+  }
+  return q + "\"";
+}
+
+std::string JsonString(const std::string& s) {
+  std::string q = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      q += '\\';
+      q += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char* hex = "0123456789abcdef";
+      q += "\\u00";
+      q += hex[(c >> 4) & 0xf];
+      q += hex[c & 0xf];
+    } else {
+      q += c;
+    }
+  }
+  return q + "\"";
+}
+
+double Share(int64_t hits, int64_t steps) {
+  return steps > 0 ? static_cast<double>(hits) / static_cast<double>(steps) : 0.0;
+}
+
+}  // namespace
+
+Profiler::Profiler(std::shared_ptr<const CompiledTM> tm, int64_t max_steps)
+    : tm_(std::move(tm)), max_steps_(max_steps),
+      hits_(static_cast<size_t>(tm_->num_states_) * tm_->num_symbols_, 0) {}
+
+RunResult Profiler::Run(const std::string& input, const RunOptions& options) {
+  const CompiledTM& tm = *tm_;
+  const uint32_t ns = static_cast<uint32_t>(tm.num_symbols_);
+  int64_t* hits = hits_.data();
+
+  tape_.resize(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    tape_[i] = tm.char_to_idx_[static_cast<unsigned char>(input[i])];
+  }
+  uint32_t state = tm.start_id_;
+  int64_t head = 0;
+  int64_t steps = 0;
+
+  RunWatch watch(options);
+  while (state < tm.halt_threshold_ && steps < max_steps_ && !watch.Expired(steps)) {
+    tm.GrowTape(tape_, head);
+    const uint8_t sym = tape_[head];
+    const FlatTransition t = tm.Lookup(state, sym);
+    ++hits[state * ns + sym];
+    tape_[head] = t.write;
+    state = t.next;
+    head = std::max<int64_t>(head + t.dir, 0);
+    ++steps;
+  }
+  ++runs_;
+  steps_ += steps;
+
+  RunResult result;
+  result.accepted = (state == tm.accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max_steps_ && state < tm.halt_threshold_);
+  result.timed_out = watch.expired();
+  if (options.final_tape) result.final_tape = tm.DecodeTape(tape_);
+  return result;
+}
+
+std::vector<StateHits> Profiler::States() const {
+  const CompiledTM& tm = *tm_;
+  std::vector<StateHits> states;
+  for (int s = 0; s < tm.num_states_; ++s) {
+    int64_t hits = 0;
+    for (int sym = 0; sym < tm.num_symbols_; ++sym) hits += hits_[s * tm.num_symbols_ + sym];
+    if (hits > 0) states.push_back({tm.id_to_state_[s], hits});
+  }
+  std::stable_sort(states.begin(), states.end(),
+                   [](const StateHits& a, const StateHits& b) { return a.hits > b.hits; });
+  return states;
+}
+
+std::vector<TransitionHits> Profiler::Transitions() const {
+  const CompiledTM& tm = *tm_;
+  std::vector<TransitionHits> transitions;
+  for (int s = 0; s < tm.num_states_; ++s) {
+    for (int sym = 0; sym < tm.num_symbols_; ++sym) {
+      const int64_t hits = hits_[s * tm.num_symbols_ + sym];
+      if (hits == 0) continue;
+      // Only rows that ran are read, and running built them
+      const FlatTransition t = tm.Entry(s, sym);
+      transitions.push_back({tm.id_to_state_[s], tm.idx_to_char_[sym], tm.idx_to_char_[t.write],
+                             t.dir < 0 ? Dir::L : t.dir > 0 ? Dir::R : Dir::S,
+                             tm.id_to_state_[t.next], hits});
+    }
+  }
+  std::stable_sort(transitions.begin(), transitions.end(),
+                   [](const TransitionHits& a, const TransitionHits& b) { return a.hits > b.hits; });
+  return transitions;
+}
+
+void Profiler::Clear() {
+  std::fill(hits_.begin(), hits_.end(), 0);
+  runs_ = 0;
+  steps_ = 0;
+}
+
+SampleProfile::SampleProfile(std::shared_ptr<const CompiledTM> tm, int64_t phase_steps,
+                             size_t max_phases)
+    : tm_(std::move(tm)), phase_steps_(std::max<int64_t>(phase_steps, 1)),
+      max_phases_(std::max<size_t>(max_phases, 2)) {}
+
+void SampleProfile::Add(const Sample& sample) {
+  while (sample.steps / phase_steps_ >= static_cast<int64_t>(max_phases_)) {
+    // Out of phases: merge neighbours and double the span
+    std::vector<Phase> merged((phases_.size() + 1) / 2);
+    for (size_t i = 0; i < phases_.size(); ++i) {
+      Phase& to = merged[i / 2];
+      to.samples += phases_[i].samples;
+      to.max_head = std::max(to.max_head, phases_[i].max_head);
+      for (const auto& [key, n] : phases_[i].bins) to.bins[key] += n;
+    }
+    phases_ = std::move(merged);
+    phase_steps_ *= 2;
+  }
+  const size_t p = static_cast<size_t>(sample.steps / phase_steps_);
+  if (p >= phases_.size()) phases_.resize(p + 1);
+  int bucket = 0;
+  while (bucket < 63 && (sample.head >> bucket) != 0) ++bucket;
+  const uint64_t key = static_cast<uint64_t>(sample.state) << 16 |
+                       static_cast<uint64_t>(sample.symbol) << 8 | static_cast<uint64_t>(bucket);
+  Phase& phase = phases_[p];
+  phase.bins[key] += sample.weight;
+  phase.samples += sample.weight;
+  phase.max_head = std::max(phase.max_head, sample.head);
+  samples_ += sample.weight;
+}
+
+SamplePhase SampleProfile::Describe(const Phase& phase, int64_t first_step, int64_t end_step) const {
+  const CompiledTM& tm = *tm_;
+  SamplePhase out;
+  out.first_step = first_step;
+  out.end_step = end_step;
+  out.samples = phase.samples;
+  out.max_head = phase.max_head;
+  for (const auto& [key, n] : phase.bins) {
+    const int bucket = static_cast<int>(key & 0xff);
+    SampleBin bin;
+    bin.state = tm.state_name(static_cast<uint32_t>(key >> 16));
+    bin.symbol = tm.symbol(static_cast<uint8_t>(key >> 8));
+    bin.head_lo = bucket == 0 ? 0 : int64_t{1} << (bucket - 1);
+    bin.head_hi = bucket == 0 ? 0 : (int64_t{1} << bucket) - 1;
+    bin.samples = n;
+    out.bins.push_back(bin);
+  }
+  std::stable_sort(out.bins.begin(), out.bins.end(),
+                   [](const SampleBin& a, const SampleBin& b) { return a.samples > b.samples; });
+  return out;
+}
+
+std::vector<SamplePhase> SampleProfile::Phases() const {
+  std::vector<SamplePhase> phases;
+  for (size_t i = 0; i < phases_.size(); ++i) {
+    if (phases_[i].samples == 0) continue;
+    const int64_t first = static_cast<int64_t>(i) * phase_steps_;
+    phases.push_back(Describe(phases_[i], first, first + phase_steps_));
+  }
+  return phases;
+}
+
+SamplePhase SampleProfile::Total() const {
+  Phase all;
+  for (const Phase& p : phases_) {
+    all.samples += p.samples;
+    all.max_head = std::max(all.max_head, p.max_head);
+    for (const auto& [key, n] : p.bins) all.bins[key] += n;
+  }
+  return Describe(all, 0, static_cast<int64_t>(phases_.size()) * phase_steps_);
+}
+
+void WriteProfileCSV(std::ostream& out, const Profiler& profile) {
+  out << "kind,state,read,write,dir,next,hits,share\n";
+  out << std::setprecision(6);
+  for (const StateHits& s : profile.States()) {
+    out << "state," << CsvField(s.state) << ",,,,," << s.hits << ","
+        << Share(s.hits, profile.steps()) << "\n";
+  }
+  for (const TransitionHits& t : profile.Transitions()) {
+    out << "transition," << CsvField(t.state) << "," << CsvField(std::string(1, t.read)) << ","
+        << CsvField(std::string(1, t.write)) << "," << DirName(t.dir) << "," << CsvField(t.next)
+        << "," << t.hits << "," << Share(t.hits, profile.steps()) << "\n";
+  }
+}
+
+void WriteProfileJSON(std::ostream& out, const Profiler& profile) {
+  out << std::setprecision(6);
+  out << "{\n  \"runs\": " << profile.runs() << ",\n  \"steps\": " << profile.steps()
+      << ",\n  \"states\": [";
+  const char* sep = "\n";
+  for (const StateHits& s : profile.States()) {
+    out << sep << "    {\"state\": " << JsonString(s.state) << ", \"hits\": " << s.hits
+        << ", \"share\": " << Share(s.hits, profile.steps()) << "}";
+    sep = ",\n";
+  }
+  out << "\n  ],\n  \"transitions\": [";
+  sep = "\n";
+  for (const TransitionHits& t : profile.Transitions()) {
+    out << sep << "    {\"state\": " << JsonString(t.state)
+        << ", \"read\": " << JsonString(std::string(1, t.read))
+        << ", \"write\": " << JsonString(std::string(1, t.write)) << ", \"dir\": \""
+        << DirName(t.dir) << "\", \"next\": " << JsonString(t.next) << ", \"hits\": " << t.hits
+        << ", \"share\": " << Share(t.hits, profile.steps()) << "}";
+    sep = ",\n";
+  }
+  out << "\n  ]\n}\n";
+}
+
+void WriteSamplesCSV(std::ostream& out, const SampleProfile& profile) {
+  out << "phase,first_step,end_step,state,symbol,head_lo,head_hi,samples,share\n";
+  out << std::setprecision(6);
+  auto write = [&](const std::string& name, const SamplePhase& phase) {
+    for (const SampleBin& b : phase.bins) {
+      out << name << "," << phase.first_step << "," << phase.end_step << "," << CsvField(b.state)
+          << "," << CsvField(std::string(1, b.symbol)) << "," << b.head_lo << "," << b.head_hi
+          << "," << b.samples << "," << Share(b.samples, phase.samples) << "\n";
+    }
+  };
+  write("all", profile.Total());
+  const std::vector<SamplePhase> phases = profile.Phases();
+  for (size_t i = 0; i < phases.size(); ++i) write(std::to_string(i), phases[i]);
+}
+
+}  // namespace tmc
@@ -0,0 +1,336 @@
+#include "tmc/simulator.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace tmc {
+
+namespace {
+
+// Break-table rows: the step into a breakpoint state was taken, and the
+// kernel stopped after it (low bits: the real next row). Above any real
+// row, below kScanRow.
+constexpr uint32_t kBreakRow = 0x40000000u;
+
+int64_t Distance(int64_t a, int64_t b) {
+  return a > b ? a - b : b - a;
+}
+
+// Append `len` old bytes at `offset`, joining a run that ends there
+void AddRun(TapeUndo& undo, size_t offset, const uint8_t* bytes, size_t len) {
+  if (len == 0) return;
+  if (!undo.runs.empty() && undo.runs.back().first + undo.runs.back().second == offset) {
+    undo.runs.back().second += len;
+  } else {
+    undo.runs.emplace_back(offset, len);
+  }
+  undo.bytes.insert(undo.bytes.end(), bytes, bytes + len);
+}
+
+// One undo for both intervals: `older`'s bytes where both have one
+TapeUndo MergeUndo(const TapeUndo& newer, const TapeUndo& older) {
+  TapeUndo out;
+  size_t a = 0, a_base = 0;
+  size_t pos = 0;  // everything before pos is in `out`
+  // Newer runs' bytes in [pos, end)
+  auto newer_until = [&](size_t end) {
+    for (; a < newer.runs.size(); ++a) {
+      const auto [off, len] = newer.runs[a];
+      const size_t s = std::max(off, pos), e = std::min(off + len, end);
+      if (s < e) AddRun(out, s, newer.bytes.data() + a_base + (s - off), e - s);
+      if (off + len > end) break;
+      a_base += len;
+    }
+  };
+  size_t b_base = 0;
+  for (const auto& [off, len] : older.runs) {
+    newer_until(off);
+    AddRun(out, off, older.bytes.data() + b_base, len);
+    b_base += len;
+    pos = off + len;
+  }
+  newer_until(SIZE_MAX);
+  return out;
+}
+
+size_t UndoBytes(const Snapshot& s) {
+  return sizeof(Snapshot) + s.undo.bytes.size() + s.undo.runs.size() * sizeof(s.undo.runs[0]);
+}
+
+}  // namespace
+
+StopReason Simulator::RunUntil(const Breakpoints& bp) {
+  const CompiledTM& tm = *tm_;
+  const bool compact = tm.table_.empty();
+
+  // State IDs to break on; the break table is rebuilt only when they change
+  std::vector<uint32_t> ids;
+  for (const State& s : bp.states) {
+    const uint32_t id = tm.StateId(s);
+    if (id < tm.halt_threshold_ && tm.id_to_state_[id] == s) ids.push_back(id);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  if (ids != break_states_ || break_flag_.empty()) {
+    break_states_ = ids;
+    break_flag_.assign(static_cast<size_t>(tm.num_states_), 0);
+    for (uint32_t id : ids) break_flag_[id] = 1;
+    break_table_.clear();
+    if (!ids.empty() && !compact) {
+      // Steps into a breakpoint state end the kernel after the step, scan
+      // loops in one included (they are steps into it too)
+      const uint32_t stride = tm.kernel_stride_;
+      break_table_ = tm.kernel_table_;
+      for (int sid = 0; sid < tm.num_states_; ++sid) {
+        for (int si = 0; si < tm.num_symbols_; ++si) {
+          const FlatTransition& ft = tm.table_[sid * tm.num_symbols_ + si];
+          if (ft.next >= tm.halt_threshold_ || !break_flag_[ft.next]) continue;
+          break_table_[sid * stride + si] = {kBreakRow | (ft.next * stride), ft.write, ft.dir};
+        }
+      }
+    }
+  }
+  const bool single = !ids.empty() && compact;
+
+  auto cell = [&](int64_t i) -> uint32_t {
+    if (static_cast<size_t>(i) >= step_len_) return tm.blank_idx_;
+    return GetCell(step_tape_.data(), static_cast<size_t>(i), step_bits_);
+  };
+  auto watched = [&](int64_t i) {
+    return std::find(bp.watch.begin(), bp.watch.end(), i) != bp.watch.end();
+  };
+  // Breakpoints other than states, after the step that wrote `at`
+  // (whose old symbol was `before`); Halted when none applies
+  auto check = [&](int64_t at, uint32_t before) {
+    if (at >= 0 && watched(at) && cell(at) != before) return StopReason::Watch;
+    if (bp.head >= 0 && std::max<int64_t>(head_, 0) == bp.head) return StopReason::Head;
+    if (bp.step >= 0 && steps_ == bp.step) return StopReason::Step;
+    return StopReason::Halted;
+  };
+
+  const int bits = step_bits_;
+  const int64_t per_byte = 8 / bits;
+  const uint32_t stride = compact ? 1 : tm.kernel_stride_;
+  const CompiledTM::Kernel kernel = compact ? &CompiledTM::RunCompactKernel
+                                  : bits == 8 ? tm.kernel_ : tm.packed_kernel_;
+  const CompiledTM::TableKernel table_kernel = bits == 8 ? tm.table_kernel_
+                                                         : tm.packed_table_kernel_;
+  const int64_t limit = std::min(max_steps_, bp.step > steps_ ? bp.step : INT64_MAX);
+
+  while (true) {
+    if (halted_ || state_id_ >= tm.halt_threshold_) {
+      halted_ = true;
+      return StopReason::Halted;
+    }
+    if (steps_ >= max_steps_) return StopReason::Limit;
+
+    // The kernel can run n steps without passing a breakpoint (or the
+    // next snapshot): the head moves (and writes) at most one cell per step
+    head_ = std::max<int64_t>(head_, 0);
+    const int64_t until = std::min(limit, next_snapshot_);
+    int64_t n = std::min(until - steps_, kFlatChunk);
+    if (bp.head >= 0) n = std::min(n, std::max<int64_t>(Distance(bp.head, head_), 1));
+    bool on_watch = false;
+    for (int64_t w : bp.watch) {
+      if (w == head_) on_watch = true;
+      n = std::min(n, std::max<int64_t>(Distance(w, head_), 1));
+    }
+
+    if (single || on_watch) {
+      const uint32_t before = cell(head_);
+      const int64_t at = head_;
+      Step();
+      if (halted_) return StopReason::Halted;
+      if (break_flag_[state_id_]) return StopReason::State;
+      const StopReason r = check(at, before);
+      if (r != StopReason::Halted) return r;
+      continue;
+    }
+
+    // Same chunking as Execution::Run
+    VirtualTape& tape = step_tape_;
+    if (head_ + 1 >= static_cast<int64_t>(tape.capacity()) * per_byte) {
+      tape.Grow(PackedBytes(static_cast<size_t>(head_ + 2), bits));
+    }
+    const int64_t cells = static_cast<int64_t>(tape.capacity()) * per_byte;
+    n = std::min(n, cells - 1 - head_);
+    const int64_t start = head_;
+    uint32_t row = state_id_ * stride;
+    const int64_t done = break_table_.empty()
+                             ? (tm.*kernel)(tape.data(), head_, row, n)
+                             : (tm.*table_kernel)(break_table_.data(), tape.data(), head_, row, n);
+    steps_ += done;
+    step_len_ = std::max(step_len_, static_cast<size_t>(start + done + 1));
+    tape.Touch(PackedBytes(step_len_, bits));
+    if (done > 0) {
+      const int64_t lo = std::max<int64_t>(start - done + 1, 0);
+      MarkDirty(static_cast<size_t>(lo * bits / 8), static_cast<size_t>((start + done - 1) * bits / 8));
+    }
+
+    bool hit_state = false;
+    if (row & kScanRow) {
+      // Stopped on a scan state's loop symbol; that entry was not a step.
+      // Skip the scan, but not past the head breakpoint or the limit.
+      state_id_ = row & ~kScanRow;
+      --steps_;
+      if (compact && !tm.compact_.Built(state_id_)) {
+        tm.BuildRow(state_id_);
+        continue;
+      }
+      int64_t max = until;
+      if (bp.head >= 0) max = std::min(max, steps_ + std::max<int64_t>(Distance(bp.head, head_), 1));
+      const int64_t before = steps_;
+      if (!tm.SkipScan(tape.data(), tape.extent() * per_byte, head_, state_id_, steps_, max, bits)) {
+        // Runs right into blank tape for good. The cells it crosses stay
+        // unvisited; Step() and the next chunk widen the tape to the head.
+        head_ += max - before;
+      }
+    } else if (row & kBreakRow) {
+      state_id_ = (row & ~kBreakRow) / stride;
+      hit_state = true;
+    } else {
+      state_id_ = row / stride;
+    }
+    if (steps_ >= next_snapshot_) TakeSnapshot();
+    if (hit_state) return StopReason::State;
+    if (state_id_ >= tm.halt_threshold_) {
+      halted_ = true;
+      return StopReason::Halted;
+    }
+    const StopReason r = check(-1, 0);
+    if (r != StopReason::Halted) return r;
+  }
+}
+
+void Simulator::TakeSnapshot() {
+  // The undo for the interval: bytes written since that differ from the
+  // tape as it was, which shadow_ holds (zero past its end)
+  uint8_t* tape = step_tape_.data();
+  TapeUndo& undo = snapshots_.back().undo;
+  history_bytes_ -= UndoBytes(snapshots_.back());
+  if (dirty_lo_ < dirty_hi_) {
+    if (shadow_.size() < dirty_hi_) shadow_.resize(dirty_hi_, 0);
+    for (size_t b = dirty_lo_; b < dirty_hi_; ++b) {
+      if (tape[b] != shadow_[b]) AddRun(undo, b, &shadow_[b], 1);
+    }
+    std::memcpy(shadow_.data() + dirty_lo_, tape + dirty_lo_, dirty_hi_ - dirty_lo_);
+  }
+  dirty_lo_ = SIZE_MAX;
+  dirty_hi_ = 0;
+  history_bytes_ += UndoBytes(snapshots_.back());
+  snapshots_.push_back({steps_, state_id_, head_, step_len_, {}});
+  history_bytes_ += UndoBytes(snapshots_.back());
+  next_snapshot_ = steps_ + history_steps_;
+
+  // Over budget: keep every other snapshot (and the last), their undos
+  // merged, and take them half as often
+  const size_t budget = config_.history_mb << 20;
+  while (history_bytes_ + shadow_.size() > budget && snapshots_.size() > 2) {
+    std::vector<Snapshot> kept;
+    for (size_t i = 0; i < snapshots_.size(); ++i) {
+      if (i % 2 == 0 || i + 1 == snapshots_.size()) {
+        kept.push_back(std::move(snapshots_[i]));
+      } else {
+        kept.back().undo = MergeUndo(snapshots_[i].undo, kept.back().undo);
+      }
+    }
+    snapshots_ = std::move(kept);
+    history_bytes_ = 0;
+    for (const Snapshot& s : snapshots_) history_bytes_ += UndoBytes(s);
+    history_steps_ *= 2;
+  }
+}
+
+void Simulator::RestoreSnapshot(size_t i) {
+  // Back to the last snapshot's tape, then undo interval by interval
+  uint8_t* tape = step_tape_.data();
+  if (dirty_lo_ < dirty_hi_) {
+    const size_t shadowed = std::clamp(shadow_.size(), dirty_lo_, dirty_hi_);
+    std::memcpy(tape + dirty_lo_, shadow_.data() + dirty_lo_, shadowed - dirty_lo_);
+    std::memset(tape + shadowed, 0, dirty_hi_ - shadowed);
+  }
+  for (size_t j = snapshots_.size() - 1; j-- > i;) {
+    const TapeUndo& undo = snapshots_[j].undo;
+    size_t base = 0;
+    for (const auto& [off, len] : undo.runs) {
+      std::memcpy(tape + off, undo.bytes.data() + base, len);
+      base += len;
+    }
+  }
+  for (size_t j = i; j < snapshots_.size(); ++j) history_bytes_ -= UndoBytes(snapshots_[j]);
+  snapshots_.resize(i + 1);
+  snapshots_.back().undo = {};
+  history_bytes_ += UndoBytes(snapshots_.back());
+
+  const Snapshot& s = snapshots_.back();
+  steps_ = s.steps;
+  state_id_ = s.state;
+  head_ = s.head;
+  step_len_ = s.len;
+  halted_ = false;
+  shadow_.assign(tape, tape + PackedBytes(step_len_, step_bits_));
+  dirty_lo_ = SIZE_MAX;
+  dirty_hi_ = 0;
+  next_snapshot_ = steps_ + history_steps_;
+}
+
+size_t Simulator::SnapshotAt(int64_t step) const {
+  auto it = std::upper_bound(snapshots_.begin(), snapshots_.end(), step,
+                             [](int64_t n, const Snapshot& s) { return n < s.steps; });
+  return static_cast<size_t>(it - snapshots_.begin()) - 1;
+}
+
+bool Simulator::StepBack() {
+  if (steps_ == 0) return false;
+  return GoToStep(steps_ - 1);
+}
+
+bool Simulator::GoToStep(int64_t step) {
+  step = std::max<int64_t>(step, 0);
+  if (step < steps_) {
+    if (snapshots_.empty()) {
+      Reset(input_);
+    } else {
+      RestoreSnapshot(SnapshotAt(step));
+    }
+  }
+  if (step > steps_) {
+    Breakpoints bp;
+    bp.step = step;
+    RunUntil(bp);
+  }
+  return steps_ == step;
+}
+
+bool Simulator::RunBackUntil(const std::function<bool(const Simulator&)>& pred) {
+  // Search [lo, hi) from the snapshot at or before hi - 1, latest first
+  int64_t hi = steps_;
+  while (hi > 0) {
+    const int64_t lo = snapshots_.empty() ? 0 : snapshots_[SnapshotAt(hi - 1)].steps;
+    GoToStep(lo);
+    int64_t found = -1;
+    while (true) {
+      if (pred(*this)) found = steps_;
+      if (steps_ + 1 >= hi) break;
+      Step();
+    }
+    if (found >= 0) return GoToStep(found);
+    hi = lo;
+  }
+  GoToStep(0);
+  return false;
+}
+
+TapeWindow Simulator::Window(int64_t radius) const {
+  TapeWindow w;
+  w.tape_ = step_tape_.data();
+  w.bits_ = step_bits_;
+  w.len_ = step_len_;
+  w.idx_to_char_ = tm_->idx_to_char_.data();
+  w.blank_ = tm_->idx_to_char_[tm_->blank_idx_];
+  w.head_ = head_;
+  w.first_ = std::max<int64_t>(head_ - radius, 0);
+  w.last_ = head_ + radius;
+  return w;
+}
+
+}  // namespace tmc
@@ -0,0 +1,336 @@
+#include "tmc/simulator.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace tmc {
+
+// Tape as a hash-consed binary tree: node ids below num_symbols are single
+// cells, every other node joins two equal-level children. A crossing of a
+// node (enter in a state at one edge, run until the head leaves, halts or
+// cycles) depends only on the node, so it is memoized per node id; equal
+// subtrees anywhere on the tape and across runs share their crossings.
+struct HashLifeCache {
+  struct Node {
+    uint32_t left, right;
+    uint8_t level;
+  };
+
+  struct Key {
+    uint32_t node, state;
+    uint8_t side, leftmost;
+    bool operator==(const Key& o) const {
+      return node == o.node && state == o.state && side == o.side && leftmost == o.leftmost;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      uint64_t h = (static_cast<uint64_t>(k.node) << 32 | k.state) * 0x9E3779B97F4A7C15ULL;
+      h ^= static_cast<uint64_t>(k.side << 1 | k.leftmost) + (h >> 31);
+      return static_cast<size_t>(h * 0xBF58476D1CE4E5B9ULL >> 16);
+    }
+  };
+
+  // Outcome of entering a node: the rewritten node, the state and side the
+  // head leaves by (exit 0 = halted, out of budget, stopped by the watch,
+  // or cycling forever)
+  struct Result {
+    uint32_t node;
+    uint32_t state;
+    int8_t exit;
+    bool loops;  // the node was seen to cycle without ever exiting
+    int64_t steps;
+  };
+
+  HashLifeCache(const FlatTransition* table, int num_symbols, uint32_t halt, size_t byte_limit)
+      : table(table), stride(num_symbols), halt(halt), byte_limit(byte_limit) {
+    for (int s = 0; s < num_symbols; ++s) nodes.push_back({0, 0, 0});
+  }
+
+  uint32_t Join(uint32_t l, uint32_t r) {
+    uint64_t key = static_cast<uint64_t>(l) << 32 | r;
+    auto it = interned.find(key);
+    if (it != interned.end()) return it->second;
+    uint32_t id = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({l, r, static_cast<uint8_t>(nodes[l].level + 1)});
+    interned.emplace(key, id);
+    return id;
+  }
+
+  // All-blank node of the given level
+  uint32_t Blank(int level, uint8_t blank_idx) {
+    if (blanks.empty()) blanks.push_back(blank_idx);
+    while (static_cast<int>(blanks.size()) <= level) {
+      blanks.push_back(Join(blanks.back(), blanks.back()));
+    }
+    return blanks[level];
+  }
+
+  size_t Bytes() const {
+    return nodes.size() * sizeof(Node) + interned.size() * 40 + memo.size() * 72;
+  }
+
+  // `watch`, given the run's steps so far as `base`, is polled before each
+  // child crossing; once it expires every frame returns with exit 0
+  Result Eval(uint32_t node, uint32_t state, uint8_t side, bool leftmost, int64_t budget,
+              RunWatch* watch, int64_t base);
+  Result EvalCell(uint32_t cell, uint32_t state, bool leftmost, int64_t budget) const;
+  Result EvalPair(uint32_t a, uint32_t b, uint32_t state, int child, uint8_t side,
+                  bool leftmost, int64_t budget, RunWatch* watch, int64_t base);
+  void Collect();
+
+  const FlatTransition* table;
+  int stride;
+  uint32_t halt;
+  size_t byte_limit;
+
+  std::vector<Node> nodes;
+  std::unordered_map<uint64_t, uint32_t> interned;
+  std::unordered_map<Key, Result, KeyHash> memo;
+  std::vector<uint32_t> blanks;  // blanks[level]
+
+  // Node ids held by active EvalPair frames; Collect remaps them in place
+  std::vector<uint32_t> pins;
+  uint64_t collections = 0;
+  size_t threshold = byte_limit;  // raised when the live tape alone exceeds the cap
+};
+
+HashLifeCache::Result HashLifeCache::Eval(uint32_t node, uint32_t state, uint8_t side,
+                                          bool leftmost, int64_t budget, RunWatch* watch,
+                                          int64_t base) {
+  if (budget <= 0) return {node, state, 0, false, 0};
+  Key key{node, state, side, static_cast<uint8_t>(leftmost)};
+  auto it = memo.find(key);
+  if (it != memo.end() && it->second.steps <= budget) return it->second;
+
+  const Node n = nodes[node];
+  const uint64_t epoch = collections;
+  Result r = n.level == 0 ? EvalCell(node, state, leftmost, budget)
+                          : EvalPair(n.left, n.right, state, side, side, leftmost, budget,
+                                     watch, base);
+  if (epoch != collections) return r;  // key is in the old numbering
+  // Finished crossings do not depend on the budget they ran under; a
+  // cycling one's step count does, so it is not kept
+  if (r.exit != 0 || r.state >= halt) memo[key] = r;
+  return r;
+}
+
+HashLifeCache::Result HashLifeCache::EvalCell(uint32_t cell, uint32_t state, bool leftmost,
+                                              int64_t budget) const {
+  Result out{cell, state, 0, false, 0};
+  // Staying on the cell is a walk over (state, symbol) pairs; Brent's
+  // method finds a cycle in it, which is then skipped to the budget
+  uint64_t saved = ~0ULL;
+  int64_t saved_steps = 0, power = 1, lam = 0;
+  bool skipped = false;
+  while (out.state < halt && out.steps < budget) {
+    if (!skipped) {
+      uint64_t cur = static_cast<uint64_t>(out.state) << 32 | out.node;
+      if (cur == saved) {
+        out.loops = true;
+        int64_t period = out.steps - saved_steps;
+        out.steps += (budget - out.steps) / period * period;
+        skipped = true;
+        continue;
+      }
+      if (lam == power) {
+        saved = cur;
+        saved_steps = out.steps;
+        power *= 2;
+        lam = 0;
+      }
+      ++lam;
+    }
+    const FlatTransition& t = table[out.state * stride + out.node];
+    out.node = t.write;
+    out.state = t.next;
+    ++out.steps;
+    if (t.dir > 0 || (t.dir < 0 && !leftmost)) {
+      out.exit = t.dir;
+      break;
+    }
+  }
+  return out;
+}
+
+// Run the head inside the pair (a, b), starting in child `child` at its
+// edge `side`, bouncing between the children until it leaves the pair
+HashLifeCache::Result HashLifeCache::EvalPair(uint32_t a, uint32_t b, uint32_t state, int child,
+                                              uint8_t side, bool leftmost, int64_t budget,
+                                              RunWatch* watch, int64_t base) {
+  const size_t top = pins.size();
+  pins.push_back(a);
+  pins.push_back(b);
+
+  struct Frame {
+    uint32_t state, a, b;
+    int child;
+    uint8_t side;
+    bool operator==(const Frame& o) const {
+      return state == o.state && a == o.a && b == o.b && child == o.child && side == o.side;
+    }
+  };
+  Frame saved{~0u, 0, 0, 0, 0};
+  int64_t saved_steps = 0, power = 1, lam = 0;
+  uint64_t epoch = collections;
+  bool loops = false;
+
+  int64_t steps = 0;
+  int8_t exit = 0;
+  while (true) {
+    if (Bytes() > threshold) Collect();
+    if (epoch != collections) {
+      // Ids were renumbered: restart cycle detection
+      epoch = collections;
+      saved.state = ~0u;
+      power = 1;
+      lam = 0;
+    }
+    if (watch && watch->Expired(base + steps)) break;
+
+    Frame cur{state, pins[top], pins[top + 1], child, side};
+    if (!loops) {
+      if (cur == saved) {
+        // Same pair, same entry: the head bounces here forever
+        loops = true;
+        int64_t period = steps - saved_steps;
+        steps += (budget - steps) / period * period;
+      } else {
+        if (lam == power) {
+          saved = cur;
+          saved_steps = steps;
+          power *= 2;
+          lam = 0;
+        }
+        ++lam;
+      }
+    }
+
+    Result r = Eval(pins[top + child], state, side, leftmost && child == 0, budget - steps,
+                    watch, base + steps);
+    pins[top + child] = r.node;
+    state = r.state;
+    steps += r.steps;
+    loops = loops || r.loops;
+    if (r.exit == 0) break;
+    if ((child == 0) == (r.exit > 0)) {
+      // Into the sibling
+      child ^= 1;
+      side = child == 0 ? 1 : 0;
+    } else {
+      exit = r.exit;
+      break;
+    }
+  }
+
+  Result out{Join(pins[top], pins[top + 1]), state, exit, loops, steps};
+  pins.resize(top);
+  return out;
+}
+
+// Drop the memo and every node not reachable from a pinned id or a blank.
+// Children always have smaller ids than their parents, so one descending
+// pass marks and one ascending pass renumbers.
+void HashLifeCache::Collect() {
+  const size_t cells = static_cast<size_t>(stride);
+  std::vector<uint8_t> live(nodes.size(), 0);
+  for (uint32_t id : pins) live[id] = 1;
+  for (uint32_t id : blanks) live[id] = 1;
+  for (size_t id = nodes.size(); id-- > cells;) {
+    if (!live[id]) continue;
+    live[nodes[id].left] = 1;
+    live[nodes[id].right] = 1;
+  }
+
+  std::vector<uint32_t> remap(nodes.size());
+  std::vector<Node> kept(nodes.begin(), nodes.begin() + cells);
+  interned.clear();
+  for (size_t id = 0; id < cells; ++id) remap[id] = static_cast<uint32_t>(id);
+  for (size_t id = cells; id < nodes.size(); ++id) {
+    if (!live[id]) continue;
+    Node n{remap[nodes[id].left], remap[nodes[id].right], nodes[id].level};
+    remap[id] = static_cast<uint32_t>(kept.size());
+    interned.emplace(static_cast<uint64_t>(n.left) << 32 | n.right, remap[id]);
+    kept.push_back(n);
+  }
+  nodes.swap(kept);
+  for (uint32_t& id : pins) id = remap[id];
+  for (uint32_t& id : blanks) id = remap[id];
+  memo.clear();
+  ++collections;
+  threshold = std::max(byte_limit, 2 * Bytes());
+}
+
+RunResult Simulator::RunHashLife(const std::string& input) {
+  if (!hashlife_) {
+    hashlife_ = std::make_shared<HashLifeCache>(tm_->table_.data(), tm_->num_symbols_,
+                                                tm_->halt_threshold_, config_.cache_mb << 20);
+  }
+  HashLifeCache& hl = *hashlife_;
+
+  // Input tree, padded with blanks to a power of two
+  std::vector<uint32_t> level(std::max<size_t>(input.size(), 1), tm_->blank_idx_);
+  for (size_t i = 0; i < input.size(); ++i) {
+    level[i] = tm_->char_to_idx_[static_cast<unsigned char>(input[i])];
+  }
+  int height = 0;
+  while (level.size() > 1) {
+    std::vector<uint32_t> up((level.size() + 1) / 2);
+    for (size_t i = 0; i < up.size(); ++i) {
+      uint32_t r = 2 * i + 1 < level.size() ? level[2 * i + 1] : hl.Blank(height, tm_->blank_idx_);
+      up[i] = hl.Join(level[2 * i], r);
+    }
+    level.swap(up);
+    ++height;
+  }
+
+  // The tape is the pair (root, blank); each time the head walks off its
+  // right end the pair becomes the left half of one twice the size
+  uint32_t root = level[0];
+  uint32_t state = tm_->start_id_;
+  int64_t steps = 0;
+  const int64_t max = max_steps_;
+  int child = 0;
+  while (true) {
+    uint32_t blank = hl.Blank(height, tm_->blank_idx_);
+    HashLifeCache::Result r =
+        hl.EvalPair(root, blank, state, child, 0, true, max - steps, &watch_, steps);
+    root = r.node;
+    state = r.state;
+    steps += r.steps;
+    ++height;
+    if (r.exit == 0 || watch_.Expired(steps)) break;
+    child = 1;
+  }
+
+  RunResult result;
+  result.accepted = (state == tm_->accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < tm_->halt_threshold_);
+  result.timed_out = watch_.expired();
+  if (!run_options_.final_tape) return result;
+
+  // Expand the tree, holding back blank subtrees so a long blank stretch
+  // is only materialized between non-blank cells
+  const char blank_ch = tm_->idx_to_char_[tm_->blank_idx_];
+  int64_t pending = 0;
+  std::vector<uint32_t> stack{root};
+  while (!stack.empty()) {
+    uint32_t id = stack.back();
+    stack.pop_back();
+    const HashLifeCache::Node n = hl.nodes[id];
+    if (id == hl.Blank(n.level, tm_->blank_idx_)) {
+      pending += int64_t{1} << n.level;
+    } else if (n.level == 0) {
+      if (!result.final_tape.empty()) result.final_tape.append(static_cast<size_t>(pending), blank_ch);
+      pending = 0;
+      result.final_tape.push_back(tm_->idx_to_char_[id]);
+    } else {
+      stack.push_back(n.right);
+      stack.push_back(n.left);
+    }
+  }
+  return result;
+}
+
+}  // namespace tmc
@@ -0,0 +1,60 @@
+#include "tmc/simulator.hpp"
+#include "tmc/jit.hpp"
+#include <algorithm>
+
+namespace tmc {
+
+RunResult Simulator::RunJit(const std::string& input) {
+  if (!jit_compiled_) {
+    jit_ = JitProgram::Compile(tm_->table_, tm_->num_symbols_, tm_->halt_threshold_);
+    jit_compiled_ = true;
+  }
+  if (!jit_) return RunFlat(input);
+
+  VirtualTape& tape = flat_tape_;
+  {
+    std::vector<uint8_t> cells(input.size());
+    for (size_t i = 0; i < input.size(); ++i) {
+      cells[i] = tm_->char_to_idx_[static_cast<unsigned char>(input[i])];
+    }
+    tape.Assign(cells.data(), cells.size());
+  }
+
+  int64_t steps = 0;
+  const int64_t max = max_steps_;
+  const uint32_t halt = tm_->halt_threshold_;
+  JitState js{tape.data(), 0, static_cast<int64_t>(tape.capacity()), 0, tm_->start_id_};
+
+  while (js.state < halt && steps < max && !watch_.Expired(steps)) {
+    if (js.head >= js.size) {
+      tape.Grow(static_cast<size_t>(js.head) + 1);
+      js.tape = tape.data();
+      js.size = static_cast<int64_t>(tape.capacity());
+    }
+    // Chunked like RunFlat so the extent stays a tight bound
+    const int64_t budget = std::min(max - steps, kFlatChunk);
+    const int64_t start = js.head;
+    js.budget = budget;
+    jit_->Run(js);
+    steps += budget - js.budget;
+    tape.Touch(static_cast<size_t>(std::min(start + budget - js.budget + 1, js.size)));
+    if (js.state >= halt || js.budget == 0 || js.head >= js.size) continue;
+
+    // Stopped on a scan state's loop symbol
+    if (!tm_->SkipScan(tape.data(), tape.extent(), js.head, js.state, steps, max)) break;
+    tape.Touch(static_cast<size_t>(js.head + 1));
+  }
+
+  RunResult result;
+  result.accepted = (js.state == tm_->accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && js.state < halt);
+  result.timed_out = watch_.expired();
+  if (!run_options_.final_tape) return result;
+
+  const uint8_t* cells = tape.data();
+  result.final_tape = tm_->DecodeTape(tape.extent(), [&](size_t i) { return cells[i]; });
+  return result;
+}
+
+}  // namespace tmc
@@ -0,0 +1,183 @@
+#include "tmc/simulator.hpp"
+#include "tmc/run_tape.hpp"
+#include <algorithm>
+
+namespace tmc {
+
+// Micro-steps to try before treating a block as one the head may never
+// leave; such crossings are simulated directly and never memoized
+constexpr int64_t kMacroProbe = 1 << 16;
+
+// Memo table sizes (slots); at the cap a full table is cleared
+constexpr size_t kMacroMemoInitial = size_t{1} << 12;
+constexpr size_t kMacroMemoLimit = size_t{1} << 22;
+
+namespace {
+
+size_t HashKey(const MacroKey& k) {
+  uint64_t h = k.block * 0x9E3779B97F4A7C15ULL;
+  h ^= (static_cast<uint64_t>(k.state) << 2 | k.side << 1 | k.leftmost) + (h >> 29);
+  return static_cast<size_t>(h * 0xBF58476D1CE4E5B9ULL >> 16);
+}
+
+// Slot holding `key`, or the empty slot where it belongs
+MacroSlot& FindSlot(std::vector<MacroSlot>& table, const MacroKey& key) {
+  size_t mask = table.size() - 1;
+  size_t i = HashKey(key) & mask;
+  while (table[i].used && !(table[i].key == key)) i = (i + 1) & mask;
+  return table[i];
+}
+
+void Rehash(std::vector<MacroSlot>& table, size_t size) {
+  std::vector<MacroSlot> old(size, MacroSlot{});
+  old.swap(table);
+  for (const MacroSlot& s : old) {
+    if (s.used) FindSlot(table, s.key) = s;
+  }
+}
+
+}  // namespace
+
+MacroEntry Simulator::CrossBlock(uint32_t state, uint64_t block, int pos, bool leftmost,
+                                 int64_t budget, RunWatch* watch, int64_t base) const {
+  const int k = config_.block_size;
+  uint8_t cells[8];
+  for (int i = 0; i < k; ++i) cells[i] = static_cast<uint8_t>(block >> (8 * i));
+
+  MacroEntry out;
+  out.exit = 0;
+  out.steps = 0;
+  while (state < tm_->halt_threshold_ && out.steps < budget &&
+         !(watch && watch->Expired(base + out.steps))) {
+    const FlatTransition& t = tm_->table_[state * tm_->num_symbols_ + cells[pos]];
+    cells[pos] = t.write;
+    state = t.next;
+    ++out.steps;
+    pos += t.dir;
+    if (pos < 0) {
+      if (!leftmost) {
+        out.exit = -1;
+        break;
+      }
+      pos = 0;  // left-bounded (Sipser)
+    } else if (pos >= k) {
+      out.exit = 1;
+      break;
+    }
+  }
+
+  out.block = 0;
+  for (int i = 0; i < k; ++i) out.block |= static_cast<uint64_t>(cells[i]) << (8 * i);
+  out.state = state;
+  return out;
+}
+
+RunResult Simulator::RunMacro(const std::string& input) {
+  const int k = config_.block_size;
+  uint64_t blank_block = 0;
+  for (int i = 0; i < k; ++i) blank_block |= static_cast<uint64_t>(tm_->blank_idx_) << (8 * i);
+
+  // Pack the input k cells per block
+  std::vector<uint64_t> blocks((input.size() + k - 1) / k, blank_block);
+  for (size_t i = 0; i < input.size(); ++i) {
+    int shift = 8 * static_cast<int>(i % k);
+    uint64_t& b = blocks[i / k];
+    b = (b & ~(0xFFULL << shift)) |
+        (static_cast<uint64_t>(tm_->char_to_idx_[static_cast<unsigned char>(input[i])]) << shift);
+  }
+  RunTape<uint64_t> tape(blocks, blank_block);
+
+  if (macro_memo_.empty()) macro_memo_.assign(kMacroMemoInitial, MacroSlot{});
+
+  uint32_t state = tm_->start_id_;
+  uint8_t side = 0;  // edge of the head's block the head is on
+  int64_t steps = 0;
+  const int64_t max = max_steps_;
+  const uint32_t halt = tm_->halt_threshold_;
+
+  // Apply a crossing that was not (or could not be) taken from the memo
+  auto apply = [&](const MacroEntry& r) {
+    tape.WriteMove(r.block, r.exit);
+    if (r.exit != 0) side = r.exit > 0 ? 0 : 1;
+    state = r.state;
+    steps += r.steps;
+  };
+
+  while (state < halt && steps < max && !watch_.Expired(steps)) {
+    MacroKey key{tape.Read(), state, side, static_cast<uint8_t>(tape.AtLeftEnd())};
+    int pos = side ? k - 1 : 0;
+    MacroSlot* slot = &FindSlot(macro_memo_, key);
+    if (!slot->used) {
+      MacroEntry probe = CrossBlock(state, key.block, pos, key.leftmost, kMacroProbe);
+      if (probe.exit == 0 && probe.state < halt) {
+        // Still inside after the probe: finish this crossing directly
+        apply(CrossBlock(state, key.block, pos, key.leftmost, max - steps, &watch_, steps));
+        continue;
+      }
+      if (4 * (macro_count_ + 1) > 3 * macro_memo_.size()) {
+        if (macro_memo_.size() < kMacroMemoLimit) {
+          Rehash(macro_memo_, macro_memo_.size() * 2);
+        } else {
+          macro_memo_.assign(macro_memo_.size(), MacroSlot{});
+          macro_count_ = 0;
+        }
+        slot = &FindSlot(macro_memo_, key);
+      }
+      *slot = {key, probe, true};
+      ++macro_count_;
+    }
+
+    const MacroEntry e = slot->entry;
+    if (e.steps > max - steps) {
+      // The crossing would overrun the step limit: replay it partially
+      apply(CrossBlock(state, key.block, pos, key.leftmost, max - steps, &watch_, steps));
+      break;
+    }
+
+    // Shift rule: a crossing that leaves by the far edge in the state it
+    // entered with repeats unchanged on every further copy of the block,
+    // so a run of n equal blocks takes n times the steps and becomes a
+    // run of the new block. Block 0 is excluded since it clamps moves.
+    bool through = e.state == state && e.exit != 0 && (e.exit > 0) == (side == 0);
+    if (through && !key.leftmost) {
+      int64_t n = tape.RunAhead(e.exit);
+      if (e.exit < 0 && tape.RunReachesLeftEnd()) --n;
+      if (!config_.shift_rule) n = std::min<int64_t>(n, 1);
+      int64_t m = std::min(n, (max - steps) / e.steps);
+      if (m > 1) {
+        tape.CrossRun(e.block, e.exit, m);
+        steps += m * e.steps;
+        continue;
+      }
+      if (e.exit > 0 && key.block == blank_block && e.block == blank_block &&
+          n >= RunTape<uint64_t>::kEndless / 2) {
+        // Sweeping untouched blank tape unchanged: runs forever
+        steps = max;
+        break;
+      }
+    }
+
+    tape.WriteMove(e.block, e.exit);
+    if (e.exit != 0) side = e.exit > 0 ? 0 : 1;
+    state = e.state;
+    steps += e.steps;
+  }
+
+  RunResult result;
+  result.accepted = (state == tm_->accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < halt);
+  result.timed_out = watch_.expired();
+  if (!run_options_.final_tape) return result;
+
+  std::vector<uint8_t> cells;
+  for (const auto& run : tape.Runs()) {
+    for (int64_t r = 0; r < run.len; ++r) {
+      for (int i = 0; i < k; ++i) cells.push_back(static_cast<uint8_t>(run.sym >> (8 * i)));
+    }
+  }
+  result.final_tape = tm_->DecodeTape(cells);
+  return result;
+}
+
+}  // namespace tmc
@@ -0,0 +1,181 @@
+#include "tmc/simulator.hpp"
+#include "tmc/paged_tape.hpp"
+#include <algorithm>
+
+namespace tmc {
+
+RunResult Simulator::RunPaged(const std::string& input) {
+  PagedTape tape(config_.page_bits);
+  {
+    std::vector<uint8_t> cells(input.size());
+    for (size_t i = 0; i < input.size(); ++i) {
+      cells[i] = tm_->char_to_idx_[static_cast<unsigned char>(input[i])];
+    }
+    tape.Assign(cells.data(), cells.size());
+  }
+
+  const int bits = tape.page_bits();
+  const int64_t page_cells = static_cast<int64_t>(tape.page_cells());
+  uint32_t row = tm_->start_id_ * tm_->kernel_stride_;
+  int64_t head = 0;
+  int64_t steps = 0;
+  const int64_t max = max_steps_;
+  const uint32_t halt_row = tm_->kernel_halt_row_;
+
+  // The page under the head, kept until the head leaves it
+  size_t page_index = static_cast<size_t>(-1);
+  uint8_t* page = nullptr;
+
+  while (row < halt_row && steps < max && !watch_.Expired(steps)) {
+    const size_t p = static_cast<size_t>(head) >> bits;
+    if (p != page_index) {
+      page = tape.Write(p);
+      page_index = p;
+    }
+    int64_t off = head & (page_cells - 1);
+
+    // The kernel runs on the page alone, for as many steps as the head
+    // cannot leave it in. Page 0's left edge is the tape's, which the
+    // kernel clamps at itself.
+    int64_t room = page_cells - 1 - off;
+    if (p > 0) room = std::min(room, off);
+    if (room > 0) {
+      steps += ((*tm_).*tm_->kernel_)(page, off, row, std::min(max - steps, room));
+      head = static_cast<int64_t>(p << bits) + off;
+    } else {
+      // On a page edge: one step by hand, exactly as the kernel takes it
+      const KernelTransition& t = tm_->kernel_table_[row + page[off]];
+      page[off] = t.write;
+      row = t.next_row;
+      head = std::max<int64_t>(head + t.dir, 0);
+      ++steps;
+    }
+    if (!(row & kScanRow)) continue;
+
+    // Stopped on a scan state's loop symbol; that entry was not a step
+    uint32_t state = row & ~kScanRow;
+    row = state * tm_->kernel_stride_;
+    --steps;
+    if (!SkipScanPaged(tape, head, state, steps)) break;
+  }
+  uint32_t state = row / tm_->kernel_stride_;
+
+  RunResult result;
+  result.accepted = (state == tm_->accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < tm_->halt_threshold_);
+  result.timed_out = watch_.expired();
+  if (!run_options_.final_tape) return result;
+
+  // Trim blanks at both ends, looking only at written pages; unwritten
+  // pages inside the span come out as runs of blanks
+  int64_t first = -1, last = -1;
+  for (size_t pg = 0; pg < tape.pages() && first < 0; ++pg) {
+    if (!tape.Written(pg)) continue;
+    const uint8_t* c = tape.Read(pg);
+    for (int64_t i = 0; i < page_cells; ++i) {
+      if (c[i] != tm_->blank_idx_) {
+        first = static_cast<int64_t>(pg << bits) + i;
+        break;
+      }
+    }
+  }
+  for (size_t pg = tape.pages(); pg-- > 0 && last < 0;) {
+    if (!tape.Written(pg)) continue;
+    const uint8_t* c = tape.Read(pg);
+    for (int64_t i = page_cells; i-- > 0;) {
+      if (c[i] != tm_->blank_idx_) {
+        last = static_cast<int64_t>(pg << bits) + i;
+        break;
+      }
+    }
+  }
+  if (first < 0) return result;
+
+  result.final_tape.reserve(static_cast<size_t>(last - first + 1));
+  const char blank_ch = tm_->idx_to_char_[tm_->blank_idx_];
+  for (int64_t pos = first; pos <= last;) {
+    const size_t pg = static_cast<size_t>(pos) >> bits;
+    const int64_t end = std::min(static_cast<int64_t>((pg + 1) << bits), last + 1);
+    if (!tape.Written(pg)) {
+      result.final_tape.append(static_cast<size_t>(end - pos), blank_ch);
+    } else {
+      const uint8_t* c = tape.Read(pg);
+      for (; pos < end; ++pos) {
+        result.final_tape.push_back(tm_->idx_to_char_[c[pos & (page_cells - 1)]]);
+      }
+    }
+    pos = end;
+  }
+  return result;
+}
+
+bool Simulator::SkipScanPaged(const PagedTape& tape, int64_t& head, uint32_t state,
+                              int64_t& steps) const {
+  // SkipScan a page at a time. Unwritten pages are all blank, so they are
+  // crossed whole (blank is a loop symbol) or stop the scan on their
+  // first cell, without being read.
+  const ScanState& sc = tm_->scan_classes_[tm_->scan_class_[state]];
+  const bool blank_stops = sc.stops.stop[tm_->blank_idx_];
+  const int bits = tape.page_bits();
+  const int64_t page_cells = static_cast<int64_t>(tape.page_cells());
+  const int64_t max = max_steps_;
+  const int64_t budget = max - steps;
+  int64_t dist = 0;
+
+  if (sc.dir > 0) {
+    while (dist < budget) {
+      const int64_t pos = head + dist;
+      const size_t pg = static_cast<size_t>(pos) >> bits;
+      const int64_t off = pos & (page_cells - 1);
+      if (pg >= tape.pages() && !blank_stops) {
+        // Runs off into blank tape that never stops it
+        steps = max;
+        return false;
+      }
+      if (!tape.Written(pg)) {
+        if (blank_stops) break;
+        dist += page_cells - off;
+        continue;
+      }
+      const int64_t n = page_cells - off;
+      const int64_t d = static_cast<int64_t>(FindStopForward(tape.Read(pg) + off, n, sc.stops));
+      dist += d;
+      if (d < n) break;
+    }
+    int64_t moved = std::min(dist, budget);
+    head += moved;
+    steps += moved;
+  } else {
+    bool found = false;
+    while (dist < budget && head - dist >= 0) {
+      const int64_t pos = head - dist;
+      const size_t pg = static_cast<size_t>(pos) >> bits;
+      const int64_t off = pos & (page_cells - 1);
+      if (!tape.Written(pg)) {
+        if (blank_stops) {
+          found = true;
+          break;
+        }
+        dist += off + 1;
+        continue;
+      }
+      size_t stop = FindStopBackward(tape.Read(pg), static_cast<size_t>(off) + 1, sc.stops);
+      if (stop != kNotFound) {
+        dist += off - static_cast<int64_t>(stop);
+        found = true;
+        break;
+      }
+      dist += off + 1;
+    }
+    // With no stop symbol left of the head the scan pins itself against
+    // cell 0 until the step limit
+    if (!found) dist = budget;
+    int64_t moved = std::min(dist, budget);
+    head = std::max<int64_t>(head - moved, 0);
+    steps += moved;
+  }
+  return true;
+}
+
+}  // namespace tmc
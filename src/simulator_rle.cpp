@@ -0,0 +1,54 @@
+#include "tmc/simulator.hpp"
+#include "tmc/run_tape.hpp"
+#include <algorithm>
+
+namespace tmc {
+
+RunResult Simulator::RunRle(const std::string& input) {
+  std::vector<uint8_t> cells(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    cells[i] = tm_->char_to_idx_[static_cast<unsigned char>(input[i])];
+  }
+  RunTape<uint8_t> tape(cells, tm_->blank_idx_);
+
+  uint32_t state = tm_->start_id_;
+  int64_t steps = 0;
+  const int64_t max = max_steps_;
+  const int stride = tm_->num_symbols_;
+  const FlatTransition* tbl = tm_->table_.data();
+  const uint32_t halt = tm_->halt_threshold_;
+
+  while (state < halt && steps < max && !watch_.Expired(steps)) {
+    uint8_t sym = tape.Read();
+    const FlatTransition& t = tbl[state * stride + sym];
+
+    if (t.next == state && t.dir != 0) {
+      // Self-loop: every cell of this run takes the same transition
+      int64_t m = std::min(tape.RunAhead(t.dir), max - steps);
+      bool free = tape.CrossRun(t.write, t.dir, m);
+      steps += m;
+      if (!free && t.write == sym) {
+        // Pinned at cell 0 re-reading the loop symbol: spins to the limit
+        steps = max;
+      }
+      continue;
+    }
+
+    tape.WriteMove(t.write, t.dir);
+    state = t.next;
+    ++steps;
+  }
+
+  RunResult result;
+  result.accepted = (state == tm_->accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < halt);
+  result.timed_out = watch_.expired();
+  if (!run_options_.final_tape) return result;
+  for (const auto& run : tape.Runs()) {
+    result.final_tape.append(static_cast<size_t>(run.len), tm_->idx_to_char_[run.sym]);
+  }
+  return result;
+}
+
+}  // namespace tmc
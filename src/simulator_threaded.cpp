@@ -0,0 +1,262 @@
+#include "tmc/simulator.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace tmc {
+
+// Longest Dir::S chain fused into one instruction
+constexpr int kMaxChain = 64;
+
+// A pair is fused once the second entry has followed the first this
+// often in profiling, and makes up at least 3/4 of what follows it
+constexpr uint64_t kPairMinCount = 64;
+
+#if defined(__GNUC__)
+
+int64_t Simulator::ThreadedKernel(uint8_t* tape, int64_t& head_io, uint32_t& row_io,
+                                  int64_t n) {
+  static const void* const kHandlers[] = {&&op_step, &&op_chain, &&op_pair, &&op_exit};
+  if (!tape) {
+    std::copy(std::begin(kHandlers), std::end(kHandlers), threaded_handlers_);
+    return 0;
+  }
+
+  const ThreadedOp* ops = threaded_ops_.data();
+  const ThreadedOp* op;
+  uint32_t row = row_io;
+  int64_t head = head_io;
+  int64_t left = n;
+
+#define TMC_DISPATCH()              \
+  do {                              \
+    if (left <= 0) goto out;        \
+    op = &ops[row + tape[head]];    \
+    goto *op->handler;              \
+  } while (0)
+
+  TMC_DISPATCH();
+
+op_step:
+  tape[head] = op->write;
+  head += op->dir;
+  head &= ~(head >> 63);  // left-bounded (Sipser)
+  row = op->next_row;
+  --left;
+  TMC_DISPATCH();
+
+op_chain:
+  // Connector states never move, so the chain's net effect is its last
+  // write and move; too close to the limit, step through it instead
+  if (left < op->steps) goto op_step;
+  tape[head] = op->write2;
+  head += op->dir2;
+  head &= ~(head >> 63);
+  row = op->next_row2;
+  left -= op->steps;
+  TMC_DISPATCH();
+
+op_pair:
+  tape[head] = op->write;
+  head += op->dir;
+  head &= ~(head >> 63);
+  row = op->next_row;
+  --left;
+  if (left > 0 && tape[head] == op->expect) {
+    tape[head] = op->write2;
+    head += op->dir2;
+    head &= ~(head >> 63);
+    row = op->next_row2;
+    --left;
+  }
+  TMC_DISPATCH();
+
+op_exit:
+  // Halt rows and scan-state loop entries; not a step
+  row = op->next_row;
+
+out:
+#undef TMC_DISPATCH
+  head_io = head;
+  row_io = row;
+  return n - left;
+}
+
+void Simulator::BuildThreaded() {
+  int64_t head = 0;
+  uint32_t row = 0;
+  ThreadedKernel(nullptr, head, row, 0);
+  const void* const step = threaded_handlers_[0];
+  const void* const chain = threaded_handlers_[1];
+  const void* const exit = threaded_handlers_[3];
+
+  const uint32_t stride = tm_->kernel_stride_;
+  const int syms = tm_->num_symbols_;
+  const uint32_t halt = tm_->halt_threshold_;
+
+  // Halt rows exit in place; padding entries are never read
+  threaded_ops_.assign(static_cast<size_t>(tm_->num_states_) * stride, ThreadedOp{});
+  for (uint32_t sid = 0; sid < static_cast<uint32_t>(tm_->num_states_); ++sid) {
+    for (int si = 0; si < syms; ++si) {
+      const FlatTransition& t = tm_->table_[sid * syms + si];
+      ThreadedOp& op = threaded_ops_[sid * stride + si];
+      if (sid >= halt) {
+        op.handler = exit;
+        op.next_row = sid * stride;
+        continue;
+      }
+      if (t.scan) {
+        op.handler = exit;
+        op.next_row = kScanRow | sid;
+        continue;
+      }
+      op.handler = step;
+      op.next_row = t.next * stride;
+      op.write = t.write;
+      op.dir = t.dir;
+      op.steps = 1;
+      if (t.dir != 0 || t.next >= halt) continue;
+
+      // A stay leaves the head on the cell it just wrote, so what the next
+      // state reads is known: follow the chain to its first move
+      FlatTransition last = t;
+      uint32_t q = t.next;
+      uint8_t sym = t.write;
+      int64_t k = 1;
+      while (k < kMaxChain) {
+        const FlatTransition& u = tm_->table_[q * syms + sym];
+        if (u.scan) break;
+        last = u;
+        ++k;
+        if (u.dir != 0 || u.next >= halt) break;
+        q = u.next;
+        sym = u.write;
+      }
+      if (k < 2) continue;
+      op.handler = chain;
+      op.write2 = last.write;
+      op.dir2 = last.dir;
+      op.next_row2 = last.next * stride;
+      op.steps = k;
+    }
+  }
+}
+
+void Simulator::ProfileThreaded(const std::string& input) {
+  // Count which entry follows each moving step, adding to earlier runs
+  const uint64_t entries = tm_->table_.size();
+  const int syms = tm_->num_symbols_;
+  const uint32_t halt = tm_->halt_threshold_;
+  std::vector<uint8_t> tape(input.size() + 1, tm_->blank_idx_);
+  for (size_t i = 0; i < input.size(); ++i) {
+    tape[i] = tm_->char_to_idx_[static_cast<unsigned char>(input[i])];
+  }
+  if (threaded_follows_.empty()) threaded_follows_.assign(entries, 0);
+  uint32_t state = tm_->start_id_;
+  int64_t head = 0;
+  uint64_t prev = entries;
+  while (threaded_profiled_ < config_.profile_steps && state < halt) {
+    if (head >= static_cast<int64_t>(tape.size())) tape.push_back(tm_->blank_idx_);
+    uint64_t e = static_cast<uint64_t>(state) * syms + tape[head];
+    if (prev < entries) {
+      ++threaded_pairs_[prev * entries + e];
+      ++threaded_follows_[prev];
+    }
+    const FlatTransition& t = tm_->table_[e];
+    tape[head] = t.write;
+    state = t.next;
+    head = std::max<int64_t>(head + t.dir, 0);
+    prev = (t.dir != 0 && !t.scan) ? e : entries;
+    ++threaded_profiled_;
+  }
+
+  // Re-pick pairs from the counts so far
+  const void* const step = threaded_handlers_[0];
+  const void* const pair = threaded_handlers_[2];
+  for (ThreadedOp& op : threaded_ops_) {
+    if (op.handler == pair) op.handler = step;
+  }
+  std::vector<std::pair<uint64_t, uint64_t>> best(entries, {entries, 0});
+  for (const auto& [key, count] : threaded_pairs_) {
+    auto& b = best[key / entries];
+    if (count > b.second) b = {key % entries, count};
+  }
+  for (uint64_t first = 0; first < entries; ++first) {
+    auto [second, count] = best[first];
+    if (count < kPairMinCount || 4 * count < 3 * threaded_follows_[first]) continue;
+    const FlatTransition& u = tm_->table_[second];
+    if (u.scan) continue;
+    ThreadedOp& op = threaded_ops_[first / syms * tm_->kernel_stride_ + first % syms];
+    op.handler = pair;
+    op.expect = static_cast<uint8_t>(second % syms);
+    op.write2 = u.write;
+    op.dir2 = u.dir;
+    op.next_row2 = u.next * tm_->kernel_stride_;
+  }
+}
+
+RunResult Simulator::RunThreaded(const std::string& input) {
+  if (threaded_ops_.empty()) BuildThreaded();
+  if (threaded_profiled_ < config_.profile_steps) ProfileThreaded(input);
+
+  VirtualTape& tape = flat_tape_;
+  {
+    std::vector<uint8_t> cells(input.size());
+    for (size_t i = 0; i < input.size(); ++i) {
+      cells[i] = tm_->char_to_idx_[static_cast<unsigned char>(input[i])];
+    }
+    tape.Assign(cells.data(), cells.size());
+  }
+
+  uint32_t row = tm_->start_id_ * tm_->kernel_stride_;
+  int64_t head = 0;
+  int64_t steps = 0;
+  const int64_t max = max_steps_;
+  const uint32_t halt_row = tm_->kernel_halt_row_;
+
+  while (row < halt_row && steps < max && !watch_.Expired(steps)) {
+    // One cell of slack per step in the chunk, as in RunFlat
+    if (head + 1 >= static_cast<int64_t>(tape.capacity())) tape.Grow(head + 2);
+    int64_t n = std::min({max - steps, static_cast<int64_t>(tape.capacity()) - 1 - head,
+                          kFlatChunk});
+    int64_t start = head;
+    int64_t done = ThreadedKernel(tape.data(), head, row, n);
+    steps += done;
+    tape.Touch(static_cast<size_t>(start + done + 1));
+    if (!(row & kScanRow)) continue;
+
+    uint32_t state = row & ~kScanRow;
+    row = state * tm_->kernel_stride_;
+    if (!tm_->SkipScan(tape.data(), tape.extent(), head, state, steps, max)) break;
+    tape.Touch(static_cast<size_t>(head + 1));
+  }
+  uint32_t state = row / tm_->kernel_stride_;
+
+  RunResult result;
+  result.accepted = (state == tm_->accept_id_);
+  result.steps = steps;
+  result.hit_limit = (steps >= max && state < tm_->halt_threshold_);
+  result.timed_out = watch_.expired();
+  if (!run_options_.final_tape) return result;
+
+  const uint8_t* cells = tape.data();
+  result.final_tape = tm_->DecodeTape(tape.extent(), [&](size_t i) { return cells[i]; });
+  return result;
+}
+
+#else  // no labels-as-values
+
+RunResult Simulator::RunThreaded(const std::string& input) {
+  return RunFlat(input);
+}
+
+void Simulator::BuildThreaded() {}
+
+void Simulator::ProfileThreaded(const std::string&) {}
+
+int64_t Simulator::ThreadedKernel(uint8_t*, int64_t&, uint32_t&, int64_t) {
+  return 0;
+}
+
+#endif
+
+}  // namespace tmc
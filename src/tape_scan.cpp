@@ -0,0 +1,319 @@
+#include "tmc/tape_scan.hpp"
+#include "tmc/packed_tape.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TMC_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace tmc {
+
+// Beyond this many compare symbols the vector loops stop paying off
+constexpr size_t kMaxVectorSymbols = 16;
+
+StopSet MakeStopSet(const std::vector<bool>& is_stop) {
+  StopSet set;
+  std::vector<uint8_t> stops, loops;
+  for (size_t i = 0; i < is_stop.size(); ++i) {
+    set.stop[i] = is_stop[i];
+    (is_stop[i] ? stops : loops).push_back(static_cast<uint8_t>(i));
+  }
+  // Only alphabet indices ever appear on the tape, so "not a loop symbol"
+  // is the same test as "a stop symbol".
+  if (loops.size() < stops.size()) {
+    set.symbols = loops;
+    set.invert = true;
+  } else {
+    set.symbols = stops;
+  }
+  return set;
+}
+
+namespace {
+
+size_t ScalarForward(const uint8_t* data, size_t from, size_t n, const StopSet& stops) {
+  for (size_t i = from; i < n; ++i) {
+    if (stops.stop[data[i]]) return i;
+  }
+  return n;
+}
+
+size_t ScalarBackward(const uint8_t* data, size_t n, const StopSet& stops) {
+  while (n > 0) {
+    --n;
+    if (stops.stop[data[n]]) return n;
+  }
+  return kNotFound;
+}
+
+#ifdef TMC_SCAN_X86
+
+// Bitmask of lanes in `v` that hold a stop symbol
+inline unsigned StopMask16(__m128i v, const __m128i* keys, size_t nkeys, bool invert) {
+  __m128i m = _mm_setzero_si128();
+  for (size_t k = 0; k < nkeys; ++k) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, keys[k]));
+  unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(m));
+  return invert ? (~bits & 0xFFFFu) : bits;
+}
+
+size_t Sse2Forward(const uint8_t* data, size_t n, const StopSet& stops) {
+  __m128i keys[kMaxVectorSymbols];
+  size_t nkeys = stops.symbols.size();
+  for (size_t k = 0; k < nkeys; ++k) keys[k] = _mm_set1_epi8(static_cast<char>(stops.symbols[k]));
+
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    unsigned bits = StopMask16(v, keys, nkeys, stops.invert);
+    if (bits) return i + __builtin_ctz(bits);
+  }
+  return ScalarForward(data, i, n, stops);
+}
+
+size_t Sse2Backward(const uint8_t* data, size_t n, const StopSet& stops) {
+  __m128i keys[kMaxVectorSymbols];
+  size_t nkeys = stops.symbols.size();
+  for (size_t k = 0; k < nkeys; ++k) keys[k] = _mm_set1_epi8(static_cast<char>(stops.symbols[k]));
+
+  size_t i = n;
+  for (; i >= 16; i -= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i - 16));
+    unsigned bits = StopMask16(v, keys, nkeys, stops.invert);
+    if (bits) return i - 16 + (31 - __builtin_clz(bits));
+  }
+  return ScalarBackward(data, i, stops);
+}
+
+__attribute__((target("avx2")))
+size_t Avx2Forward(const uint8_t* data, size_t n, const StopSet& stops) {
+  __m256i keys[kMaxVectorSymbols];
+  size_t nkeys = stops.symbols.size();
+  for (size_t k = 0; k < nkeys; ++k) keys[k] = _mm256_set1_epi8(static_cast<char>(stops.symbols[k]));
+
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i m = _mm256_setzero_si256();
+    for (size_t k = 0; k < nkeys; ++k) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, keys[k]));
+    unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(m));
+    if (stops.invert) bits = ~bits;
+    if (bits) return i + __builtin_ctz(bits);
+  }
+  return ScalarForward(data, i, n, stops);
+}
+
+__attribute__((target("avx2")))
+size_t Avx2Backward(const uint8_t* data, size_t n, const StopSet& stops) {
+  __m256i keys[kMaxVectorSymbols];
+  size_t nkeys = stops.symbols.size();
+  for (size_t k = 0; k < nkeys; ++k) keys[k] = _mm256_set1_epi8(static_cast<char>(stops.symbols[k]));
+
+  size_t i = n;
+  for (; i >= 32; i -= 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i - 32));
+    __m256i m = _mm256_setzero_si256();
+    for (size_t k = 0; k < nkeys; ++k) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, keys[k]));
+    unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(m));
+    if (stops.invert) bits = ~bits;
+    if (bits) return i - 32 + (31 - __builtin_clz(bits));
+  }
+  return ScalarBackward(data, i, stops);
+}
+
+bool HasAvx2() {
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+}
+
+#endif  // TMC_SCAN_X86
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TMC_SCAN_SWAR 1
+#endif
+
+// Word of packed cells compared against each key at once. Each result
+// lane has its low bit set when the cell is a stop symbol.
+struct PackedKeys {
+  uint64_t keys[16];  // key symbol repeated in every lane
+  size_t nkeys;
+  uint64_t low;  // low bit of every lane
+  int bits;
+  bool invert;
+
+  PackedKeys(int bits, const StopSet& stops) : nkeys(stops.symbols.size()), bits(bits),
+                                               invert(stops.invert) {
+    low = bits == 2 ? 0x5555555555555555ULL : 0x1111111111111111ULL;
+    for (size_t k = 0; k < nkeys; ++k) keys[k] = stops.symbols[k] * low;
+  }
+
+  uint64_t Stops(uint64_t w) const {
+    uint64_t m = 0;
+    for (size_t k = 0; k < nkeys; ++k) {
+      // A lane equals the key when all its bits of w ^ key are zero
+      uint64_t z = ~(w ^ keys[k]);
+      uint64_t all = z;
+      for (int b = 1; b < bits; ++b) all &= z >> b;
+      m |= all;
+    }
+    m &= low;
+    return invert ? (~m & low) : m;
+  }
+};
+
+#if defined(TMC_SCAN_X86) && defined(TMC_SCAN_SWAR)
+
+// Packed cells, 32 bytes at a time: each of the 8 / kBits cell positions
+// within a byte is shifted down and masked into its own byte lanes, then
+// compared like an unpacked tape. Both advance `i`/`n` (cell indices, a
+// multiple of the cells per byte) over whole vectors; on a stop they
+// leave it at the stop cell and return true.
+template <int kBits>
+struct Avx2Packed {
+  static constexpr size_t kPerByte = 8 / kBits;
+  static constexpr size_t kPerVector = 32 * kPerByte;
+
+  // Lanes holding a stop symbol, per cell position
+  __attribute__((target("avx2")))
+  static void Masks(__m256i v, const __m256i* keys, size_t nkeys, bool invert, __m256i* out) {
+    const __m256i mask = _mm256_set1_epi8(static_cast<char>((1 << kBits) - 1));
+    for (size_t j = 0; j < kPerByte; ++j) {
+      __m256i cells = _mm256_and_si256(_mm256_srli_epi16(v, j * kBits), mask);
+      __m256i m = _mm256_setzero_si256();
+      for (size_t k = 0; k < nkeys; ++k) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(cells, keys[k]));
+      out[j] = invert ? _mm256_andnot_si256(m, _mm256_set1_epi8(-1)) : m;
+    }
+  }
+
+  __attribute__((target("avx2")))
+  static bool Forward(const uint8_t* data, size_t& i, size_t n, const StopSet& stops) {
+    __m256i keys[kMaxVectorSymbols];
+    size_t nkeys = stops.symbols.size();
+    for (size_t k = 0; k < nkeys; ++k) keys[k] = _mm256_set1_epi8(static_cast<char>(stops.symbols[k]));
+
+    for (; i + kPerVector <= n; i += kPerVector) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i / kPerByte));
+      __m256i m[kPerByte];
+      Masks(v, keys, nkeys, stops.invert, m);
+      __m256i any = m[0];
+      for (size_t j = 1; j < kPerByte; ++j) any = _mm256_or_si256(any, m[j]);
+      if (_mm256_testz_si256(any, any)) continue;
+      size_t best = kNotFound;
+      for (size_t j = 0; j < kPerByte; ++j) {
+        unsigned found = static_cast<unsigned>(_mm256_movemask_epi8(m[j]));
+        if (found) best = std::min(best, kPerByte * __builtin_ctz(found) + j);
+      }
+      i += best;
+      return true;
+    }
+    return false;
+  }
+
+  __attribute__((target("avx2")))
+  static bool Backward(const uint8_t* data, size_t& n, const StopSet& stops) {
+    __m256i keys[kMaxVectorSymbols];
+    size_t nkeys = stops.symbols.size();
+    for (size_t k = 0; k < nkeys; ++k) keys[k] = _mm256_set1_epi8(static_cast<char>(stops.symbols[k]));
+
+    for (; n >= kPerVector; n -= kPerVector) {
+      const size_t base = n - kPerVector;
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + base / kPerByte));
+      __m256i m[kPerByte];
+      Masks(v, keys, nkeys, stops.invert, m);
+      __m256i any = m[0];
+      for (size_t j = 1; j < kPerByte; ++j) any = _mm256_or_si256(any, m[j]);
+      if (_mm256_testz_si256(any, any)) continue;
+      size_t best = 0;
+      for (size_t j = 0; j < kPerByte; ++j) {
+        unsigned found = static_cast<unsigned>(_mm256_movemask_epi8(m[j]));
+        if (found) best = std::max(best, kPerByte * (31 - __builtin_clz(found)) + j);
+      }
+      n = base + best;
+      return true;
+    }
+    return false;
+  }
+};
+
+bool Avx2ForwardPacked(const uint8_t* data, size_t& i, size_t n, int bits, const StopSet& stops) {
+  return bits == 2 ? Avx2Packed<2>::Forward(data, i, n, stops)
+                   : Avx2Packed<4>::Forward(data, i, n, stops);
+}
+
+bool Avx2BackwardPacked(const uint8_t* data, size_t& n, int bits, const StopSet& stops) {
+  return bits == 2 ? Avx2Packed<2>::Backward(data, n, stops)
+                   : Avx2Packed<4>::Backward(data, n, stops);
+}
+
+#endif
+
+}  // namespace
+
+size_t FindStopForward(const uint8_t* data, size_t n, const StopSet& stops) {
+#ifdef TMC_SCAN_X86
+  if (stops.symbols.size() <= kMaxVectorSymbols) {
+    return HasAvx2() ? Avx2Forward(data, n, stops) : Sse2Forward(data, n, stops);
+  }
+#endif
+  return ScalarForward(data, 0, n, stops);
+}
+
+size_t FindStopBackward(const uint8_t* data, size_t n, const StopSet& stops) {
+#ifdef TMC_SCAN_X86
+  if (stops.symbols.size() <= kMaxVectorSymbols) {
+    return HasAvx2() ? Avx2Backward(data, n, stops) : Sse2Backward(data, n, stops);
+  }
+#endif
+  return ScalarBackward(data, n, stops);
+}
+
+size_t FindStopForwardPacked(const uint8_t* data, size_t from, size_t n, int bits,
+                             const StopSet& stops) {
+  const size_t per_word = 64 / static_cast<size_t>(bits);
+  size_t i = from;
+#ifdef TMC_SCAN_SWAR
+  for (; i < n && i % per_word; ++i) {
+    if (stops.stop[GetCell(data, i, bits)]) return i;
+  }
+#ifdef TMC_SCAN_X86
+  if (HasAvx2() && Avx2ForwardPacked(data, i, n, bits, stops)) return i;
+#endif
+  const PackedKeys keys(bits, stops);
+  for (; i + per_word <= n; i += per_word) {
+    uint64_t w;
+    std::memcpy(&w, data + i / per_word * 8, 8);
+    uint64_t m = keys.Stops(w);
+    if (m) return i + static_cast<size_t>(__builtin_ctzll(m)) / bits;
+  }
+#endif
+  for (; i < n; ++i) {
+    if (stops.stop[GetCell(data, i, bits)]) return i;
+  }
+  return n;
+}
+
+size_t FindStopBackwardPacked(const uint8_t* data, size_t n, int bits, const StopSet& stops) {
+  const size_t per_word = 64 / static_cast<size_t>(bits);
+#ifdef TMC_SCAN_SWAR
+  for (; n % per_word; --n) {
+    if (stops.stop[GetCell(data, n - 1, bits)]) return n - 1;
+  }
+#ifdef TMC_SCAN_X86
+  if (HasAvx2() && Avx2BackwardPacked(data, n, bits, stops)) return n;
+#endif
+  const PackedKeys keys(bits, stops);
+  for (; n > 0; n -= per_word) {
+    uint64_t w;
+    std::memcpy(&w, data + (n - per_word) / per_word * 8, 8);
+    uint64_t m = keys.Stops(w);
+    if (m) return n - per_word + static_cast<size_t>(63 - __builtin_clzll(m)) / bits;
+  }
+#endif
+  for (; n > 0; --n) {
+    if (stops.stop[GetCell(data, n - 1, bits)]) return n - 1;
+  }
+  return kNotFound;
+}
+
+}  // namespace tmc
@@ -0,0 +1,353 @@
+#include "tmc/trace.hpp"
+#include "tmc/varint.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace tmc {
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'M', 'C', 'T', 'R', 'C', '1', '\n'};
+
+// Bits for a symbol index
+int SymbolBits(int num_symbols) {
+  int bits = 1;
+  while ((1 << bits) < num_symbols) ++bits;
+  return bits;
+}
+
+// Bytes [offset, offset + n) of `in`
+std::string ReadAt(std::ifstream& in, uint64_t offset, size_t n) {
+  std::string data(n, '\0');
+  in.clear();
+  in.seekg(static_cast<std::streamoff>(offset));
+  if (!in.read(data.data(), static_cast<std::streamsize>(n))) {
+    throw std::runtime_error("Truncated trace");
+  }
+  return data;
+}
+
+}  // namespace
+
+TraceRecorder::TraceRecorder(std::shared_ptr<const CompiledTM> tm, int64_t max_steps,
+                             int64_t sync_steps)
+    : tm_(std::move(tm)), max_steps_(max_steps),
+      sync_steps_(std::max<int64_t>(sync_steps, 1)), sym_bits_(SymbolBits(tm_->num_symbols_)) {}
+
+RunResult TraceRecorder::Record(const std::string& input, const std::string& path,
+                                const RunOptions& options) {
+  const CompiledTM& tm = *tm_;
+  out_ = std::ofstream(path, std::ios::binary | std::ios::trunc);
+  if (!out_) throw std::runtime_error("Cannot write trace: " + path);
+
+  // Header: the symbols and the state names
+  std::string header(kMagic, sizeof(kMagic));
+  PutVarint(header, static_cast<uint64_t>(tm.num_symbols_));
+  header.append(tm.idx_to_char_.begin(), tm.idx_to_char_.end());
+  PutVarint(header, static_cast<uint64_t>(tm.num_states_));
+  for (const State& s : tm.id_to_state_) {
+    PutVarint(header, s.size());
+    header += s;
+  }
+  out_.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+  tape_.resize(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    tape_[i] = tm.char_to_idx_[static_cast<unsigned char>(input[i])];
+  }
+  state_ = tm.start_id_;
+  head_ = 0;
+  steps_ = 0;
+  index_.clear();
+  sync_.clear();
+  Sync();
+
+  RunWatch watch(options);
+  while (state_ < tm.halt_threshold_ && steps_ < max_steps_ && !watch.Expired(steps_)) {
+    if (steps_ >= next_sync_) {
+      if (bits_.size() + vars_.size() >= sync_bytes_) {
+        Sync();
+      } else {
+        next_sync_ += sync_steps_;
+      }
+    }
+    tm.GrowTape(tape_, head_);
+    const uint8_t read = tape_[head_];
+    const FlatTransition t = tm.Lookup(state_, read);
+
+    if (t.scan) {
+      // The whole scan as one run, up to the step limit or the next sync
+      const int64_t before = steps_;
+      const int64_t max = std::min(max_steps_, next_sync_);
+      int64_t head = head_;
+      if (!tm.SkipScan(tape_.data(), tape_.size(), head, state_, steps_, max)) {
+        // Right into blank tape for good: one run to the step limit
+        steps_ = max_steps_;
+        head = head_ + (max_steps_ - before);
+      }
+      PutRun(t.dir, steps_ - before);
+      head_ = head;
+      continue;
+    }
+
+    tape_[head_] = t.write;
+    if (t.write == read && t.next == state_ && t.dir != 0) {
+      PutRun(t.dir, 1);
+    } else {
+      PutStep(t.dir, t.write, t.next);
+    }
+    state_ = t.next;
+    head_ = std::max<int64_t>(head_ + t.dir, 0);
+    ++steps_;
+  }
+  FlushBlock();
+
+  // Footer: totals and the block index, then where the footer starts
+  const uint64_t footer_at = static_cast<uint64_t>(out_.tellp());
+  std::string footer;
+  PutVarint(footer, static_cast<uint64_t>(steps_));
+  PutVarint(footer, state_);
+  PutVarint(footer, index_.size());
+  for (const auto& [step, offset] : index_) {
+    PutVarint(footer, static_cast<uint64_t>(step));
+    PutVarint(footer, offset);
+  }
+  for (int i = 0; i < 8; ++i) footer.push_back(static_cast<char>(footer_at >> (8 * i)));
+  out_.write(footer.data(), static_cast<std::streamsize>(footer.size()));
+  out_.close();
+  if (!out_) throw std::runtime_error("Cannot write trace: " + path);
+
+  RunResult result;
+  result.accepted = (state_ == tm.accept_id_);
+  result.steps = steps_;
+  result.hit_limit = (steps_ >= max_steps_ && state_ < tm.halt_threshold_);
+  result.timed_out = watch.expired();
+  if (options.final_tape) result.final_tape = tm.DecodeTape(tape_);
+  return result;
+}
+
+void TraceRecorder::Sync() {
+  FlushBlock();
+  size_t cells = tape_.size();
+  while (cells > 0 && tape_[cells - 1] == tm_->blank_idx_) --cells;
+  PutVarint(sync_, static_cast<uint64_t>(steps_));
+  PutVarint(sync_, state_);
+  PutVarint(sync_, static_cast<uint64_t>(head_));
+  PutRuns(sync_, std::vector<uint8_t>(tape_.begin(), tape_.begin() + static_cast<ptrdiff_t>(cells)));
+  sync_step_ = steps_;
+  sync_bytes_ = sync_.size();
+  next_sync_ = steps_ + sync_steps_;
+}
+
+void TraceRecorder::FlushBlock() {
+  if (sync_.empty()) return;
+  FlushRun();
+  if (bit_count_ > 0) {
+    bits_.push_back(static_cast<char>(bit_acc_));
+    bit_acc_ = 0;
+    bit_count_ = 0;
+  }
+  index_.emplace_back(sync_step_, static_cast<uint64_t>(out_.tellp()));
+  std::string block = std::move(sync_);
+  PutVarint(block, static_cast<uint64_t>(block_steps_));
+  PutVarint(block, bits_.size());
+  block += bits_;
+  PutVarint(block, vars_.size());
+  block += vars_;
+  out_.write(block.data(), static_cast<std::streamsize>(block.size()));
+
+  sync_.clear();
+  bits_.clear();
+  vars_.clear();
+  block_steps_ = 0;
+}
+
+void TraceRecorder::PutBits(uint64_t v, int n) {
+  bit_acc_ |= v << bit_count_;
+  bit_count_ += n;
+  while (bit_count_ >= 8) {
+    bits_.push_back(static_cast<char>(bit_acc_));
+    bit_acc_ >>= 8;
+    bit_count_ -= 8;
+  }
+}
+
+void TraceRecorder::PutStep(int dir, uint32_t write, uint32_t next) {
+  FlushRun();
+  const bool changed = next != state_;
+  PutBits(static_cast<uint64_t>(dir + 1), 2);
+  PutBits(changed, 1);
+  PutBits(write, sym_bits_);
+  if (changed) PutVarint(vars_, next);
+  ++block_steps_;
+}
+
+void TraceRecorder::PutRun(int dir, int64_t len) {
+  if (len == 0) return;
+  if (run_len_ > 0 && run_dir_ != dir) FlushRun();
+  run_dir_ = dir;
+  run_len_ += len;
+  block_steps_ += len;
+}
+
+void TraceRecorder::FlushRun() {
+  if (run_len_ == 0) return;
+  PutBits(3, 2);
+  PutBits(run_dir_ > 0, 1);
+  PutVarint(vars_, static_cast<uint64_t>(run_len_));
+  run_len_ = 0;
+}
+
+TraceReplay::TraceReplay(const std::string& path) : in_(path, std::ios::binary) {
+  if (!in_) throw std::runtime_error("Cannot open trace: " + path);
+  in_.seekg(0, std::ios::end);
+  const uint64_t size = static_cast<uint64_t>(in_.tellg());
+  if (size < sizeof(kMagic) + 8) throw std::runtime_error("Not a trace: " + path);
+
+  // Footer
+  const std::string tail = ReadAt(in_, size - 8, 8);
+  footer_at_ = 0;
+  for (int i = 0; i < 8; ++i) footer_at_ |= static_cast<uint64_t>(static_cast<uint8_t>(tail[i])) << (8 * i);
+  if (footer_at_ < sizeof(kMagic) || footer_at_ > size - 8) throw std::runtime_error("Bad trace: " + path);
+  const std::string footer = ReadAt(in_, footer_at_, size - 8 - footer_at_);
+  ByteReader f{footer.data(), footer.size(), "trace"};
+  total_steps_ = static_cast<int64_t>(f.Varint());
+  final_state_ = static_cast<uint32_t>(f.Varint());
+  const uint64_t blocks = f.Varint();
+  if (blocks == 0 || blocks > footer.size()) throw std::runtime_error("Bad trace: " + path);
+  for (uint64_t b = 0; b < blocks; ++b) {
+    const int64_t step = static_cast<int64_t>(f.Varint());
+    const uint64_t offset = f.Varint();
+    if (offset >= footer_at_ || (!index_.empty() && offset <= index_.back().second)) {
+      throw std::runtime_error("Bad trace: " + path);
+    }
+    index_.emplace_back(step, offset);
+  }
+
+  // Header
+  const std::string header = ReadAt(in_, 0, index_[0].second);
+  if (header.compare(0, sizeof(kMagic), std::string(kMagic, sizeof(kMagic))) != 0) {
+    throw std::runtime_error("Not a trace: " + path);
+  }
+  ByteReader h{header.data(), header.size(), "trace", sizeof(kMagic)};
+  const uint64_t num_symbols = h.Varint();
+  if (num_symbols == 0 || num_symbols > 256) throw std::runtime_error("Bad trace: " + path);
+  const char* syms = h.Bytes(num_symbols);
+  symbols_.assign(syms, syms + num_symbols);
+  sym_bits_ = SymbolBits(static_cast<int>(num_symbols));
+  const uint64_t num_states = h.Varint();
+  if (num_states > header.size()) throw std::runtime_error("Bad trace: " + path);
+  for (uint64_t i = 0; i < num_states; ++i) {
+    const uint64_t len = h.Varint();
+    const char* name = h.Bytes(len);
+    states_.emplace_back(name, len);
+  }
+  if (final_state_ >= states_.size()) throw std::runtime_error("Bad trace: " + path);
+  LoadBlock(0);
+}
+
+void TraceReplay::LoadBlock(size_t b) {
+  const uint64_t end = b + 1 < index_.size() ? index_[b + 1].second : footer_at_;
+  const std::string data = ReadAt(in_, index_[b].second, end - index_[b].second);
+  ByteReader r{data.data(), data.size(), "trace"};
+  step_ = static_cast<int64_t>(r.Varint());
+  state_ = static_cast<uint32_t>(r.Varint());
+  head_ = static_cast<int64_t>(r.Varint());
+  tape_.clear();
+  ReadRuns(r, tape_);
+  const int64_t steps = static_cast<int64_t>(r.Varint());
+  const uint64_t bit_bytes = r.Varint();
+  const char* bits = r.Bytes(bit_bytes);
+  bits_.assign(bits, bit_bytes);
+  const uint64_t var_bytes = r.Varint();
+  const char* vars = r.Bytes(var_bytes);
+  vars_.assign(vars, var_bytes);
+  if (state_ >= states_.size() || step_ != index_[b].first) throw std::runtime_error("Bad trace");
+  for (uint8_t c : tape_) {
+    if (c >= symbols_.size()) throw std::runtime_error("Bad trace");
+  }
+
+  block_ = b;
+  block_end_ = step_ + steps;
+  bit_pos_ = 0;
+  var_pos_ = 0;
+  run_left_ = 0;
+}
+
+uint64_t TraceReplay::Bits(int n) {
+  if (bit_pos_ + static_cast<size_t>(n) > bits_.size() * 8) throw std::runtime_error("Truncated trace");
+  uint64_t v = 0;
+  for (int i = 0; i < n; ++i, ++bit_pos_) {
+    v |= static_cast<uint64_t>((static_cast<uint8_t>(bits_[bit_pos_ >> 3]) >> (bit_pos_ & 7)) & 1) << i;
+  }
+  return v;
+}
+
+uint64_t TraceReplay::Varint() {
+  ByteReader r{vars_.data(), vars_.size(), "trace", var_pos_};
+  const uint64_t v = r.Varint();
+  var_pos_ = r.pos;
+  return v;
+}
+
+void TraceReplay::Seek(int64_t step) {
+  step = std::clamp<int64_t>(step, 0, total_steps_);
+  // The last block starting at or before `step`
+  auto it = std::upper_bound(index_.begin(), index_.end(), step,
+                             [](int64_t n, const std::pair<int64_t, uint64_t>& e) { return n < e.first; });
+  const size_t b = static_cast<size_t>(it - index_.begin()) - 1;
+  if (b != block_ || step < step_) LoadBlock(b);
+  while (step_ < step) {
+    if (run_left_ > 0) {
+      // Runs are crossed whole
+      const int64_t k = std::min(run_left_, step - step_);
+      head_ = std::max<int64_t>(head_ + run_dir_ * k, 0);
+      run_left_ -= k;
+      step_ += k;
+      continue;
+    }
+    Next();
+  }
+}
+
+bool TraceReplay::Next() {
+  if (step_ >= total_steps_) return false;
+  while (step_ >= block_end_ && run_left_ == 0 && block_ + 1 < index_.size()) LoadBlock(block_ + 1);
+  if (run_left_ == 0) {
+    const uint64_t code = Bits(2);
+    if (code == 3) {
+      run_dir_ = Bits(1) ? 1 : -1;
+      run_left_ = static_cast<int64_t>(Varint());
+      if (run_left_ == 0) throw std::runtime_error("Bad trace");
+    } else {
+      const bool changed = Bits(1);
+      const uint64_t write = Bits(sym_bits_);
+      if (write >= symbols_.size()) throw std::runtime_error("Bad trace");
+      if (static_cast<size_t>(head_) >= tape_.size()) tape_.resize(static_cast<size_t>(head_) + 1, 0);
+      tape_[head_] = static_cast<uint8_t>(write);
+      if (changed) {
+        state_ = static_cast<uint32_t>(Varint());
+        if (state_ >= states_.size()) throw std::runtime_error("Bad trace");
+      }
+      head_ = std::max<int64_t>(head_ + static_cast<int64_t>(code) - 1, 0);
+      ++step_;
+      return true;
+    }
+  }
+  head_ = std::max<int64_t>(head_ + run_dir_, 0);
+  --run_left_;
+  ++step_;
+  return true;
+}
+
+Config TraceReplay::CurrentConfig() const {
+  Config c;
+  const size_t cells = std::max(tape_.size(), static_cast<size_t>(head_) + 1);
+  c.tape.reserve(cells);
+  for (size_t i = 0; i < cells; ++i) c.tape.push_back(cell(static_cast<int64_t>(i)));
+  c.head = static_cast<int>(head_);
+  c.state = states_[state_];
+  return c;
+}
+
+}  // namespace tmc
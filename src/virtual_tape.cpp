@@ -0,0 +1,77 @@
+#include "tmc/virtual_tape.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define TMC_VIRTUAL_TAPE 1
+#endif
+
+namespace tmc {
+
+// Above this many dirty cells, Assign hands pages back to the kernel
+// instead of clearing them
+constexpr size_t kReleaseThreshold = size_t{1} << 20;
+
+VirtualTape::~VirtualTape() {
+#ifdef TMC_VIRTUAL_TAPE
+  if (mapped_) munmap(base_, kReserve + static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+#endif
+}
+
+void VirtualTape::Reserve() {
+  tried_ = true;
+#ifdef TMC_VIRTUAL_TAPE
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  void* mem = mmap(nullptr, kReserve + page, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (mem == MAP_FAILED) return;
+  uint8_t* base = static_cast<uint8_t*>(mem);
+  if (mprotect(base + kReserve, page, PROT_NONE) != 0) {
+    munmap(mem, kReserve + page);
+    return;
+  }
+  base_ = base;
+  capacity_ = kReserve;
+  mapped_ = true;
+#endif
+}
+
+void VirtualTape::Assign(const uint8_t* cells, size_t n) {
+  if (!tried_) Reserve();
+
+  if (mapped_) {
+    if (n > capacity_) throw std::length_error("tape exceeds reserved region");
+#if defined(TMC_VIRTUAL_TAPE) && defined(MADV_DONTNEED)
+    if (extent_ > kReleaseThreshold) {
+      // Anonymous private pages read back as zero after MADV_DONTNEED
+      const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      size_t keep = kReleaseThreshold / page * page;
+      madvise(base_ + keep, (extent_ - keep + page - 1) / page * page, MADV_DONTNEED);
+      extent_ = keep;
+    }
+#endif
+    std::memset(base_, 0, extent_);
+  } else {
+    fallback_.assign(std::max<size_t>(n + 4096, 4096), 0);
+    base_ = fallback_.data();
+    capacity_ = fallback_.size();
+  }
+  std::memcpy(base_, cells, n);
+  extent_ = n;
+}
+
+void VirtualTape::Grow(size_t cells) {
+  if (cells <= capacity_) return;
+  if (mapped_) throw std::length_error("tape exceeds reserved region");
+  fallback_.resize(std::max(cells, fallback_.size() * 2), 0);
+  base_ = fallback_.data();
+  capacity_ = fallback_.size();
+}
+
+}  // namespace tmc
@@ -1,6 +1,13 @@
 #include <gtest/gtest.h>
 #include "tmc/ir.hpp"
 #include "tmc/codegen.hpp"
+#include "tmc/hlcompiler.hpp"
+#include "tmc/parser.hpp"
+#include "tmc/simulator.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 namespace tmc {
 namespace {
@@ -74,5 +81,86 @@ TEST(CodegenTest, CompileSequence) {
   EXPECT_TRUE(tm.Validate(&error)) << error;
 }
 
+
+// Inputs from a bench test suite file (same format as tmc --bench)
+std::vector<std::string> ReadSuite(const std::string& path) {
+  std::ifstream ifs(path);
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+  return inputs;
+}
+
+// Emit `tm` as C++, build it with the host compiler, run it on every
+// fixture and compare each line of output against Simulator::Run
+void ExpectEmittedMatchesSimulator(const TM& tm, const std::string& name) {
+  namespace fs = std::filesystem;
+  const int64_t max_steps = 200000;  // keeps the large fixture cheap
+  fs::path dir = fs::path(::testing::TempDir()) / ("tmc_emit_" + name);
+  fs::create_directories(dir);
+  fs::path src = dir / "tm.cpp", exe = dir / "tm", in = dir / "in.txt", out = dir / "out.txt";
+  {
+    std::ofstream ofs(src);
+    ofs << ToCpp(tm);
+  }
+  std::string build = std::string(TMC_CXX_COMPILER) + " -O1 -std=c++17 -o " + exe.string() +
+                      " " + src.string();
+  ASSERT_EQ(std::system(build.c_str()), 0) << build;
+
+  Simulator sim(tm, max_steps);
+  std::vector<fs::path> fixtures;
+  for (const auto& entry : fs::directory_iterator(FIXTURES_DIR)) {
+    if (entry.path().extension() == ".txt") fixtures.push_back(entry.path());
+  }
+  ASSERT_FALSE(fixtures.empty());
+
+  for (const auto& fixture : fixtures) {
+    std::vector<std::string> inputs = ReadSuite(fixture.string());
+    {
+      std::ofstream ofs(in);
+      for (const auto& input : inputs) ofs << input << "\n";
+    }
+    std::string run = exe.string() + " " + std::to_string(max_steps) + " < " + in.string() +
+                      " > " + out.string();
+    ASSERT_EQ(std::system(run.c_str()), 0) << run;
+
+    std::ifstream ifs(out);
+    for (const auto& input : inputs) {
+      std::string verdict, tape;
+      int64_t steps = -1;
+      int hit_limit = -1;
+      ifs >> verdict >> steps >> hit_limit;
+      ifs.get();
+      std::getline(ifs, tape);
+      RunResult expected = sim.Run(input);
+      std::string where = fixture.filename().string() + ": " + input.substr(0, 20);
+      EXPECT_EQ(verdict, expected.accepted ? "ACCEPT" : "REJECT") << where;
+      EXPECT_EQ(steps, expected.steps) << where;
+      EXPECT_EQ(hit_limit == 1, expected.hit_limit) << where;
+      EXPECT_EQ(tape, expected.final_tape) << where;
+    }
+  }
+}
+
+TEST(CodegenTest, EmittedCppMatchesSimulatorYAML) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  ExpectEmittedMatchesSimulator(FromYAML(buf.str()), "yaml");
+}
+
+TEST(CodegenTest, EmittedCppMatchesSimulatorCompiled) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tmc");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tmc";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  ExpectEmittedMatchesSimulator(CompileProgram(ParseHL(buf.str())), "tmc");
+}
+
 }  // namespace
 }  // namespace tmc
@@ -3,6 +3,7 @@
 #include "tmc/parser.hpp"
 #include "tmc/hlcompiler.hpp"
 #include "tmc/simulator.hpp"
+#include "tmc/lockstep.hpp"
 #include <fstream>
 #include <sstream>
 
@@ -98,9 +99,12 @@ void VerifyExhaustive(const TM& tm,
                       const std::function<bool(const std::string&)>& oracle,
                       int step_limit = 10000000) {
   Simulator sim(tm, step_limit);
+  Lockstep lockstep(CompiledTM::Compile(tm), step_limit);
   auto inputs = AllStrings(alphabet, max_len);
+  auto batch = lockstep.Run(inputs);
 
-  for (const auto& input : inputs) {
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const auto& input = inputs[i];
     bool expected = oracle(input);
     auto result = sim.Run(input);
     EXPECT_EQ(result.accepted, expected)
@@ -108,6 +112,8 @@ void VerifyExhaustive(const TM& tm,
         << "oracle=" << (expected ? "accept" : "reject")
         << ", TM=" << (result.accepted ? "accept" : "reject")
         << (result.hit_limit ? " (HIT STEP LIMIT)" : "");
+    EXPECT_EQ(batch[i].accepted, result.accepted) << "lockstep, input=\"" << input << "\"";
+    EXPECT_EQ(batch[i].steps, result.steps) << "lockstep, input=\"" << input << "\"";
   }
 }
 
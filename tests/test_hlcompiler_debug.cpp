@@ -32,11 +32,11 @@ RunResult TraceRun(const std::string& src, const std::string& input,
 
   std::cout << "\nTrace for \"" << input << "\":\n";
   for (int i = 0; i < max_trace && !sim.Halted(); ++i) {
-    auto cfg = sim.CurrentConfig();
-    std::cout << "  " << i << ": " << cfg.state << " @" << cfg.head << " [";
-    for (size_t j = 0; j < cfg.tape.size(); ++j) {
-      if (j == static_cast<size_t>(cfg.head)) std::cout << ">";
-      std::cout << cfg.tape[j];
+    TapeWindow w = sim.Window(40);
+    std::cout << "  " << i << ": " << sim.CurrentState() << " @" << w.head() << " [";
+    for (int64_t j = w.first(); j <= w.last(); ++j) {
+      if (j == w.head()) std::cout << ">";
+      std::cout << w[j];
     }
     std::cout << "]\n";
     sim.Step();
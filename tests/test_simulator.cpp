@@ -2,8 +2,29 @@
 #include "tmc/ir.hpp"
 #include "tmc/codegen.hpp"
 #include "tmc/simulator.hpp"
+#include "tmc/compact_table.hpp"
+#include "tmc/execution.hpp"
+#include "tmc/batch.hpp"
+#include "tmc/checkpoint.hpp"
+#include "tmc/lockstep.hpp"
+#include "tmc/trace.hpp"
+#include "tmc/profile.hpp"
+#include "tmc/metrics.hpp"
+#include "tmc/packed_tape.hpp"
+#include "tmc/paged_tape.hpp"
+#include "tmc/parser.hpp"
+#include "tmc/hlcompiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
 #include <sstream>
+#include <thread>
+#include <tuple>
 
 namespace tmc {
 namespace {
@@ -206,5 +227,1685 @@ TEST(SimulatorTest, RunVsStepOnYAML) {
   }
 }
 
+// Run() jumps scan states straight to their stop symbol; the step count
+// must match single-stepping exactly, including scans longer than one
+// SIMD block and scans that straddle the step limit.
+TEST(SimulatorTest, ScanSkipMatchesStep) {
+  TM tm = MakeAnBn();
+
+  std::vector<std::string> inputs;
+  for (int n : {1, 7, 16, 33, 100, 257}) {
+    inputs.push_back(std::string(n, 'a') + std::string(n, 'b'));
+    inputs.push_back(std::string(n, 'a') + std::string(n + 1, 'b'));
+  }
+
+  for (int64_t limit : {1000000LL, 5000LL, 777LL}) {
+    Simulator sim(tm, limit);
+    for (const auto& input : inputs) {
+      auto run_result = sim.Run(input);
+
+      sim.Reset(input);
+      while (sim.Step() && sim.Steps() < limit) {}
+
+      EXPECT_EQ(run_result.steps, sim.Steps())
+          << "limit=" << limit << " |w|=" << input.size();
+      EXPECT_EQ(run_result.accepted, sim.Accepted());
+      EXPECT_EQ(run_result.hit_limit, !sim.Halted());
+    }
+  }
+}
+
+// RunFlat pads table rows to a power of two and picks a kernel per
+// stride; each one must match single-stepping, including the unpadded
+// kernel for alphabets over 32 symbols and the packed-tape kernels.
+TEST(SimulatorTest, FlatKernelsMatchStepForEachAlphabetSize) {
+  for (int k : {1, 3, 6, 12, 25, 40}) {
+    for (size_t pack_min : {SimConfig{}.pack_min_cells, size_t{0}}) {
+      std::vector<Symbol> syms;
+      for (char c = '!'; static_cast<int>(syms.size()) < k; ++c) {
+        if (c != kBlank && c != kWildcard) syms.push_back(c);
+      }
+      std::vector<Symbol> all = syms;
+      all.push_back(kBlank);
+
+      // Pseudo-random machine: 6 states, a few transitions to halt
+      TM tm;
+      tm.start = "q0";
+      tm.accept = "qA";
+      tm.reject = "qR";
+      tm.input_alphabet.insert(syms.begin(), syms.end());
+      uint32_t seed = 12345u + k;
+      auto next = [&seed]() { return seed = seed * 1103515245u + 12345u, seed >> 16; };
+      const Dir dirs[] = {Dir::L, Dir::R, Dir::R, Dir::S};
+      for (int q = 0; q < 6; ++q) {
+        for (Symbol c : all) {
+          uint32_t r = next();
+          std::string to = r % 97 == 0 ? "qA" : r % 89 == 0 ? "qR" : "q" + std::to_string(r % 6);
+          tm.AddTransition("q" + std::to_string(q), c, all[next() % all.size()],
+                           dirs[next() % 4], to);
+        }
+      }
+      tm.Finalize();
+
+      const int64_t limit = 20000;
+      SimConfig config;
+      config.pack_min_cells = pack_min;
+      Simulator sim(tm, limit, config);
+      for (int len : {0, 1, 5, 40}) {
+        std::string input;
+        for (int i = 0; i < len; ++i) input.push_back(syms[next() % syms.size()]);
+        RunResult result = sim.Run(input);
+
+        sim.Reset(input);
+        while (sim.Step() && sim.Steps() < limit) {}
+        std::string tape;
+        for (Symbol c : sim.CurrentConfig().tape) tape.push_back(c);
+        size_t l = tape.find_first_not_of(kBlank), r = tape.find_last_not_of(kBlank);
+        tape = l == std::string::npos ? "" : tape.substr(l, r - l + 1);
+
+        EXPECT_EQ(result.steps, sim.Steps()) << "k=" << k << " |w|=" << len;
+        EXPECT_EQ(result.accepted, sim.Accepted()) << "k=" << k << " |w|=" << len;
+        EXPECT_EQ(result.hit_limit, !sim.Halted()) << "k=" << k << " |w|=" << len;
+        EXPECT_EQ(result.final_tape, tape) << "k=" << k << " |w|=" << len;
+      }
+    }
+  }
+}
+
+// A scan that never meets a stop symbol runs until the step limit, in
+// either direction.
+TEST(SimulatorTest, ScanWithoutStopHitsLimit) {
+  TM tm;
+  tm.start = "q0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a'};
+  tm.AddTransition("q0", 'a', 'a', Dir::R, "q0");
+  tm.AddTransition("q0", kBlank, kBlank, Dir::R, "q0");
+  tm.Finalize();
+
+  Simulator sim(tm, 123456789);
+  auto result = sim.Run("aaa");
+  EXPECT_TRUE(result.hit_limit);
+  EXPECT_EQ(result.steps, 123456789);
+  EXPECT_EQ(result.final_tape, "aaa");
+
+  TM left;
+  left.start = "q0";
+  left.accept = "qA";
+  left.reject = "qR";
+  left.input_alphabet = {'a'};
+  left.AddTransition("q0", 'a', 'a', Dir::R, "q0");
+  left.AddTransition("q0", kBlank, 'a', Dir::L, "q1");
+  left.AddTransition("q1", 'a', 'a', Dir::L, "q1");
+  left.Finalize();
+
+  Simulator lsim(left, 5000);
+  result = lsim.Run("aaaa");
+  EXPECT_TRUE(result.hit_limit);
+  EXPECT_EQ(result.steps, 5000);
+  EXPECT_EQ(result.final_tape, "aaaaa");
+}
+
+// Packed scans test a word or vector of cells at a time; they must find
+// the same stop as the byte scans from any start, end and alignment
+TEST(TapeScanTest, PackedScansMatchUnpacked) {
+  uint32_t seed = 7;
+  auto next = [&seed]() { return seed = seed * 1103515245u + 12345u, seed >> 16; };
+  for (int bits : {2, 4}) {
+    const int symbols = 1 << bits;
+    for (int trial = 0; trial < 200; ++trial) {
+      // Long runs of loop symbols with the odd stop symbol between them
+      std::vector<bool> is_stop(symbols, false);
+      for (int s = 0; s < symbols; ++s) is_stop[s] = next() % 3 == 0;
+      StopSet stops = MakeStopSet(is_stop);
+      std::vector<uint8_t> cells(1 + next() % 700);
+      for (auto& c : cells) {
+        c = static_cast<uint8_t>(next() % symbols);
+        while (is_stop[c] && next() % 50) c = static_cast<uint8_t>(next() % symbols);
+      }
+      std::vector<uint8_t> packed = PackCells(cells.data(), cells.size(), bits);
+      packed.resize(packed.size() + 32, 0);  // vector loads may read past the end
+
+      size_t from = next() % cells.size();
+      size_t n = from + next() % (cells.size() - from + 1);
+      size_t fwd = FindStopForward(cells.data() + from, n - from, stops);
+      EXPECT_EQ(FindStopForwardPacked(packed.data(), from, n, bits, stops), from + fwd)
+          << "bits=" << bits << " trial=" << trial;
+      EXPECT_EQ(FindStopBackwardPacked(packed.data(), n, bits, stops),
+                FindStopBackward(cells.data(), n, stops))
+          << "bits=" << bits << " trial=" << trial;
+    }
+  }
+}
+
+// Every input over {a, b} up to max_len
+std::vector<std::string> AllStrings(int max_len) {
+  std::vector<std::string> out = {""};
+  for (size_t i = 0; i < out.size(); ++i) {
+    if (static_cast<int>(out[i].size()) == max_len) continue;
+    out.push_back(out[i] + 'a');
+    out.push_back(out[i] + 'b');
+  }
+  return out;
+}
+
+void ExpectSameResult(const RunResult& expected, const RunResult& actual,
+                      const std::string& input) {
+  EXPECT_EQ(expected.accepted, actual.accepted) << "input \"" << input << "\"";
+  EXPECT_EQ(expected.steps, actual.steps) << "input \"" << input << "\"";
+  EXPECT_EQ(expected.hit_limit, actual.hit_limit) << "input \"" << input << "\"";
+  EXPECT_EQ(expected.final_tape, actual.final_tape) << "input \"" << input << "\"";
+}
+
+// The run-length engine must reproduce the flat engine's RunResult exactly,
+// including runs cut short by the step limit.
+TEST(SimulatorTest, RleEngineMatchesFlat) {
+  TM tm = MakeAnBn();
+  SimConfig rle;
+  rle.engine = Engine::Rle;
+
+  for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+    Simulator flat_sim(tm, limit);
+    Simulator rle_sim(tm, limit, rle);
+    for (const auto& input : AllStrings(8)) {
+      ExpectSameResult(flat_sim.Run(input), rle_sim.Run(input), input);
+    }
+  }
+}
+
+TEST(SimulatorTest, RleEngineMatchesFlatOnYAML) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  SimConfig rle;
+  rle.engine = Engine::Rle;
+  Simulator flat_sim(tm, 10000000);
+  Simulator rle_sim(tm, 10000000, rle);
+
+  for (int n = 0; n <= 12; ++n) {
+    int t = n * (n + 1) / 2;
+    for (int m : {t - 1, t, t + 1}) {
+      if (m < 0) continue;
+      std::string input = std::string(n, 'a') + std::string(m, 'b');
+      ExpectSameResult(flat_sim.Run(input), rle_sim.Run(input), input);
+    }
+  }
+}
+
+// The block macro engine must match the flat engine for every block size,
+// including crossings memoized in one run and replayed in the next, and
+// crossings cut short by the step limit.
+TEST(SimulatorTest, MacroEngineMatchesFlat) {
+  TM tm = MakeAnBn();
+
+  for (int k = 1; k <= 8; ++k) {
+    SimConfig macro;
+    macro.engine = Engine::Macro;
+    macro.block_size = k;
+    for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+      Simulator flat_sim(tm, limit);
+      Simulator macro_sim(tm, limit, macro);
+      for (const auto& input : AllStrings(8)) {
+        ExpectSameResult(flat_sim.Run(input), macro_sim.Run(input), input);
+      }
+    }
+  }
+}
+
+TEST(SimulatorTest, MacroEngineMatchesFlatOnYAML) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  for (int k : {3, 8}) {
+    SimConfig macro;
+    macro.engine = Engine::Macro;
+    macro.block_size = k;
+    Simulator flat_sim(tm, 10000000);
+    Simulator macro_sim(tm, 10000000, macro);
+
+    for (int n = 0; n <= 12; ++n) {
+      int t = n * (n + 1) / 2;
+      for (int m : {t - 1, t, t + 1}) {
+        if (m < 0) continue;
+        std::string input = std::string(n, 'a') + std::string(m, 'b');
+        ExpectSameResult(flat_sim.Run(input), macro_sim.Run(input), input);
+      }
+    }
+  }
+}
+
+// With the shift rule, runs of equal blocks are crossed in one jump; on
+// the public HW3A suite that must still give the flat engine's results.
+TEST(SimulatorTest, MacroShiftRuleMatchesFlatOnHW3A) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  SimConfig macro;
+  macro.engine = Engine::Macro;
+  Simulator flat_sim(tm, 86000000000LL);
+  Simulator macro_sim(tm, 86000000000LL, macro);
+  for (const auto& input : inputs) {
+    ExpectSameResult(flat_sim.Run(input), macro_sim.Run(input),
+                     input.substr(0, 20));
+  }
+}
+
+
+TEST(SimulatorTest, HashLifeEngineMatchesFlat) {
+  TM tm = MakeAnBn();
+
+  SimConfig hashlife;
+  hashlife.engine = Engine::HashLife;
+  for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+    Simulator flat_sim(tm, limit);
+    Simulator hl_sim(tm, limit, hashlife);
+    for (const auto& input : AllStrings(8)) {
+      ExpectSameResult(flat_sim.Run(input), hl_sim.Run(input), input);
+    }
+  }
+}
+
+// A zero cache cap collects on every crossing; results must not change
+TEST(SimulatorTest, HashLifeEngineUnderMemoryPressure) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  SimConfig hashlife;
+  hashlife.engine = Engine::HashLife;
+  hashlife.cache_mb = 0;
+  Simulator flat_sim(tm, 10000000);
+  Simulator hl_sim(tm, 10000000, hashlife);
+  for (int n = 0; n <= 9; ++n) {
+    int t = n * (n + 1) / 2;
+    for (int m : {t - 1, t, t + 1}) {
+      if (m < 0) continue;
+      std::string input = std::string(n, 'a') + std::string(m, 'b');
+      ExpectSameResult(flat_sim.Run(input), hl_sim.Run(input), input);
+    }
+  }
+}
+
+TEST(SimulatorTest, HashLifeEngineMatchesFlatOnHW3A) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  SimConfig hashlife;
+  hashlife.engine = Engine::HashLife;
+  Simulator flat_sim(tm, 86000000000LL);
+  Simulator hl_sim(tm, 86000000000LL, hashlife);
+  for (const auto& input : inputs) {
+    ExpectSameResult(flat_sim.Run(input), hl_sim.Run(input), input.substr(0, 20));
+  }
+}
+
+
+TEST(SimulatorTest, JitEngineMatchesFlat) {
+  TM tm = MakeAnBn();
+
+  SimConfig jit;
+  jit.engine = Engine::Jit;
+  for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+    Simulator flat_sim(tm, limit);
+    Simulator jit_sim(tm, limit, jit);
+    for (const auto& input : AllStrings(8)) {
+      ExpectSameResult(flat_sim.Run(input), jit_sim.Run(input), input);
+    }
+    // Long enough to grow the tape from inside JIT code
+    std::string input = std::string(3000, 'a') + std::string(3000, 'b');
+    ExpectSameResult(flat_sim.Run(input), jit_sim.Run(input), "a^3000 b^3000");
+  }
+}
+
+// Tables over JitProgram::kMaxEntries run on the interpreter instead
+TEST(SimulatorTest, JitEngineFallsBackForLargeTables) {
+  const int n = 30000;  // 3 symbols per state: over the 65536-entry cap
+  TM tm;
+  tm.start = "s0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a', 'b'};
+  for (int i = 0; i < n; ++i) {
+    std::string next = i + 1 < n ? "s" + std::to_string(i + 1) : "qA";
+    tm.AddTransition("s" + std::to_string(i), kWildcard, 'a', Dir::R, next);
+  }
+  tm.Finalize();
+
+  SimConfig jit;
+  jit.engine = Engine::Jit;
+  Simulator sim(tm, 1000000, jit);
+  auto result = sim.Run("ab");
+  EXPECT_TRUE(result.accepted);
+  EXPECT_EQ(result.steps, n);
+  EXPECT_EQ(result.final_tape, std::string(n, 'a'));
+}
+
+
+TEST(SimulatorTest, ThreadedEngineMatchesFlat) {
+  TM tm = MakeAnBn();
+
+  for (int64_t profile : {int64_t{1} << 20, int64_t{0}}) {
+    SimConfig threaded;
+    threaded.engine = Engine::Threaded;
+    threaded.profile_steps = profile;
+    for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+      Simulator flat_sim(tm, limit);
+      Simulator threaded_sim(tm, limit, threaded);
+      for (const auto& input : AllStrings(8)) {
+        ExpectSameResult(flat_sim.Run(input), threaded_sim.Run(input), input);
+      }
+    }
+  }
+}
+
+// Compiled .tmc machines are full of Dir::S connector chains; fused chains
+// and profiled pairs must keep exact step counts, also when the limit
+// falls inside a chain
+TEST(SimulatorTest, ThreadedEngineMatchesFlatOnCompiledTM) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tmc");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tmc";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = CompileProgram(ParseHL(buf.str()));
+
+  SimConfig threaded;
+  threaded.engine = Engine::Threaded;
+  for (int64_t limit : {10000000LL, 1001LL, 333LL}) {
+    Simulator flat_sim(tm, limit);
+    Simulator threaded_sim(tm, limit, threaded);
+    for (int n = 0; n <= 9; ++n) {
+      int t = n * (n + 1) / 2;
+      for (int m : {t - 1, t, t + 1}) {
+        if (m < 0) continue;
+        std::string input = std::string(n, 'a') + std::string(m, 'b');
+        ExpectSameResult(flat_sim.Run(input), threaded_sim.Run(input), input);
+      }
+    }
+  }
+}
+
+
+// Tiny pages put page edges everywhere: the per-page kernel, the
+// hand-taken edge steps and page-by-page scans must match the flat tape
+TEST(SimulatorTest, PagedEngineMatchesFlat) {
+  TM tm = MakeAnBn();
+
+  for (int page_bits : {2, 3, 16}) {
+    SimConfig paged;
+    paged.engine = Engine::Paged;
+    paged.page_bits = page_bits;
+    for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+      Simulator flat_sim(tm, limit);
+      Simulator paged_sim(tm, limit, paged);
+      for (const auto& input : AllStrings(8)) {
+        ExpectSameResult(flat_sim.Run(input), paged_sim.Run(input), input);
+      }
+    }
+  }
+}
+
+TEST(SimulatorTest, PagedEngineMatchesFlatOnHW3A) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  SimConfig paged;
+  paged.engine = Engine::Paged;
+  paged.page_bits = 5;
+  for (int64_t limit : {int64_t{86000000000}, int64_t{123457}}) {
+    Simulator flat_sim(tm, limit);
+    Simulator paged_sim(tm, limit, paged);
+    for (const auto& input : inputs) {
+      ExpectSameResult(flat_sim.Run(input), paged_sim.Run(input), input.substr(0, 20));
+    }
+  }
+}
+
+TEST(PagedTapeTest, UnwrittenPagesShareOneBlankPage) {
+  PagedTape tape(4);
+  const uint8_t cells[] = {1, 2, 3};
+  tape.Assign(cells, 3);
+  EXPECT_EQ(tape.WrittenPages(), 1u);
+  EXPECT_EQ(tape.Read(0)[2], 3);
+
+  // Far pages read as the same blank page until written
+  EXPECT_EQ(tape.Read(7), tape.Read(1000));
+  EXPECT_EQ(tape.Read(7)[5], 0);
+  EXPECT_FALSE(tape.Written(7));
+
+  tape.Write(1000)[3] = 2;
+  EXPECT_TRUE(tape.Written(1000));
+  EXPECT_FALSE(tape.Written(999));
+  EXPECT_EQ(tape.WrittenPages(), 2u);
+  EXPECT_EQ(tape.Read(1000)[3], 2);
+  EXPECT_EQ(tape.Read(1000)[4], 0);
+}
+
+// The blank is symbol index 0 internally; a missing transition still
+// rejects by writing the lowest tape character, and characters outside
+// the alphabet read as that character too
+TEST(SimulatorTest, MissingTransitionWritesLowestSymbol) {
+  TM tm;
+  tm.start = "q0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a', 'b'};
+  tm.tape_alphabet.insert('A');
+  tm.AddTransition("q0", 'a', 'a', Dir::R, "q0");
+  tm.Finalize();
+
+  for (Engine engine : {Engine::Flat, Engine::Threaded, Engine::Jit}) {
+    SimConfig config;
+    config.engine = engine;
+    Simulator sim(tm, 1000, config);
+    auto result = sim.Run("aab");
+    EXPECT_FALSE(result.accepted);
+    EXPECT_EQ(result.steps, 3);
+    EXPECT_EQ(result.final_tape, "aaA");
+
+    result = sim.Run("az");
+    EXPECT_EQ(result.final_tape, "aA");
+  }
+}
+
+TEST(VirtualTapeTest, StartsBlankAndResets) {
+  VirtualTape tape;
+  const uint8_t cells[] = {3, 1, 2};
+  tape.Assign(cells, 3);
+  ASSERT_GE(tape.capacity(), 3u);
+  EXPECT_EQ(tape.extent(), 3u);
+  EXPECT_EQ(tape.data()[0], 3);
+  EXPECT_EQ(tape.data()[2], 2);
+
+  // Cells past the input read as blank (0) with no resize
+  size_t far = std::min<size_t>(tape.capacity() - 1, size_t{1} << 24);
+  EXPECT_EQ(tape.data()[far], 0);
+  tape.data()[far] = 7;
+  tape.Touch(far + 1);
+
+  // A reset clears everything written, near and far
+  tape.Assign(cells, 1);
+  EXPECT_EQ(tape.extent(), 1u);
+  EXPECT_EQ(tape.data()[1], 0);
+  EXPECT_EQ(tape.data()[far], 0);
+}
+
+// A machine that writes its way right across millions of cells: the
+// reserved tape must match single-stepping at every limit
+TEST(SimulatorTest, LongWriteSweepMatchesStep) {
+  TM tm;
+  tm.start = "q0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a'};
+  tm.tape_alphabet.insert('x');
+  tm.AddTransition("q0", kBlank, 'x', Dir::R, "q1");
+  tm.AddTransition("q0", 'a', 'x', Dir::R, "q1");
+  tm.AddTransition("q1", kBlank, 'a', Dir::R, "q0");
+  tm.Finalize();
+
+  for (int64_t limit : {int64_t{3000001}, int64_t{5}}) {
+    Simulator sim(tm, limit);
+    auto result = sim.Run("a");
+    EXPECT_TRUE(result.hit_limit);
+    EXPECT_EQ(result.steps, limit);
+
+    sim.Reset("a");
+    while (sim.Step() && sim.Steps() < limit) {}
+    std::string tape;
+    for (Symbol c : sim.CurrentConfig().tape) tape.push_back(c);
+    tape.erase(tape.find_last_not_of(kBlank) + 1);
+    EXPECT_EQ(result.final_tape, tape);
+  }
+}
+
+// The packed tape must not change any result, scans included
+TEST(SimulatorTest, PackedTapeMatchesUnpackedOnHW3A) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  SimConfig unpacked, packed;
+  unpacked.pack_min_cells = SIZE_MAX;
+  packed.pack_min_cells = 0;
+  for (int64_t limit : {int64_t{86000000000}, int64_t{123457}}) {
+    Simulator byte_sim(tm, limit, unpacked);
+    Simulator packed_sim(tm, limit, packed);
+    for (const auto& input : inputs) {
+      ExpectSameResult(byte_sim.Run(input), packed_sim.Run(input), input.substr(0, 20));
+    }
+  }
+}
+
+// Forcing the compact table must not change any result, scans included
+TEST(SimulatorTest, CompactTableMatchesDense) {
+  SimConfig compact;
+  compact.dense_table_mb = 0;
+  TM anbn = MakeAnBn();
+  for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+    Simulator dense_sim(anbn, limit);
+    Simulator compact_sim(anbn, limit, compact);
+    for (const auto& input : AllStrings(8)) {
+      ExpectSameResult(dense_sim.Run(input), compact_sim.Run(input), input);
+
+      // Step() reads the compact table too
+      compact_sim.Reset(input);
+      while (compact_sim.Steps() < limit && compact_sim.Step()) {}
+      EXPECT_EQ(compact_sim.Steps(), dense_sim.Run(input).steps) << input;
+    }
+  }
+
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  for (int64_t limit : {int64_t{86000000000}, int64_t{123457}}) {
+    Simulator dense_sim(tm, limit);
+    Simulator compact_sim(tm, limit, compact);
+    for (const auto& input : inputs) {
+      ExpectSameResult(dense_sim.Run(input), compact_sim.Run(input), input.substr(0, 20));
+    }
+  }
+
+  // Other engines expand the compact table on first use
+  compact.engine = Engine::Threaded;
+  Simulator dense_sim(tm, 123457);
+  Simulator threaded_sim(tm, 123457, compact);
+  for (const auto& input : inputs) {
+    ExpectSameResult(dense_sim.Run(input), threaded_sim.Run(input), input.substr(0, 20));
+  }
+}
+
+// Lazy and parallel table builds must not change any result
+TEST(SimulatorTest, TableBuildsMatchEager) {
+  TM anbn = MakeAnBn();
+  for (TableBuild build : {TableBuild::Lazy, TableBuild::Parallel}) {
+    SimConfig config;
+    config.table_build = build;
+    config.build_threads = 3;
+    for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+      Simulator eager_sim(anbn, limit);
+      Simulator sim(anbn, limit, config);
+      Simulator step_sim(anbn, limit, config);
+      for (const auto& input : AllStrings(8)) {
+        RunResult expected = eager_sim.Run(input);
+        ExpectSameResult(expected, sim.Run(input), input);
+
+        step_sim.Reset(input);
+        while (step_sim.Steps() < limit && step_sim.Step()) {}
+        EXPECT_EQ(step_sim.Steps(), expected.steps) << input;
+        EXPECT_EQ(step_sim.Accepted(), expected.accepted) << input;
+      }
+    }
+  }
+
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  SimConfig lazy;
+  lazy.table_build = TableBuild::Lazy;
+  Simulator eager_sim(tm, 123457);
+  Simulator lazy_sim(tm, 123457, lazy);
+  for (const auto& input : inputs) {
+    ExpectSameResult(eager_sim.Run(input), lazy_sim.Run(input), input.substr(0, 20));
+  }
+
+  // Other engines build the rows a lazy build has left
+  lazy.engine = Engine::Threaded;
+  Simulator threaded_sim(tm, 123457, lazy);
+  for (const auto& input : inputs) {
+    ExpectSameResult(eager_sim.Run(input), threaded_sim.Run(input), input.substr(0, 20));
+  }
+}
+
+TEST(CompactTableTest, DenseSparseAndSharedRows) {
+  CompactTable t;
+  const uint32_t def = CompactTable::Pack(9, 0, 0);
+  t.Reset(4, def);
+  t.AddRow({});                                            // shared default row
+  t.AddRow({{1, CompactTable::Pack(2, 3, 1)}});            // sparse
+  t.AddRow({{0, CompactTable::Pack(1, 1, -1)}, {3, CompactTable::Pack(0, 2, 0)}});  // dense
+  ASSERT_EQ(t.num_states(), 3u);
+
+  EXPECT_EQ(t.Lookup(0, 2), def);
+  EXPECT_EQ(t.Lookup(1, 0), def);
+  const uint32_t e = t.Lookup(1, 1);
+  EXPECT_EQ(CompactTable::Next(e), 2u);
+  EXPECT_EQ(CompactTable::Write(e), 3);
+  EXPECT_EQ(CompactTable::Code(e), 2u);
+  EXPECT_EQ(CompactTable::Code(t.Lookup(2, 0)), 0u);
+  EXPECT_EQ(t.Lookup(2, 2), def);
+
+  t.Set(1, 1, CompactTable::PackScan(1, 1));
+  t.Set(0, 1, CompactTable::PackScan(0, 1));  // ignored: row 0 is shared
+  EXPECT_EQ(CompactTable::Code(t.Lookup(1, 1)), CompactTable::kScanCode);
+  EXPECT_EQ(t.Lookup(0, 1), def);
+}
+
+// Executions on several threads share one CompiledTM and match Simulator
+TEST(ExecutionTest, SharedTableAcrossThreads) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  std::ifstream suite(std::string(FIXTURES_DIR) + "/hw3a_public.txt");
+  ASSERT_TRUE(suite.good()) << "Cannot open hw3a_public.txt";
+  std::vector<std::string> inputs;
+  std::string line;
+  while (std::getline(suite, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line == "(empty)" ? "" : line);
+  }
+
+  const int64_t limit = 123457;
+  Simulator sim(tm, limit);
+  std::vector<RunResult> expected;
+  for (const auto& input : inputs) expected.push_back(sim.Run(input));
+
+  // Compact tables too; Compile() builds a lazy request eagerly
+  SimConfig compact;
+  compact.dense_table_mb = 0;
+  compact.table_build = TableBuild::Lazy;
+  for (const SimConfig& config : {SimConfig{}, compact}) {
+    std::shared_ptr<const CompiledTM> compiled = CompiledTM::Compile(tm, config);
+    constexpr int kThreads = 4;
+    std::vector<std::vector<RunResult>> got(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&, t] {
+        Execution exec(compiled, limit);
+        for (size_t i = t; i < inputs.size(); i += kThreads) got[t].push_back(exec.Run(inputs[i]));
+      });
+    }
+    for (auto& th : threads) th.join();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      ExpectSameResult(expected[i], got[i % kThreads][i / kThreads], inputs[i].substr(0, 20));
+    }
+  }
+}
+
+TEST(ExecutionTest, FinalTapeIsOptional) {
+  TM tm = MakeAnBn();
+  Execution exec(CompiledTM::Compile(tm));
+  RunOptions no_tape;
+  no_tape.final_tape = false;
+  for (const auto& input : AllStrings(6)) {
+    RunResult full = exec.Run(input);
+    RunResult bare = exec.Run(input, no_tape);
+    EXPECT_EQ(bare.accepted, full.accepted) << input;
+    EXPECT_EQ(bare.steps, full.steps) << input;
+    EXPECT_EQ(bare.hit_limit, full.hit_limit) << input;
+    EXPECT_TRUE(bare.final_tape.empty()) << input;
+  }
+}
+
+// Every engine skips the tape decode when asked to
+TEST(SimulatorTest, FinalTapeIsOptionalOnEveryEngine) {
+  TM tm = MakeAnBn();
+  RunOptions no_tape;
+  no_tape.final_tape = false;
+  for (Engine engine : {Engine::Flat, Engine::Rle, Engine::Macro, Engine::HashLife, Engine::Jit,
+                        Engine::Threaded, Engine::Paged}) {
+    SimConfig config;
+    config.engine = engine;
+    Simulator sim(tm, 10000, config);
+    for (const auto& input : {std::string("aabb"), std::string("aab")}) {
+      RunResult full = sim.Run(input);
+      RunResult bare = sim.Run(input, no_tape);
+      EXPECT_FALSE(full.final_tape.empty()) << static_cast<int>(engine) << " " << input;
+      EXPECT_TRUE(bare.final_tape.empty()) << static_cast<int>(engine) << " " << input;
+      EXPECT_EQ(bare.accepted, full.accepted) << static_cast<int>(engine) << " " << input;
+      EXPECT_EQ(bare.steps, full.steps) << static_cast<int>(engine) << " " << input;
+    }
+  }
+}
+
+// Simulators built on one shared compact table, with engines that need
+// the dense tables
+TEST(SimulatorTest, SharedCompactTableServesEveryEngine) {
+  TM tm = MakeAnBn();
+  SimConfig compact;
+  compact.dense_table_mb = 0;
+  std::shared_ptr<const CompiledTM> compiled = CompiledTM::Compile(tm, compact);
+  ASSERT_FALSE(compiled->dense());
+
+  Simulator reference(tm, 1000);
+  for (Engine engine : {Engine::Flat, Engine::Rle, Engine::Threaded, Engine::Paged}) {
+    SimConfig config;
+    config.engine = engine;
+    Simulator sim(compiled, 1000, config);
+    for (const auto& input : AllStrings(6)) {
+      ExpectSameResult(reference.Run(input), sim.Run(input), input);
+    }
+  }
+  EXPECT_FALSE(compiled->dense());
+}
+
+TEST(BatchTest, ResultsComeBackInInputOrder) {
+  TM tm = MakeAnBn();
+  std::vector<std::string> inputs = AllStrings(7);
+  auto compiled = CompiledTM::Compile(tm);
+  Simulator sim(tm, 1000);
+
+  for (int threads : {1, 3}) {
+    BatchOptions options;
+    options.max_steps = 1000;
+    std::vector<size_t> seen;
+    options.on_case = [&](size_t i, const BatchCase&) { seen.push_back(i); };
+    std::vector<BatchCase> cases = RunBatch(compiled, inputs, threads, options);
+    ASSERT_EQ(cases.size(), inputs.size());
+    ASSERT_EQ(seen.size(), inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      EXPECT_EQ(seen[i], i);
+      EXPECT_FALSE(cases[i].skipped);
+      ExpectSameResult(sim.Run(inputs[i]), cases[i].result, inputs[i]);
+    }
+  }
+}
+
+// A case that hits the limit skips every later case, however the
+// threads ran them
+TEST(BatchTest, StopOnLimitSkipsLaterCases) {
+  TM tm = MakeAnBn();
+  std::vector<std::string> inputs = {"ab", "aaaabbbb", "aabb", "a", "aaabbb"};
+  BatchOptions options;
+  options.max_steps = 20;  // "aaaabbbb" needs more
+  options.stop_on_limit = true;
+  for (int threads : {1, 2, 4}) {
+    std::vector<BatchCase> cases = RunBatch(CompiledTM::Compile(tm), inputs, threads, options);
+    EXPECT_FALSE(cases[0].skipped);
+    EXPECT_TRUE(cases[0].result.accepted);
+    EXPECT_FALSE(cases[1].skipped);
+    EXPECT_TRUE(cases[1].result.hit_limit);
+    for (size_t i = 2; i < inputs.size(); ++i) EXPECT_TRUE(cases[i].skipped) << i;
+  }
+}
+
+// Every lane must end exactly as the flat engine does, including runs
+// cut short by the step limit and inputs longer than a lane takes
+TEST(LockstepTest, MatchesFlat) {
+  TM tm = MakeAnBn();
+  std::vector<std::string> inputs = AllStrings(10);
+  inputs.push_back(std::string(3000, 'a') + std::string(3000, 'b'));
+  for (int64_t limit : {1000000LL, 40LL, 7LL}) {
+    Simulator sim(tm, limit);
+    Lockstep lockstep(CompiledTM::Compile(tm), limit);
+    EXPECT_GT(lockstep.lanes(), 0);
+    std::vector<RunResult> results = lockstep.Run(inputs);
+    ASSERT_EQ(results.size(), inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) ExpectSameResult(sim.Run(inputs[i]), results[i], inputs[i]);
+  }
+}
+
+// A head that runs right forever leaves its lane's tape and finishes on
+// the Execution
+TEST(LockstepTest, HeadsOffTheLaneFinishOnExecution) {
+  TM tm;
+  tm.start = "q0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a', 'b'};
+  tm.AddTransition("q0", 'a', 'b', Dir::R, "q0");
+  tm.AddTransition("q0", 'b', 'b', Dir::S, "qA");
+  tm.AddTransition("q0", kBlank, 'a', Dir::R, "q1");
+  tm.AddTransition("q1", kBlank, 'b', Dir::R, "q1");
+  tm.Finalize();
+
+  std::vector<std::string> inputs = AllStrings(6);
+  Simulator sim(tm, 5000);
+  Lockstep lockstep(CompiledTM::Compile(tm), 5000);
+  std::vector<RunResult> results = lockstep.Run(inputs);
+  for (size_t i = 0; i < inputs.size(); ++i) ExpectSameResult(sim.Run(inputs[i]), results[i], inputs[i]);
+}
+
+// Bounces between cells 0 and 1 forever on input "a"; rejects "b"
+TM MakeBouncer() {
+  TM tm;
+  tm.start = "q0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a', 'b'};
+  tm.AddTransition("q0", 'a', 'a', Dir::R, "q1");
+  tm.AddTransition("q0", 'b', 'b', Dir::S, "qR");
+  for (Symbol sym : {Symbol('a'), Symbol('b'), kBlank}) tm.AddTransition("q1", sym, sym, Dir::L, "q0");
+  tm.Finalize();
+  return tm;
+}
+
+// A set stop flag ends a runaway run on every engine that polls it by
+// step count, keeping the steps and tape so far
+TEST(SimulatorTest, StopFlagEndsRunawayRuns) {
+  TM tm = MakeBouncer();
+  std::atomic<bool> stop{true};
+  RunOptions options;
+  options.stop = &stop;
+  for (Engine engine : {Engine::Flat, Engine::Rle, Engine::Macro, Engine::Jit,
+                        Engine::Threaded, Engine::Paged, Engine::HashLife}) {
+    SimConfig config;
+    config.engine = engine;
+    Simulator sim(tm, int64_t{1} << 50, config);
+    RunResult r = sim.Run("a", options);
+    EXPECT_TRUE(r.timed_out) << static_cast<int>(engine);
+    EXPECT_FALSE(r.accepted);
+    EXPECT_FALSE(r.hit_limit);
+    EXPECT_LT(r.steps, int64_t{1} << 40);
+    EXPECT_EQ(r.final_tape, "a");
+
+    stop = false;
+    RunResult halted = sim.Run("b", options);
+    EXPECT_FALSE(halted.timed_out);
+    EXPECT_EQ(halted.steps, 1);
+    stop = true;
+  }
+}
+
+TEST(SimulatorTest, DeadlineEndsRunawayRuns) {
+  TM tm = MakeBouncer();
+  for (Engine engine : {Engine::Flat, Engine::Macro}) {
+    SimConfig config;
+    config.engine = engine;
+    Simulator sim(tm, int64_t{1} << 50, config);
+    RunOptions options;
+    options.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(30);
+    const auto t0 = std::chrono::steady_clock::now();
+    RunResult r = sim.Run("a", options);
+    EXPECT_LT(std::chrono::steady_clock::now() - t0, std::chrono::seconds(5));
+    EXPECT_TRUE(r.timed_out);
+    EXPECT_GT(r.steps, 0);
+
+    RunOptions cpu;
+    cpu.cpu_ms = 30;
+    r = sim.Run("a", cpu);
+    EXPECT_TRUE(r.timed_out);
+  }
+}
+
+// Runaway cases time out instead of running to the step cap, and the
+// first one stops the rest
+TEST(BatchTest, TimeoutStopsRunawayCases) {
+  TM tm = MakeBouncer();
+  std::vector<std::string> inputs(4, "a");
+  BatchOptions options;
+  options.max_steps = int64_t{1} << 50;
+  options.timeout_ms = 30;
+  options.stop_on_limit = true;
+  for (int threads : {1, 2}) {
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<BatchCase> cases = RunBatch(CompiledTM::Compile(tm), inputs, threads, options);
+    EXPECT_LT(std::chrono::steady_clock::now() - t0, std::chrono::seconds(5));
+    EXPECT_TRUE(cases[0].result.timed_out);
+    for (size_t i = 1; i < inputs.size(); ++i) EXPECT_TRUE(cases[i].skipped) << i;
+  }
+}
+
+// The deadline covers the whole lockstep batch
+TEST(LockstepTest, StopFlagTimesOutUnfinishedInputs) {
+  TM tm = MakeBouncer();
+  std::atomic<bool> stop{true};
+  RunOptions options;
+  options.stop = &stop;
+  Lockstep lockstep(CompiledTM::Compile(tm), int64_t{1} << 50);
+  std::vector<RunResult> results = lockstep.Run({"a", "b", "ab", std::string(5000, 'a')}, options);
+  EXPECT_TRUE(results[0].timed_out);
+  EXPECT_FALSE(results[1].timed_out);  // rejected in the first block
+  EXPECT_FALSE(results[1].accepted);
+  EXPECT_TRUE(results[2].timed_out);
+  EXPECT_EQ(results[2].final_tape, "ab");
+  EXPECT_TRUE(results[3].timed_out);
+  EXPECT_EQ(results[3].steps, 0);
+}
+
+// What RunUntil should do, one Step() at a time
+StopReason StepUntil(Simulator& sim, const Breakpoints& bp, int64_t max_steps) {
+  while (true) {
+    if (sim.Halted()) return StopReason::Halted;
+    if (sim.Steps() >= max_steps) return StopReason::Limit;
+    const int64_t at = std::max<int64_t>(sim.Head(), 0);
+    const Symbol before = sim.Window(0)[at];
+    if (!sim.Step()) return StopReason::Halted;
+    if (std::count(bp.states.begin(), bp.states.end(), sim.CurrentState())) return StopReason::State;
+    if (std::count(bp.watch.begin(), bp.watch.end(), at) && sim.Window(0)[at] != before) {
+      return StopReason::Watch;
+    }
+    if (std::max<int64_t>(sim.Head(), 0) == bp.head) return StopReason::Head;
+    if (sim.Steps() == bp.step) return StopReason::Step;
+  }
+}
+
+// RunUntil stops exactly where single steps reach the same breakpoint,
+// scans and packed or compact tapes included, and carries on from there
+TEST(SimulatorTest, RunUntilMatchesStep) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  SimConfig packed, compact;
+  packed.pack_min_cells = 0;
+  compact.dense_table_mb = 0;
+  std::vector<Breakpoints> sets(5);
+  sets[0].states = {"appnd_find213", "rewind234", "qA"};
+  sets[1].step = 1000;
+  sets[2].head = 7;
+  sets[3].watch = {0, 6, 30};
+  sets[4].states = {"cnt_scan21"};
+  sets[4].head = 12;
+  sets[4].watch = {3};
+  const int64_t limit = 200000;
+  for (const SimConfig& config : {SimConfig{}, packed, compact}) {
+    Simulator fast(tm, limit, config), slow(tm, limit, config);
+    for (const Breakpoints& bp : sets) {
+      for (const std::string input : {"aabbb", "aaabbbbbb", "abb", ""}) {
+        fast.Reset(input);
+        slow.Reset(input);
+        for (int stop = 0; stop < 300; ++stop) {
+          const StopReason expected = StepUntil(slow, bp, limit);
+          ASSERT_EQ(fast.RunUntil(bp), expected) << input << " stop " << stop;
+          ASSERT_EQ(fast.Steps(), slow.Steps()) << input << " stop " << stop;
+          ASSERT_EQ(std::max<int64_t>(fast.Head(), 0), std::max<int64_t>(slow.Head(), 0));
+          ASSERT_EQ(fast.CurrentState(), slow.CurrentState());
+          TapeWindow a = fast.Window(40), b = slow.Window(40);
+          for (int64_t i = a.first(); i <= a.last(); ++i) ASSERT_EQ(a[i], b[i]) << "cell " << i;
+          if (expected == StopReason::Halted || expected == StopReason::Limit) break;
+        }
+        EXPECT_EQ(fast.Accepted(), slow.Accepted()) << input;
+      }
+    }
+  }
+}
+
+TEST(SimulatorTest, WindowReadsTheStepTape) {
+  TM tm = MakeAnBn();
+  Simulator sim(tm);
+  sim.Reset("aabb");
+  Breakpoints bp;
+  bp.step = 3;
+  EXPECT_EQ(sim.RunUntil(bp), StopReason::Step);
+  Config cfg = sim.CurrentConfig();
+  TapeWindow w = sim.Window(2);
+  EXPECT_EQ(w.head(), cfg.head);
+  EXPECT_EQ(w.first(), std::max(cfg.head - 2, 0));
+  EXPECT_EQ(w.last(), cfg.head + 2);
+  for (int64_t i = 0; i < static_cast<int64_t>(cfg.tape.size()); ++i) EXPECT_EQ(w[i], cfg.tape[i]);
+  EXPECT_EQ(w[100], kBlank);
+  EXPECT_EQ(sim.CurrentState(), cfg.state);
+}
+
+// Step-tape cells [0, cells) with trailing blanks dropped
+std::string TapeText(const Simulator& sim, int64_t cells) {
+  TapeWindow w = sim.Window(0);
+  std::string text;
+  for (int64_t i = 0; i < cells; ++i) text.push_back(w[i]);
+  while (!text.empty() && text.back() == kBlank) text.pop_back();
+  return text;
+}
+
+// Going back to any step, by snapshot and re-execution, gives the
+// configuration single steps reached there; with a budget small enough
+// to thin the snapshots, and with no history at all
+TEST(SimulatorTest, TimeTravelMatchesForwardSteps) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+  const std::string input = "aaaaaabbbbbbbbbbbbbbbbbbbbb";
+  const int64_t cells = 128;
+
+  struct Seen {
+    std::string state;
+    int64_t head;
+    std::string tape;
+  };
+  std::vector<Seen> seen;
+  SimConfig plain;
+  plain.history_mb = 0;
+  Simulator ref(tm, 1000000, plain);
+  ref.Reset(input);
+  while (true) {
+    seen.push_back({ref.CurrentState(), std::max<int64_t>(ref.Head(), 0), TapeText(ref, cells)});
+    if (ref.Halted()) break;
+    ref.Step();
+  }
+  const int64_t last = static_cast<int64_t>(seen.size()) - 1;
+
+  SimConfig thin, packed, coarse;
+  thin.history_steps = 1;
+  thin.history_mb = 1;
+  packed.pack_min_cells = 0;
+  packed.history_steps = 100;
+  coarse.history_steps = 5000;
+  for (const SimConfig& config : {thin, packed, coarse, plain}) {
+    Simulator sim(tm, 1000000, config);
+    sim.Reset(input);
+    ASSERT_EQ(sim.RunUntil({}), StopReason::Halted);
+    ASSERT_EQ(sim.Steps(), last);
+    auto expect_at = [&](int64_t step) {
+      ASSERT_EQ(sim.Steps(), step);
+      EXPECT_EQ(sim.CurrentState(), seen[step].state) << "step " << step;
+      EXPECT_EQ(std::max<int64_t>(sim.Head(), 0), seen[step].head) << "step " << step;
+      EXPECT_EQ(TapeText(sim, cells), seen[step].tape) << "step " << step;
+    };
+
+    for (int i = 0; i < 20; ++i) {
+      ASSERT_TRUE(sim.StepBack());
+      expect_at(last - 1 - i);
+    }
+    uint64_t x = 12345;
+    for (int i = 0; i < 60; ++i) {
+      x = x * 6364136223846793005ull + 1442695040888963407ull;
+      const int64_t step = static_cast<int64_t>((x >> 33) % static_cast<uint64_t>(last + 1));
+      ASSERT_TRUE(sim.GoToStep(step));
+      expect_at(step);
+    }
+    EXPECT_FALSE(sim.GoToStep(last + 10));
+    EXPECT_TRUE(sim.Halted());
+
+    // Back to the latest visit of a state, or to step 0 without one
+    const std::string target = seen[last / 2].state;
+    int64_t expected = -1;
+    for (int64_t s = 0; s < last; ++s) {
+      if (seen[s].state == target) expected = s;
+    }
+    ASSERT_TRUE(sim.RunBackUntil([&](const Simulator& s) { return s.CurrentState() == target; }));
+    expect_at(expected);
+    EXPECT_FALSE(sim.RunBackUntil([](const Simulator&) { return false; }));
+    expect_at(0);
+    EXPECT_FALSE(sim.StepBack());
+  }
+}
+
+// Resuming from any checkpoint, after a trip through a file, finishes
+// exactly as the uninterrupted run does
+TEST(CheckpointTest, ResumeMatchesUninterrupted) {
+  TM tm = MakeAnBn();
+  const std::string path = testing::TempDir() + "/tmc_checkpoint_test.ckpt";
+  SimConfig packed;
+  packed.pack_min_cells = 0;
+  for (const SimConfig& config : {SimConfig{}, packed}) {
+    for (int64_t limit : {int64_t{1000000}, int64_t{37}}) {
+      Execution exec(CompiledTM::Compile(tm, config), limit);
+      for (const std::string input : {"aaaaabbbbb", "aaaaabbbb", "aaabbbbbb", ""}) {
+        RunResult expected = exec.Run(input);
+        std::vector<Checkpoint> ckpts;
+        RunOptions options;
+        options.on_checkpoint = [&](Checkpoint& c) { ckpts.push_back(c); };
+        options.checkpoint_steps = 5;
+        ExpectSameResult(expected, exec.Run(input, options), input);
+        if (expected.steps > 10) {
+          EXPECT_FALSE(ckpts.empty()) << input;
+        }
+
+        for (Checkpoint& c : ckpts) {
+          c.tm_hash = HashTM(tm);
+          SaveCheckpoint(path, c);
+          Checkpoint loaded = LoadCheckpoint(path);
+          EXPECT_EQ(loaded.tm_hash, HashTM(tm));
+          EXPECT_EQ(loaded.input, input);
+          EXPECT_EQ(loaded.steps, c.steps);
+          ExpectSameResult(expected, exec.Resume(loaded), input);
+        }
+      }
+    }
+  }
+  std::remove(path.c_str());
+}
+
+// A stopped run hands over a final checkpoint, which carries on to the
+// step count the run would have reached
+TEST(CheckpointTest, StoppedRunLeavesCheckpoint) {
+  TM tm = MakeBouncer();
+  std::atomic<bool> stop{true};
+  std::vector<Checkpoint> ckpts;
+  RunOptions options;
+  options.stop = &stop;
+  options.on_checkpoint = [&](Checkpoint& c) { ckpts.push_back(c); };
+  Execution exec(CompiledTM::Compile(tm), 1000);
+  RunResult r = exec.Run("a", options);
+  EXPECT_TRUE(r.timed_out);
+  ASSERT_EQ(ckpts.size(), 1u);
+  EXPECT_EQ(ckpts[0].steps, r.steps);
+
+  RunResult resumed = exec.Resume(ckpts[0]);
+  EXPECT_FALSE(resumed.timed_out);
+  EXPECT_TRUE(resumed.hit_limit);
+  EXPECT_EQ(resumed.steps, 1000);
+}
+
+TEST(CheckpointTest, RejectsForeignAndDamagedFiles) {
+  TM tm = MakeAnBn();
+  TM changed = MakeAnBn();
+  changed.AddTransition("q1", kBlank, 'b', Dir::R, "q1");
+  changed.Finalize();
+  EXPECT_EQ(HashTM(tm), HashTM(MakeAnBn()));
+  EXPECT_NE(HashTM(tm), HashTM(changed));
+
+  const std::string path = testing::TempDir() + "/tmc_checkpoint_bad.ckpt";
+  Checkpoint c;
+  c.input = "aabb";
+  c.cells = {1, 1, 2, 2};
+  SaveCheckpoint(path, c);
+  std::ifstream ifs(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ifs.close();
+
+  auto write = [&](const std::string& bytes) {
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs << bytes;
+  };
+  write(data.substr(0, data.size() - 1));
+  EXPECT_THROW(LoadCheckpoint(path), std::runtime_error);
+  write("not a checkpoint at all");
+  EXPECT_THROW(LoadCheckpoint(path), std::runtime_error);
+  write(data + "x");
+  EXPECT_THROW(LoadCheckpoint(path), std::runtime_error);
+  std::remove(path.c_str());
+  EXPECT_THROW(LoadCheckpoint(path), std::runtime_error);
+
+  c.cells = {200};
+  Execution exec(CompiledTM::Compile(tm));
+  EXPECT_THROW(exec.Resume(c), std::runtime_error);
+}
+
+// Replay tape cells [0, cells) with trailing blanks dropped
+std::string TapeText(const TraceReplay& replay, int64_t cells) {
+  std::string text;
+  for (int64_t i = 0; i < cells; ++i) text.push_back(replay.cell(i));
+  while (!text.empty() && text.back() == kBlank) text.pop_back();
+  return text;
+}
+
+// A recorded run replays to the configuration single steps reached at
+// every step, stepping forward or seeking, with sync frames near and far
+// apart, and records the result the flat engine gives
+TEST(TraceTest, ReplayMatchesForwardSteps) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+  const std::string path = testing::TempDir() + "/tmc_trace_test.trc";
+  const int64_t cells = 128;
+
+  SimConfig compact, plain;
+  compact.dense_table_mb = 0;
+  plain.history_mb = 0;
+  for (const std::string input : {"aaaaabbbbbbbbbbbbbbb", "aaabbbbb", ""}) {
+    std::vector<std::tuple<std::string, int64_t, std::string>> seen;
+    Simulator ref(tm, 1000000, plain);
+    ref.Reset(input);
+    while (true) {
+      seen.emplace_back(ref.CurrentState(), std::max<int64_t>(ref.Head(), 0), TapeText(ref, cells));
+      if (ref.Halted()) break;
+      ref.Step();
+    }
+    const int64_t last = static_cast<int64_t>(seen.size()) - 1;
+
+    for (const SimConfig& config : {SimConfig{}, compact}) {
+      for (int64_t sync_steps : {int64_t{1}, int64_t{100}, int64_t{1} << 20}) {
+        auto compiled = CompiledTM::Compile(tm, config);
+        TraceRecorder recorder(compiled, 1000000, sync_steps);
+        ExpectSameResult(Execution(compiled).Run(input), recorder.Record(input, path), input);
+
+        TraceReplay replay(path);
+        ASSERT_EQ(replay.steps(), last);
+        EXPECT_EQ(replay.final_state(), std::get<0>(seen[last]));
+        auto expect_here = [&](int64_t step) {
+          ASSERT_EQ(replay.step(), step);
+          EXPECT_EQ(replay.state(), std::get<0>(seen[step])) << "step " << step;
+          EXPECT_EQ(replay.head(), std::get<1>(seen[step])) << "step " << step;
+          EXPECT_EQ(TapeText(replay, cells), std::get<2>(seen[step])) << "step " << step;
+        };
+        for (int64_t step = 0; step <= last; ++step) {
+          expect_here(step);
+          EXPECT_EQ(replay.Next(), step < last);
+        }
+        uint64_t x = 12345;
+        for (int i = 0; i < 60; ++i) {
+          x = x * 6364136223846793005ull + 1442695040888963407ull;
+          const int64_t step = static_cast<int64_t>((x >> 33) % static_cast<uint64_t>(last + 1));
+          replay.Seek(step);
+          expect_here(step);
+        }
+        replay.Seek(last + 10);
+        expect_here(last);
+      }
+    }
+  }
+  std::remove(path.c_str());
+}
+
+// A scan off into blank tape is one run, however long, and the step
+// limit ends the trace where it ends the run
+TEST(TraceTest, RecordsEndlessScansAsRuns) {
+  TM tm;
+  tm.start = "q0";
+  tm.accept = "qA";
+  tm.reject = "qR";
+  tm.input_alphabet = {'a', 'b'};
+  for (Symbol sym : {Symbol('a'), Symbol('b'), kBlank}) tm.AddTransition("q0", sym, sym, Dir::R, "q0");
+  tm.Finalize();
+  const std::string path = testing::TempDir() + "/tmc_trace_scan.trc";
+
+  TraceRecorder recorder(CompiledTM::Compile(tm), 100000000);
+  RunResult r = recorder.Record("ab", path);
+  EXPECT_TRUE(r.hit_limit);
+  EXPECT_EQ(r.steps, 100000000);
+  EXPECT_EQ(r.final_tape, "ab");
+
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  EXPECT_LT(static_cast<int64_t>(ifs.tellg()), 4096);
+  TraceReplay replay(path);
+  EXPECT_EQ(replay.steps(), 100000000);
+  EXPECT_EQ(replay.final_state(), "q0");
+  for (int64_t step : {int64_t{99999999}, int64_t{1}, int64_t{54321987}}) {
+    replay.Seek(step);
+    EXPECT_EQ(replay.head(), step);
+    EXPECT_EQ(replay.cell(1), 'b');
+  }
+  std::remove(path.c_str());
+}
+
+TEST(TraceTest, RejectsDamagedFiles) {
+  TM tm = MakeAnBn();
+  const std::string path = testing::TempDir() + "/tmc_trace_bad.trc";
+  TraceRecorder(CompiledTM::Compile(tm)).Record("aaabbb", path);
+  std::ifstream ifs(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ifs.close();
+
+  auto write = [&](const std::string& bytes) {
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs << bytes;
+  };
+  write(data.substr(0, data.size() - 1));
+  EXPECT_THROW(TraceReplay{path}, std::runtime_error);
+  write("not a trace at all");
+  EXPECT_THROW(TraceReplay{path}, std::runtime_error);
+  std::remove(path.c_str());
+  EXPECT_THROW(TraceReplay{path}, std::runtime_error);
+  EXPECT_THROW(TraceRecorder(CompiledTM::Compile(tm)).Record("ab", testing::TempDir() + "/no/such/dir/x.trc"),
+               std::runtime_error);
+}
+
+// Every transition's count is the number of single steps that took it,
+// summed over runs, dense or compact table, and a run gives the flat
+// engine's result
+TEST(ProfileTest, CountsMatchSingleSteps) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+  const std::vector<std::string> inputs = {"aaaaabbbbbbbbbbbbbbb", "aaabbbbb", "abb", ""};
+
+  std::map<std::pair<std::string, Symbol>, int64_t> expected;
+  std::map<std::string, int64_t> expected_states;
+  int64_t total = 0;
+  SimConfig plain;
+  plain.history_mb = 0;
+  Simulator ref(tm, 1000000, plain);
+  for (const std::string& input : inputs) {
+    ref.Reset(input);
+    while (!ref.Halted()) {
+      const int64_t head = std::max<int64_t>(ref.Head(), 0);
+      ++expected[{ref.CurrentState(), ref.Window(0)[head]}];
+      ++expected_states[ref.CurrentState()];
+      ++total;
+      ref.Step();
+    }
+  }
+
+  SimConfig compact;
+  compact.dense_table_mb = 0;
+  for (const SimConfig& config : {SimConfig{}, compact}) {
+    auto compiled = CompiledTM::Compile(tm, config);
+    Profiler profiler(compiled);
+    for (const std::string& input : inputs) {
+      ExpectSameResult(Execution(compiled).Run(input), profiler.Run(input), input);
+    }
+    EXPECT_EQ(profiler.runs(), 4);
+    EXPECT_EQ(profiler.steps(), total);
+
+    std::vector<TransitionHits> transitions = profiler.Transitions();
+    ASSERT_EQ(transitions.size(), expected.size());
+    for (size_t i = 0; i < transitions.size(); ++i) {
+      const TransitionHits& t = transitions[i];
+      EXPECT_EQ(t.hits, (expected[{t.state, t.read}])) << t.state << " " << t.read;
+      if (i > 0) {
+        EXPECT_GE(transitions[i - 1].hits, t.hits);
+      }
+      const Transition& rule = tm.delta.at(t.state).at(t.read);
+      EXPECT_EQ(t.write, rule.write);
+      EXPECT_EQ(t.dir, rule.dir);
+      EXPECT_EQ(t.next, rule.next);
+    }
+    std::vector<StateHits> states = profiler.States();
+    ASSERT_EQ(states.size(), expected_states.size());
+    for (const StateHits& s : states) EXPECT_EQ(s.hits, expected_states[s.state]) << s.state;
+
+    std::ostringstream csv, json;
+    WriteProfileCSV(csv, profiler);
+    WriteProfileJSON(json, profiler);
+    EXPECT_EQ(csv.str().rfind("kind,state,read,write,dir,next,hits,share\nstate," + states[0].state + ",", 0), 0u);
+    EXPECT_NE(json.str().find("\"steps\": " + std::to_string(total)), std::string::npos);
+
+    profiler.Clear();
+    EXPECT_EQ(profiler.steps(), 0);
+    EXPECT_TRUE(profiler.Transitions().empty());
+  }
+}
+
+// Samples come at the step they say, with the configuration single
+// steps reach there, and weigh in every sample point they stand for
+TEST(SampleTest, SamplesMatchSingleSteps) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+  const std::string input = "aaaaaabbbbbbbbbbbbbbbbbbbbb";
+
+  std::vector<std::tuple<std::string, int64_t, Symbol>> seen;
+  SimConfig plain;
+  plain.history_mb = 0;
+  Simulator ref(tm, 1000000, plain);
+  ref.Reset(input);
+  while (!ref.Halted()) {
+    const int64_t head = std::max<int64_t>(ref.Head(), 0);
+    seen.emplace_back(ref.CurrentState(), head, ref.Window(0)[head]);
+    ref.Step();
+  }
+
+  SimConfig packed;
+  packed.pack_min_cells = 0;
+  for (const SimConfig& config : {SimConfig{}, packed}) {
+    auto compiled = CompiledTM::Compile(tm, config);
+    std::vector<Sample> samples;
+    RunOptions options;
+    options.on_sample = [&](const Sample& s) { samples.push_back(s); };
+    options.sample_steps = 97;
+    Simulator sim(compiled, 1000000, config);
+    RunResult r = sim.Run(input, options);
+    EXPECT_EQ(r.steps, static_cast<int64_t>(seen.size()));
+    ASSERT_FALSE(samples.empty());
+
+    int64_t weight = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+      const Sample& s = samples[i];
+      if (i > 0) {
+        EXPECT_GT(s.steps, samples[i - 1].steps);
+      }
+      ASSERT_LT(s.steps, static_cast<int64_t>(seen.size()));
+      EXPECT_EQ(compiled->state_name(s.state), std::get<0>(seen[s.steps])) << "step " << s.steps;
+      EXPECT_EQ(s.head, std::get<1>(seen[s.steps])) << "step " << s.steps;
+      EXPECT_EQ(compiled->symbol(s.symbol), std::get<2>(seen[s.steps])) << "step " << s.steps;
+      weight += s.weight;
+    }
+    EXPECT_EQ(weight, samples.back().steps / 97);
+    EXPECT_GT(samples.size(), seen.size() / 97 / 2);
+
+    // A sample_now request is taken once, a little later
+    std::atomic<bool> now{true};
+    samples.clear();
+    options.sample_steps = 0;
+    options.sample_now = &now;
+    sim.Run(input, options);
+    EXPECT_FALSE(now);
+    ASSERT_EQ(samples.size(), 1u);
+    EXPECT_GE(samples[0].steps, 1);
+    EXPECT_EQ(samples[0].weight, 1);
+  }
+}
+
+TEST(SampleTest, PhasesMergeAsTheRunGrows) {
+  auto compiled = CompiledTM::Compile(MakeAnBn());
+  SampleProfile profile(compiled, 10, 4);
+  for (int64_t step = 0; step < 100; ++step) {
+    Sample s;
+    s.steps = step;
+    s.state = static_cast<uint32_t>(step % 2);
+    s.head = step;
+    profile.Add(s);
+  }
+  EXPECT_EQ(profile.samples(), 100);
+  EXPECT_EQ(profile.phase_steps(), 40);
+  std::vector<SamplePhase> phases = profile.Phases();
+  ASSERT_EQ(phases.size(), 3u);
+  int64_t total = 0;
+  for (size_t i = 0; i < phases.size(); ++i) {
+    EXPECT_EQ(phases[i].first_step, static_cast<int64_t>(i) * 40);
+    EXPECT_EQ(phases[i].end_step, static_cast<int64_t>(i + 1) * 40);
+    int64_t in_bins = 0;
+    for (const SampleBin& bin : phases[i].bins) {
+      EXPECT_LE(bin.head_lo, bin.head_hi);
+      in_bins += bin.samples;
+    }
+    EXPECT_EQ(in_bins, phases[i].samples);
+    total += phases[i].samples;
+  }
+  EXPECT_EQ(phases[0].samples, 40);
+  EXPECT_EQ(phases[2].max_head, 99);
+  EXPECT_EQ(total, 100);
+
+  SamplePhase all = profile.Total();
+  EXPECT_EQ(all.samples, 100);
+  // Heads 64-99 fall in the 64-127 bucket, half in each state
+  ASSERT_FALSE(all.bins.empty());
+  EXPECT_EQ(all.bins[0].head_lo, 64);
+  EXPECT_EQ(all.bins[0].head_hi, 127);
+  EXPECT_EQ(all.bins[0].samples, 18);
+
+  std::ostringstream csv;
+  WriteSamplesCSV(csv, profile);
+  EXPECT_EQ(csv.str().rfind("phase,first_step,end_step,state,symbol,head_lo,head_hi,samples,share\nall,", 0), 0u);
+}
+
+// Metrics agree with what single steps show, and measuring a run leaves
+// its result as it was
+TEST(MetricsTest, MatchSingleSteps) {
+  std::ifstream ifs(std::string(EXAMPLES_DIR) + "/triangular.tm");
+  ASSERT_TRUE(ifs.good()) << "Cannot open triangular.tm";
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+  TM tm = FromYAML(buf.str());
+
+  SimConfig compact, plain;
+  compact.dense_table_mb = 0;
+  plain.history_mb = 0;
+  for (const std::string input : {"aaaaabbbbbbbbbbbbbbb", "aaabbbbb", "abb", ""}) {
+    RunMetrics expected;
+    std::set<int64_t> written;
+    int last_dir = 0;
+    Simulator ref(tm, 1000000, plain);
+    ref.Reset(input);
+    while (!ref.Halted()) {
+      const int64_t head = std::max<int64_t>(ref.Head(), 0);
+      const Symbol before = ref.Window(0)[head];
+      const int64_t step = ref.Steps();
+      ref.Step();
+      if (ref.Steps() > step) expected.heatmap.Visit(step, head);
+      if (ref.Window(0)[head] != before) written.insert(head);
+      const int64_t to = std::max<int64_t>(ref.Head(), 0);
+      if (to != head) {
+        const int dir = to > head ? 1 : -1;
+        if (last_dir != 0 && dir != last_dir) ++expected.reversals;
+        last_dir = dir;
+        ++expected.travel;
+      }
+      expected.max_head = std::max(expected.max_head, to);
+    }
+
+    for (const SimConfig& config : {SimConfig{}, compact}) {
+      Execution exec(CompiledTM::Compile(tm, config));
+      RunOptions options;
+      options.metrics = true;
+      RunResult measured = exec.Run(input, options);
+      RunResult plain_run = exec.Run(input);
+      ExpectSameResult(plain_run, measured, input);
+      EXPECT_FALSE(plain_run.metrics);
+      ASSERT_TRUE(measured.metrics);
+      const RunMetrics& m = *measured.metrics;
+      EXPECT_EQ(m.max_head, expected.max_head) << input;
+      EXPECT_EQ(m.cells_written, static_cast<int64_t>(written.size())) << input;
+      EXPECT_EQ(m.reversals, expected.reversals) << input;
+      EXPECT_EQ(m.travel, expected.travel) << input;
+      EXPECT_EQ(m.peak_tape_bytes,
+                std::max<int64_t>(static_cast<int64_t>(input.size()), m.max_head + 1));
+
+      int64_t visits = 0;
+      for (int r = 0; r < m.heatmap.rows(); ++r) {
+        for (int c = 0; c < m.heatmap.cols(); ++c) visits += m.heatmap.at(r, c);
+      }
+      EXPECT_EQ(visits, measured.steps) << input;
+      // Scans are counted in one go, to the same buckets as step by step
+      EXPECT_EQ(m.heatmap.row_steps(), expected.heatmap.row_steps()) << input;
+      EXPECT_EQ(m.heatmap.col_cells(), expected.heatmap.col_cells()) << input;
+      ASSERT_EQ(m.heatmap.rows(), expected.heatmap.rows()) << input;
+      ASSERT_EQ(m.heatmap.cols(), expected.heatmap.cols()) << input;
+      for (int r = 0; r < m.heatmap.rows(); ++r) {
+        for (int c = 0; c < m.heatmap.cols(); ++c) {
+          EXPECT_EQ(m.heatmap.at(r, c), expected.heatmap.at(r, c)) << input << " " << r << "," << c;
+        }
+      }
+    }
+  }
+}
+
+TEST(MetricsTest, HeatmapMergesAsTheRunGrows) {
+  Heatmap map(4, 4);
+  for (int64_t step = 0; step < 100; ++step) map.Visit(step, step % 37);
+  EXPECT_EQ(map.row_steps(), 32);
+  EXPECT_EQ(map.col_cells(), 16);
+  EXPECT_EQ(map.rows(), 4);
+  EXPECT_EQ(map.cols(), 3);
+  int64_t visits = 0;
+  for (int r = 0; r < map.rows(); ++r) {
+    int64_t in_row = 0;
+    for (int c = 0; c < map.cols(); ++c) in_row += map.at(r, c);
+    EXPECT_EQ(in_row, r < 3 ? 32 : 4) << "row " << r;
+    visits += in_row;
+  }
+  EXPECT_EQ(visits, 100);
+  // Cells 0-15 of steps 0-31
+  EXPECT_EQ(map.at(0, 0), 16);
+
+  std::ostringstream pgm, csv;
+  WriteHeatmapPGM(pgm, map);
+  EXPECT_EQ(pgm.str().rfind("P5\n3 4\n255\n", 0), 0u);
+  EXPECT_EQ(pgm.str().size(), std::string("P5\n3 4\n255\n").size() + 12);
+  WriteHeatmapCSV(csv, map);
+  EXPECT_EQ(csv.str().rfind("first_step,end_step,first_cell,end_cell,visits\n0,32,0,16,16\n", 0), 0u);
+}
+
+// A run of moves in one call lands where the same moves one by one do,
+// including a left run pinned against cell 0
+TEST(MetricsTest, HeatmapRunsMatchSingleVisits) {
+  struct Run {
+    int64_t cell;
+    int dir;
+    int64_t n;
+  };
+  Heatmap one(8, 8), runs(8, 8);
+  int64_t step = 0;
+  for (const Run& run : {Run{0, 1, 5}, Run{4, 1, 40}, Run{44, -1, 30}, Run{14, -1, 25},
+                         Run{0, 1, 300}, Run{300, -1, 1000}}) {
+    runs.VisitRun(step, run.cell, run.dir, run.n);
+    int64_t cell = run.cell;
+    for (int64_t i = 0; i < run.n; ++i) {
+      one.Visit(step++, cell);
+      cell = std::max<int64_t>(cell + run.dir, 0);
+    }
+  }
+  EXPECT_EQ(runs.row_steps(), one.row_steps());
+  EXPECT_EQ(runs.col_cells(), one.col_cells());
+  ASSERT_EQ(runs.rows(), one.rows());
+  ASSERT_EQ(runs.cols(), one.cols());
+  for (int r = 0; r < one.rows(); ++r) {
+    for (int c = 0; c < one.cols(); ++c) EXPECT_EQ(runs.at(r, c), one.at(r, c)) << r << "," << c;
+  }
+}
+
 }  // namespace
 }  // namespace tmc